@@ -4,6 +4,10 @@
 #include <math.h>
 #include <assert.h>
 
+#ifndef LIBVXL_NO_THREADS
+#include <pthread.h>
+#endif
+
 #include <libvxl.h>
 
 #define LIBVXL_SPAN(base, off) ((struct libvxl_span*)((uint8_t*)(base) + (off)))
@@ -43,6 +47,69 @@ static void libvxl_geometry_set(struct libvxl_map* map, size_t x, size_t y,
     *val = (*val & ~((size_t)1 << bit)) | (state << bit);
 }
 
+// sets bits [z_start, z_end) of a column with masked word stores
+static void libvxl_geometry_set_range(struct libvxl_map* map, size_t x,
+                                      size_t y, size_t z_start, size_t z_end,
+                                      bool state) {
+    libvxl_assert(map && x < map->width && y < map->height
+                      && z_start <= z_end && z_end <= map->depth,
+                  "invalid input parameters");
+
+    size_t bits = sizeof(size_t) * 8;
+    size_t offset = z_start + (x + y * map->width) * map->depth;
+    size_t end = offset + z_end - z_start;
+
+    while (offset < end) {
+        size_t shift = offset % bits;
+        size_t count = bits - shift < end - offset ? bits - shift : end - offset;
+        size_t mask = (count < bits ? ((size_t)1 << count) - 1 : ~(size_t)0)
+            << shift;
+        size_t* val = map->geometry + offset / bits;
+
+        *val = state ? *val | mask : *val & ~mask;
+        offset += count;
+    }
+}
+
+// first z >= z_start of a column whose bit equals state, map->depth if none
+static size_t libvxl_geometry_find(struct libvxl_map* map, size_t x, size_t y,
+                                   size_t z_start, bool state) {
+    libvxl_assert(map && x < map->width && y < map->height,
+                  "invalid input parameters");
+
+    size_t bits = sizeof(size_t) * 8;
+    size_t base = (x + y * map->width) * map->depth;
+    size_t offset = base + z_start;
+    size_t end = base + map->depth;
+
+    while (offset < end) {
+        size_t val = map->geometry[offset / bits];
+        if (!state)
+            val = ~val;
+        val &= ~(size_t)0 << (offset % bits);
+
+        if (val) {
+            size_t found = offset - offset % bits
+                + __builtin_ctzll((unsigned long long)val);
+            return found < end ? found - base : map->depth;
+        }
+
+        offset += bits - offset % bits;
+    }
+
+    return map->depth;
+}
+
+static size_t libvxl_geometry_next_solid(struct libvxl_map* map, size_t x,
+                                         size_t y, size_t z) {
+    return libvxl_geometry_find(map, x, y, z, true);
+}
+
+static size_t libvxl_geometry_next_air(struct libvxl_map* map, size_t x,
+                                       size_t y, size_t z) {
+    return libvxl_geometry_find(map, x, y, z, false);
+}
+
 static int cmp(const void* a, const void* b) {
     struct libvxl_block* aa = (struct libvxl_block*)a;
     struct libvxl_block* bb = (struct libvxl_block*)b;
@@ -68,59 +135,157 @@ static void libvxl_chunk_put(struct libvxl_chunk* chunk, uint32_t pos,
            sizeof(struct libvxl_block));
 }
 
+static size_t libvxl_column_index(size_t x, size_t y) {
+    return x % LIBVXL_CHUNK_SIZE + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+}
+
+// first block of a column with a position greater or equal to pos
 static struct libvxl_block*
-libvxl_chunk_gequal_block(struct libvxl_chunk* chunk, uint32_t pos) {
+libvxl_column_gequal_block(struct libvxl_chunk* chunk, size_t column,
+                           uint32_t pos) {
     libvxl_assert(chunk, "chunk pointer is null");
 
+    struct libvxl_block* blocks = chunk->blocks + chunk->column_start[column];
     size_t start = 0;
-    size_t end = chunk->index;
+    size_t end = chunk->column_count[column];
     while (end > start) {
         size_t mid = (start + end) / 2;
-        if (pos > chunk->blocks[mid].position) {
+        if (pos > blocks[mid].position) {
             start = mid + 1;
-        } else if (pos < chunk->blocks[mid].position) {
+        } else if (pos < blocks[mid].position) {
             end = mid;
         } else {
-            return chunk->blocks + mid;
+            return blocks + mid;
         }
     }
 
-    return chunk->blocks + start;
+    return blocks + start;
+}
+
+static struct libvxl_block* libvxl_chunk_find(struct libvxl_chunk* chunk,
+                                              uint32_t pos) {
+    size_t column = libvxl_column_index(key_getx(pos), key_gety(pos));
+    struct libvxl_block* block
+        = libvxl_column_gequal_block(chunk, column, pos);
+    struct libvxl_block* end = chunk->blocks + chunk->column_start[column]
+        + chunk->column_count[column];
+
+    return block < end && block->position == pos ? block : NULL;
+}
+
+// Moves all columns into a new buffer, each with LIBVXL_COLUMN_SLACK free blocks.
+// Unless compacting, columns keep their capacity if it is larger already.
+// The given column gets room for at least needed blocks. The buffer leaves as
+// many blocks free at its tail as the columns take up, for columns to grow into.
+static void libvxl_chunk_layout(struct libvxl_chunk* chunk, size_t column,
+                                size_t needed, bool compact) {
+    uint16_t capacity[LIBVXL_CHUNK_COLUMNS];
+    size_t length = 0;
+
+    for (size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+        size_t c = chunk->column_count[k] + LIBVXL_COLUMN_SLACK;
+        if (!compact && chunk->column_capacity[k] > c)
+            c = chunk->column_capacity[k];
+        if (k == column && needed > c)
+            c = needed;
+        capacity[k] = c;
+        length += c;
+    }
+
+    struct libvxl_block* blocks = libvxl_mem_malloc(
+        length * LIBVXL_CHUNK_GROWTH * sizeof(struct libvxl_block));
+    size_t offset = 0;
+
+    for (size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+        memcpy(blocks + offset, chunk->blocks + chunk->column_start[k],
+               chunk->column_count[k] * sizeof(struct libvxl_block));
+        chunk->column_start[k] = offset;
+        chunk->column_capacity[k] = capacity[k];
+        offset += capacity[k];
+    }
+
+    libvxl_mem_free(chunk->blocks);
+    chunk->blocks = blocks;
+    chunk->length = length * LIBVXL_CHUNK_GROWTH;
+    chunk->tail = length;
+}
+
+// gives a full column room for more blocks, usually by moving it to the tail
+static void libvxl_column_grow(struct libvxl_chunk* chunk, size_t column) {
+    size_t count = chunk->column_count[column];
+    size_t needed = count * LIBVXL_CHUNK_GROWTH + LIBVXL_COLUMN_SLACK;
+
+    if (chunk->tail + needed > chunk->length) {
+        // also reclaims the blocks that moved columns left behind
+        libvxl_chunk_layout(chunk, column, needed, false);
+        return;
+    }
+
+    memcpy(chunk->blocks + chunk->tail,
+           chunk->blocks + chunk->column_start[column],
+           count * sizeof(struct libvxl_block));
+    chunk->column_start[column] = chunk->tail;
+    chunk->column_capacity[column] = needed;
+    chunk->tail += needed;
 }
 
 static void libvxl_chunk_insert(struct libvxl_chunk* chunk, uint32_t pos,
                                 uint32_t color) {
     libvxl_assert(chunk, "chunk pointer is null");
 
-    // TODO: use libvxl_chunk_gequal_block
+    size_t column = libvxl_column_index(key_getx(pos), key_gety(pos));
+    struct libvxl_block* block
+        = libvxl_column_gequal_block(chunk, column, pos);
+    size_t start = block - (chunk->blocks + chunk->column_start[column]);
+    size_t count = chunk->column_count[column];
 
-    size_t start = 0;
-    size_t end = chunk->index;
-    while (end > start) {
-        size_t mid = (start + end) / 2;
-        if (pos > chunk->blocks[mid].position) {
-            start = mid + 1;
-        } else if (pos < chunk->blocks[mid].position) {
-            end = mid;
-        } else { // diff=0, replace color
-            chunk->blocks[mid].color = color;
-            return;
-        }
+    if (start < count && block->position == pos) {
+        block->color = color; // replace color
+        return;
     }
 
-    if (chunk->index == chunk->length) { // needs to grow
-        chunk->length *= LIBVXL_CHUNK_GROWTH;
-        chunk->blocks = libvxl_mem_realloc(
-            chunk->blocks, chunk->length * sizeof(struct libvxl_block));
+    if (count == chunk->column_capacity[column]) { // needs to grow
+        libvxl_column_grow(chunk, column);
+        block = chunk->blocks + chunk->column_start[column] + start;
     }
 
-    memmove(chunk->blocks + start + 1, chunk->blocks + start,
-            (chunk->index - start) * sizeof(struct libvxl_block));
-    chunk->blocks[start].position = pos;
-    chunk->blocks[start].color = color;
+    memmove(block + 1, block, (count - start) * sizeof(struct libvxl_block));
+    block->position = pos;
+    block->color = color;
+    chunk->column_count[column]++;
     chunk->index++;
 }
 
+static void libvxl_chunk_erase(struct libvxl_chunk* chunk, uint32_t pos) {
+    libvxl_assert(chunk, "chunk pointer is null");
+
+    struct libvxl_block* block = libvxl_chunk_find(chunk, pos);
+    if (!block)
+        return;
+
+    size_t column = libvxl_column_index(key_getx(pos), key_gety(pos));
+    struct libvxl_block* end = chunk->blocks + chunk->column_start[column]
+        + chunk->column_count[column];
+
+    memmove(block, block + 1, (end - block - 1) * sizeof(struct libvxl_block));
+    chunk->column_count[column]--;
+    chunk->index--;
+
+    if (chunk->length > LIBVXL_CHUNK_SHRINK
+           * (chunk->index + LIBVXL_CHUNK_COLUMNS * LIBVXL_COLUMN_SLACK))
+        libvxl_chunk_layout(chunk, column, 0, true);
+}
+
+// copies all blocks of a chunk to out, sorted by position
+static void libvxl_chunk_gather(struct libvxl_chunk* chunk,
+                                struct libvxl_block* out) {
+    for (size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+        memcpy(out, chunk->blocks + chunk->column_start[k],
+               chunk->column_count[k] * sizeof(struct libvxl_block));
+        out += chunk->column_count[k];
+    }
+}
+
 static size_t libvxl_span_length(struct libvxl_span* s) {
     libvxl_assert(s, "span pointer is null");
 
@@ -158,10 +323,9 @@ bool libvxl_size(size_t* size, size_t* depth, const void* data, size_t len) {
     return true;
 }
 
-bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
-                   const void* data, size_t len) {
-    if (!map)
-        return false;
+// chunk arrays are sized for block_counts[chunk] blocks if given
+static void libvxl_alloc(struct libvxl_map* map, size_t w, size_t h,
+                         size_t d, bool solid, const size_t* block_counts) {
     map->streamed = 0;
     map->width = w;
     map->height = h;
@@ -173,146 +337,344 @@ bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
         for (size_t x = 0; x < sx; x++) {
             map->chunks[x + y * sx].length = LIBVXL_CHUNK_SIZE
                 * LIBVXL_CHUNK_SIZE * 2; // allows for two fully filled layers
+            if (block_counts && block_counts[x + y * sx]
+                > map->chunks[x + y * sx].length)
+                map->chunks[x + y * sx].length = block_counts[x + y * sx];
             map->chunks[x + y * sx].index = 0;
+            map->chunks[x + y * sx].tail = 0;
             map->chunks[x + y * sx].blocks = libvxl_mem_malloc(
                 map->chunks[x + y * sx].length * sizeof(struct libvxl_block));
+
+            // columns of loaded maps are laid out while they are decoded
+            size_t per_column = solid ?
+                0 :
+                map->chunks[x + y * sx].length / LIBVXL_CHUNK_COLUMNS;
+            for (size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+                map->chunks[x + y * sx].column_start[k] = k * per_column;
+                map->chunks[x + y * sx].column_count[k] = 0;
+                map->chunks[x + y * sx].column_capacity[k] = per_column;
+                map->chunks[x + y * sx].tail += per_column;
+            }
         }
     }
 
     size_t sg = (w * h * d + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8)
         * sizeof(size_t);
     map->geometry = libvxl_mem_malloc(sg);
-    if (data) {
-        memset(map->geometry, 0xFF, sg);
-    } else {
-        memset(map->geometry, 0x00, sg);
-        for (size_t y = 0; y < h; y++)
-            for (size_t x = 0; x < w; x++)
-                libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
-        return true;
+    memset(map->geometry, solid ? 0xFF : 0x00, sg);
+}
+
+// byte length of the column at the start of data, 0 if it is not complete yet
+// the number of colored blocks in it is added to blocks, if given
+static size_t libvxl_column_length(const void* data, size_t len,
+                                   size_t* blocks) {
+    size_t offset = 0;
+
+    while (1) {
+        if (offset + sizeof(struct libvxl_span) > len)
+            return 0;
+        struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+        if (offset + libvxl_span_length(desc) > len)
+            return 0;
+        if (blocks)
+            *blocks += desc->length > 0 ? desc->length - 1u :
+                                          desc->color_end + 1u - desc->color_start;
+        offset += libvxl_span_length(desc);
+        if (!desc->length)
+            return offset;
     }
+}
 
+static void libvxl_column_decode(struct libvxl_map* map, size_t x, size_t y,
+                                 const void* data) {
+    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+    size_t column = libvxl_column_index(x, y);
+    size_t column_start = chunk->index;
     size_t offset = 0;
-    for (size_t y = 0; y < map->height; y++) {
-        for (size_t x = 0; x < map->width; x++) {
-            struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
 
-            while (1) {
-                if (offset + sizeof(struct libvxl_span) - 1 >= len)
-                    return false;
-                struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
-                if (offset + libvxl_span_length(desc) - 1 >= len)
-                    return false;
-                uint32_t* color_data = (uint32_t*)LIBVXL_SPAN(
-                    data, offset + sizeof(struct libvxl_span));
-
-                for (size_t z = desc->air_start; z < desc->color_start; z++)
-                    libvxl_geometry_set(map, x, y, z, 0);
-
-                for (size_t z = desc->color_start; z <= desc->color_end;
-                    z++) // top color run
-                    libvxl_chunk_put(chunk, pos_key(x, y, z),
-                                     color_data[z - desc->color_start]);
-
-                size_t top_len = desc->color_end - desc->color_start + 1;
-                size_t bottom_len = desc->length - 1 - top_len;
-
-                if (desc->length > 0) {
-                    if (offset + libvxl_span_length(desc)
-                           + sizeof(struct libvxl_span) - 1
-                       >= len)
-                        return false;
-                    struct libvxl_span* desc_next
-                        = LIBVXL_SPAN(data, offset + libvxl_span_length(desc));
-                    for (size_t z = desc_next->air_start - bottom_len;
-                        z < desc_next->air_start; z++) // bottom color run
-                        libvxl_chunk_put(
-                            chunk, pos_key(x, y, z),
-                            color_data[z - (desc_next->air_start - bottom_len)
-                                       + top_len]);
-                    offset += libvxl_span_length(desc);
-                } else {
-                    offset += libvxl_span_length(desc);
-                    break;
-                }
-            }
+    while (1) {
+        struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+        uint32_t* color_data
+            = (uint32_t*)LIBVXL_SPAN(data, offset + sizeof(struct libvxl_span));
+
+        if (desc->air_start < desc->color_start)
+            libvxl_geometry_set_range(map, x, y, desc->air_start,
+                                      desc->color_start, false);
+
+        for (size_t z = desc->color_start; z <= desc->color_end;
+            z++) // top color run
+            libvxl_chunk_put(chunk, pos_key(x, y, z),
+                             color_data[z - desc->color_start]);
+
+        size_t top_len = desc->color_end - desc->color_start + 1;
+        size_t bottom_len = desc->length - 1 - top_len;
+
+        if (desc->length > 0) {
+            struct libvxl_span* desc_next
+                = LIBVXL_SPAN(data, offset + libvxl_span_length(desc));
+            for (size_t z = desc_next->air_start - bottom_len;
+                z < desc_next->air_start; z++) // bottom color run
+                libvxl_chunk_put(
+                    chunk, pos_key(x, y, z),
+                    color_data[z - (desc_next->air_start - bottom_len)
+                               + top_len]);
+            offset += libvxl_span_length(desc);
+        } else {
+            break;
         }
     }
 
-    for (size_t z = 0; z < map->depth; z++) {
-        for (size_t x = 0; x < map->width; x++) {
-            bool A = libvxl_geometry_get(map, x, 0, z);
-            bool B = libvxl_geometry_get(map, x, map->height - 1, z);
-
-            struct libvxl_chunk* c1 = chunk_fposition(map, x, 0);
-            struct libvxl_block* b1 = bsearch(
-                &(struct libvxl_block) {
-                    .position = pos_key(x, 0, z),
-                },
-                c1->blocks, c1->index, sizeof(struct libvxl_block), cmp);
-
-            struct libvxl_chunk* c2 = chunk_fposition(map, x, map->height - 1);
-            struct libvxl_block* b2 = bsearch(
-                &(struct libvxl_block) {
-                    .position = pos_key(x, map->height - 1, z),
-                },
-                c2->blocks, c2->index, sizeof(struct libvxl_block), cmp);
-
-            if (A && !B && !b1)
-                libvxl_chunk_insert(c1, pos_key(x, 0, z),
-                                    DEFAULT_COLOR(x, 0, z));
-
-            if (!A && B && !b2)
-                libvxl_chunk_insert(c2, pos_key(x, map->height - 1, z),
-                                    DEFAULT_COLOR(x, map->height - 1, z));
+    chunk->column_start[column] = column_start;
+    chunk->column_count[column] = chunk->index - column_start;
+    chunk->column_capacity[column] = chunk->index - column_start;
+    chunk->tail = chunk->index;
+}
+
+void libvxl_loader_begin(struct libvxl_loader* loader, struct libvxl_map* map,
+                         size_t w, size_t h, size_t d) {
+    libvxl_assert(loader && map, "loader or map is null");
+
+    libvxl_alloc(map, w, h, d, true, NULL);
+
+    loader->map = map;
+    loader->x = 0;
+    loader->y = 0;
+}
+
+size_t libvxl_loader_feed(struct libvxl_loader* loader, const void* data,
+                          size_t len) {
+    if (!loader || !data)
+        return 0;
+
+    struct libvxl_map* map = loader->map;
+    size_t offset = 0;
+
+    while (loader->y < map->height) {
+        size_t length
+            = libvxl_column_length((uint8_t*)data + offset, len - offset, NULL);
+        if (!length)
+            break;
+
+        libvxl_column_decode(map, loader->x, loader->y,
+                             (uint8_t*)data + offset);
+        offset += length;
+
+        if (++loader->x >= map->width) {
+            loader->x = 0;
+            loader->y++;
         }
+    }
 
-        for (size_t y = 0; y < map->height; y++) {
-            bool A = libvxl_geometry_get(map, 0, y, z);
-            bool B = libvxl_geometry_get(map, map->width - 1, y, z);
-
-            struct libvxl_chunk* c1 = chunk_fposition(map, 0, y);
-            struct libvxl_block* b1 = bsearch(
-                &(struct libvxl_block) {
-                    .position = pos_key(0, y, z),
-                },
-                c1->blocks, c1->index, sizeof(struct libvxl_block), cmp);
-
-            struct libvxl_chunk* c2 = chunk_fposition(map, map->width - 1, y);
-            struct libvxl_block* b2 = bsearch(
-                &(struct libvxl_block) {
-                    .position = pos_key(map->width - 1, y, z),
-                },
-                c2->blocks, c2->index, sizeof(struct libvxl_block), cmp);
-
-            if (A && !B && !b1)
-                libvxl_chunk_insert(c1, pos_key(0, y, z),
-                                    DEFAULT_COLOR(0, y, z));
-
-            if (!A && B && !b2)
-                libvxl_chunk_insert(c2, pos_key(map->width - 1, y, z),
-                                    DEFAULT_COLOR(map->width - 1, y, z));
+    return offset;
+}
+
+// Colors blocks at (x, y) that are solid while (x_other, y_other) is air.
+static void libvxl_fix_edge(struct libvxl_map* map, size_t x, size_t y,
+                            size_t x_other, size_t y_other) {
+    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+    size_t z = libvxl_geometry_next_solid(map, x, y, 0);
+
+    while (z < map->depth) {
+        if (libvxl_geometry_get(map, x_other, y_other, z)) {
+            z = libvxl_geometry_next_solid(
+                map, x, y, libvxl_geometry_next_air(map, x_other, y_other, z));
+            continue;
         }
+
+        if (!libvxl_chunk_find(chunk, pos_key(x, y, z)))
+            libvxl_chunk_insert(chunk, pos_key(x, y, z), DEFAULT_COLOR(x, y, z));
+
+        z = libvxl_geometry_next_solid(map, x, y, z + 1);
+    }
+}
+
+// Blocks on the map border are visible from the other side of the map when it wraps around.
+// Only chunks of rows [y_start, y_end) are modified, so disjoint row ranges can be fixed in parallel.
+static void libvxl_fix_edges(struct libvxl_map* map, size_t y_start,
+                             size_t y_end) {
+    for (size_t x = 0; x < map->width; x++) {
+        if (y_start == 0)
+            libvxl_fix_edge(map, x, 0, x, map->height - 1);
+        if (y_end == map->height)
+            libvxl_fix_edge(map, x, map->height - 1, x, 0);
     }
 
+    for (size_t y = y_start; y < y_end; y++) {
+        libvxl_fix_edge(map, 0, y, map->width - 1, y);
+        libvxl_fix_edge(map, map->width - 1, y, 0, y);
+    }
+}
+
+bool libvxl_loader_finish(struct libvxl_loader* loader) {
+    if (!loader || loader->y < loader->map->height)
+        return false;
+
+    libvxl_fix_edges(loader->map, 0, loader->map->height);
+
     return true;
 }
 
-static size_t find_successive_surface(struct libvxl_chunk* chunk,
-                                      size_t block_offset, int x, int y,
+struct libvxl_load_job {
+    struct libvxl_map* map;
+    const uint8_t* data;
+    const size_t* row_offsets;
+    size_t y_start, y_end;
+};
+
+static void* libvxl_load_decode(void* arg) {
+    struct libvxl_load_job* job = arg;
+    const uint8_t* data
+        = job->data + job->row_offsets[job->y_start / LIBVXL_CHUNK_SIZE];
+
+    for (size_t y = job->y_start; y < job->y_end; y++) {
+        for (size_t x = 0; x < job->map->width; x++) {
+            libvxl_column_decode(job->map, x, y, data);
+            data += libvxl_column_length(data, SIZE_MAX, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static void* libvxl_load_fix_edges(void* arg) {
+    struct libvxl_load_job* job = arg;
+    libvxl_fix_edges(job->map, job->y_start, job->y_end);
+    return NULL;
+}
+
+// runs func on every job, the first one on the calling thread
+static void libvxl_run_jobs(void* jobs, size_t job_size, size_t count,
+                            void* (*func)(void*)) {
+    uint8_t* job = jobs;
+#ifndef LIBVXL_NO_THREADS
+    pthread_t threads[count];
+    bool started[count];
+
+    for (size_t k = 1; k < count; k++)
+        started[k]
+            = !pthread_create(threads + k, NULL, func, job + k * job_size);
+
+    func(job);
+
+    for (size_t k = 1; k < count; k++) {
+        if (started[k])
+            pthread_join(threads[k], NULL);
+        else
+            func(job + k * job_size);
+    }
+#else
+    for (size_t k = 0; k < count; k++)
+        func(job + k * job_size);
+#endif
+}
+
+bool libvxl_create_parallel(struct libvxl_map* map, size_t w, size_t h,
+                            size_t d, const void* data, size_t len,
+                            size_t threads) {
+    if (!map)
+        return false;
+
+    if (!data || threads <= 1)
+        return libvxl_create(map, w, h, d, data, len);
+
+    // bands of chunk rows are decoded in parallel, they must not share
+    // geometry words
+    size_t chunk_rows = (h + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t chunk_cnt = (w + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    if ((LIBVXL_CHUNK_SIZE * w * d) % (sizeof(size_t) * 8))
+        threads = 1;
+    if (threads > chunk_rows)
+        threads = chunk_rows;
+
+    // find where every chunk row starts and how many blocks each chunk needs,
+    // this only hops from span to span and is cheap compared to decoding
+    size_t* row_offsets = libvxl_mem_malloc((chunk_rows + 1) * sizeof(size_t));
+    size_t* block_counts
+        = libvxl_mem_malloc(chunk_rows * chunk_cnt * sizeof(size_t));
+    memset(block_counts, 0, chunk_rows * chunk_cnt * sizeof(size_t));
+    size_t offset = 0;
+
+    for (size_t y = 0; y < h; y++) {
+        if (y % LIBVXL_CHUNK_SIZE == 0)
+            row_offsets[y / LIBVXL_CHUNK_SIZE] = offset;
+
+        for (size_t x = 0; x < w; x++) {
+            size_t length = libvxl_column_length(
+                (const uint8_t*)data + offset, len - offset,
+                block_counts + x / LIBVXL_CHUNK_SIZE
+                    + y / LIBVXL_CHUNK_SIZE * chunk_cnt);
+
+            if (!length) {
+                libvxl_mem_free(row_offsets);
+                libvxl_mem_free(block_counts);
+                libvxl_alloc(map, w, h, d, true, NULL);
+                return false;
+            }
+
+            offset += length;
+        }
+    }
+
+    row_offsets[chunk_rows] = offset;
+
+    libvxl_alloc(map, w, h, d, true, block_counts);
+    libvxl_mem_free(block_counts);
+
+    struct libvxl_load_job jobs[threads];
+    for (size_t k = 0; k < threads; k++) {
+        jobs[k] = (struct libvxl_load_job) {
+            .map = map,
+            .data = data,
+            .row_offsets = row_offsets,
+            .y_start = chunk_rows * k / threads * LIBVXL_CHUNK_SIZE,
+            .y_end = chunk_rows * (k + 1) / threads * LIBVXL_CHUNK_SIZE,
+        };
+
+        if (jobs[k].y_end > h)
+            jobs[k].y_end = h;
+    }
+
+    libvxl_run_jobs(jobs, sizeof(*jobs), threads, libvxl_load_decode);
+    // edges of one band depend on the geometry of others
+    libvxl_run_jobs(jobs, sizeof(*jobs), threads, libvxl_load_fix_edges);
+
+    libvxl_mem_free(row_offsets);
+    return true;
+}
+
+bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
+                   const void* data, size_t len) {
+    if (!map)
+        return false;
+
+    if (!data) {
+        libvxl_alloc(map, w, h, d, false, NULL);
+        for (size_t y = 0; y < h; y++)
+            for (size_t x = 0; x < w; x++)
+                libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
+        return true;
+    }
+
+    struct libvxl_loader loader;
+    libvxl_loader_begin(&loader, map, w, h, d);
+    libvxl_loader_feed(&loader, data, len);
+    return libvxl_loader_finish(&loader);
+}
+
+static size_t find_successive_surface(struct libvxl_block* next,
+                                      struct libvxl_block* end, int x, int y,
                                       size_t start,
                                       struct libvxl_block** current) {
-    libvxl_assert(chunk && current, "chunk or block pointer is null");
+    libvxl_assert(next && end && current, "block pointer is null");
 
-    *current = chunk->blocks + block_offset;
-    struct libvxl_block* end_marker = chunk->blocks + chunk->index;
+    *current = next;
 
-    if (*current < end_marker && (*current)->position == pos_key(x, y, start)) {
+    if (*current < end && (*current)->position == pos_key(x, y, start)) {
         while (1) {
             uint32_t next_z = key_getz((*current)->position) + 1;
             (*current)++;
 
-            if (*current >= end_marker
+            if (*current >= end
                || (*current)->position != pos_key(x, y, next_z))
                 return next_z;
         }
@@ -321,34 +683,29 @@ static size_t find_successive_surface(struct libvxl_chunk* chunk,
     }
 }
 
-static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
-                                 int x, int y, void* out, size_t* offset) {
-    libvxl_assert(map && chunk_offsets && out && offset,
-                  "invalid input parameters");
+static void libvxl_column_encode(struct libvxl_map* map, int x, int y,
+                                 void* out, size_t* offset) {
+    libvxl_assert(map && out && offset, "invalid input parameters");
 
     struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+    size_t column = libvxl_column_index(x, y);
+    struct libvxl_block* next = chunk->blocks + chunk->column_start[column];
+    struct libvxl_block* end = next + chunk->column_count[column];
 
     bool first_run = true;
-    size_t z
-        = key_getz(chunk->blocks[chunk_offsets[chunk - map->chunks]].position);
+    size_t z = next < end ? key_getz(next->position) : 0;
     while (1) {
-        size_t top_start = libvxl_geometry_get(map, x, y, z) ?
-            z :
-            key_getz(
-                chunk->blocks[chunk_offsets[chunk - map->chunks]].position);
+        size_t top_start = libvxl_geometry_next_solid(map, x, y, z);
 
         struct libvxl_block* last_surface_block;
-        size_t top_end
-            = find_successive_surface(chunk, chunk_offsets[chunk - map->chunks],
-                                      x, y, top_start, &last_surface_block);
+        size_t top_end = find_successive_surface(next, end, x, y, top_start,
+                                                 &last_surface_block);
 
         size_t bottom_start = map->depth;
 
         if (top_end == map->depth || !libvxl_geometry_get(map, x, y, top_end)) {
             bottom_start = top_end;
-        } else if (last_surface_block < chunk->blocks + chunk->index
-                  && key_discardz(last_surface_block->position)
-                      == pos_key(x, y, 0)) {
+        } else if (last_surface_block < end) {
             bottom_start = key_getz(last_surface_block->position);
         }
 
@@ -367,9 +724,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
 
         for (size_t k = top_start; k < top_end; k++) {
             *(uint32_t*)LIBVXL_SPAN(out, *offset)
-                = (chunk->blocks[chunk_offsets[chunk - map->chunks]++].color
-                   & 0xFFFFFF)
-                | 0x7F000000;
+                = ((next++)->color & 0xFFFFFF) | 0x7F000000;
             *offset += sizeof(uint32_t);
         }
 
@@ -381,8 +736,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
         } else { // bottom_start < map->depth
             struct libvxl_block* last_surface_block;
             size_t bottom_end = find_successive_surface(
-                chunk, chunk_offsets[chunk - map->chunks], x, y, bottom_start,
-                &last_surface_block);
+                next, end, x, y, bottom_start, &last_surface_block);
 
             // there are more spans to follow, emit bottom colors
             if (bottom_end < map->depth) {
@@ -391,10 +745,7 @@ static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
 
                 for (size_t k = bottom_start; k < bottom_end; k++) {
                     *(uint32_t*)LIBVXL_SPAN(out, *offset)
-                        = (chunk->blocks[chunk_offsets[chunk - map->chunks]++]
-                               .color
-                           & 0xFFFFFF)
-                        | 0x7F000000;
+                        = ((next++)->color & 0xFFFFFF) | 0x7F000000;
                     *offset += sizeof(uint32_t);
                 }
 
@@ -417,11 +768,6 @@ void libvxl_stream(struct libvxl_stream* stream, struct libvxl_map* map,
     stream->pos = pos_key(0, 0, 0);
     stream->buffer_offset = 0;
     stream->buffer = libvxl_mem_malloc(stream->chunk_size * 2);
-
-    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-    stream->chunk_offsets = libvxl_mem_malloc(sx * sy * sizeof(size_t));
-    memset(stream->chunk_offsets, 0, sx * sy * sizeof(size_t));
 }
 
 void libvxl_stream_free(struct libvxl_stream* stream) {
@@ -429,7 +775,6 @@ void libvxl_stream_free(struct libvxl_stream* stream) {
         return;
     stream->map->streamed--;
     libvxl_mem_free(stream->buffer);
-    libvxl_mem_free(stream->chunk_offsets);
 }
 
 #ifndef min
@@ -441,9 +786,9 @@ size_t libvxl_stream_read(struct libvxl_stream* stream, void* out) {
         return 0;
     while (stream->buffer_offset < stream->chunk_size
           && key_gety(stream->pos) < stream->map->height) {
-        libvxl_column_encode(stream->map, stream->chunk_offsets,
-                             key_getx(stream->pos), key_gety(stream->pos),
-                             stream->buffer, &stream->buffer_offset);
+        libvxl_column_encode(stream->map, key_getx(stream->pos),
+                             key_gety(stream->pos), stream->buffer,
+                             &stream->buffer_offset);
         if (key_getx(stream->pos) + 1 < stream->map->width)
             stream->pos
                 = pos_key(key_getx(stream->pos) + 1, key_gety(stream->pos), 0);
@@ -465,21 +810,116 @@ size_t libvxl_stream_read(struct libvxl_stream* stream, void* out) {
 void libvxl_write(struct libvxl_map* map, void* out, size_t* size) {
     if (!map || !out)
         return;
-    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-
-    size_t* chunk_offsets = libvxl_mem_malloc(sx * sy * sizeof(size_t));
-    memset(chunk_offsets, 0, sx * sy * sizeof(size_t));
 
     size_t offset = 0;
     for (uint32_t y = 0; y < map->height; y++)
         for (uint32_t x = 0; x < map->width; x++)
-            libvxl_column_encode(map, chunk_offsets, x, y, out, &offset);
+            libvxl_column_encode(map, x, y, out, &offset);
 
     if (size)
         *size = offset;
+}
+
+struct libvxl_write_job {
+    struct libvxl_map* map;
+    size_t band, y_start, y_end;
+    libvxl_write_callback callback;
+    void* user;
+};
+
+static void* libvxl_write_band(void* arg) {
+    struct libvxl_write_job* job = arg;
+    struct libvxl_map* map = job->map;
 
-    libvxl_mem_free(chunk_offsets);
+    // a column has at most one span header or color per voxel, plus the last header
+    size_t column_max = (map->depth * 2 + 1) * 4;
+    size_t capacity = column_max * map->width * LIBVXL_CHUNK_SIZE;
+    size_t offset = 0;
+    void* out = libvxl_mem_malloc(capacity);
+
+    for (size_t y = job->y_start; y < job->y_end; y++) {
+        for (size_t x = 0; x < map->width; x++) {
+            if (offset + column_max > capacity) {
+                capacity *= 2;
+                out = libvxl_mem_realloc(out, capacity);
+            }
+
+            libvxl_column_encode(map, x, y, out, &offset);
+        }
+    }
+
+    job->callback(job->user, job->band, out, offset);
+    return NULL;
+}
+
+size_t libvxl_write_parallel(struct libvxl_map* map, size_t threads,
+                             libvxl_write_callback callback, void* user) {
+    if (!map || !callback || threads == 0)
+        return 0;
+
+    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    if (threads > sy)
+        threads = sy;
+
+    struct libvxl_write_job jobs[threads];
+    for (size_t k = 0; k < threads; k++) {
+        jobs[k] = (struct libvxl_write_job) {
+            .map = map,
+            .band = k,
+            .y_start = sy * k / threads * LIBVXL_CHUNK_SIZE,
+            .y_end = sy * (k + 1) / threads * LIBVXL_CHUNK_SIZE,
+            .callback = callback,
+            .user = user,
+        };
+
+        if (jobs[k].y_end > map->height)
+            jobs[k].y_end = map->height;
+    }
+
+    map->streamed++;
+    libvxl_run_jobs(jobs, sizeof(*jobs), threads, libvxl_write_band);
+    map->streamed--;
+
+    return threads;
+}
+
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* copy) {
+    libvxl_assert(map && copy, "map or copy is null");
+
+    size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+    size_t sg = (map->width * map->height * map->depth
+                 + (sizeof(size_t) * 8 - 1))
+        / (sizeof(size_t) * 8) * sizeof(size_t);
+
+    *copy = (struct libvxl_map) {
+        .width = map->width,
+        .height = map->height,
+        .depth = map->depth,
+        .streamed = 0,
+    };
+
+    copy->chunks = libvxl_mem_malloc(sx * sy * sizeof(struct libvxl_chunk));
+    for (size_t k = 0; k < sx * sy; k++) {
+        struct libvxl_chunk* c = map->chunks + k;
+        copy->chunks[k].index = c->index;
+        copy->chunks[k].tail = c->index;
+        copy->chunks[k].length = c->index > 0 ? c->index : 1;
+        copy->chunks[k].blocks = libvxl_mem_malloc(copy->chunks[k].length
+                                                   * sizeof(struct libvxl_block));
+        libvxl_chunk_gather(c, copy->chunks[k].blocks);
+
+        size_t offset = 0;
+        for (size_t column = 0; column < LIBVXL_CHUNK_COLUMNS; column++) {
+            copy->chunks[k].column_start[column] = offset;
+            copy->chunks[k].column_count[column] = c->column_count[column];
+            copy->chunks[k].column_capacity[column] = c->column_count[column];
+            offset += c->column_count[column];
+        }
+    }
+
+    copy->geometry = libvxl_mem_malloc(sg);
+    memcpy(copy->geometry, map->geometry, sg);
 }
 
 size_t libvxl_writefile(struct libvxl_map* map, char* name) {
@@ -585,12 +1025,8 @@ uint32_t libvxl_map_get(struct libvxl_map* map, int x, int y, int z) {
         return 0;
     if (!libvxl_geometry_get(map, x, y, z))
         return 0;
-    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
-    struct libvxl_block* loc = bsearch(
-        &(struct libvxl_block) {
-            .position = pos_key(x, y, z),
-        },
-        chunk->blocks, chunk->index, sizeof(struct libvxl_block), cmp);
+    struct libvxl_block* loc
+        = libvxl_chunk_find(chunk_fposition(map, x, y), pos_key(x, y, z));
     return loc ? loc->color : DEFAULT_COLOR(x, y, z);
 }
 
@@ -618,17 +1054,12 @@ void libvxl_map_gettop(struct libvxl_map* map, int x, int y, uint32_t* result) {
     if (!map || x < 0 || y < 0 || x >= (int)map->width || y >= (int)map->height)
         return;
 
-    struct libvxl_chunk* c = chunk_fposition(map, x, y);
-    struct libvxl_block* block = libvxl_chunk_gequal_block(c, pos_key(x, y, 0));
+    size_t z = libvxl_geometry_next_solid(map, x, y, 0);
 
-    libvxl_assert(block < c->blocks + c->index, "block is out of bounds");
-    libvxl_assert(key_discardz(block->position) == pos_key(x, y, 0),
-                  "position is out of bounds");
-    libvxl_assert(key_getz(block->position) < map->depth,
-                  "position is out of bounds");
+    libvxl_assert(z < map->depth, "column has no solid block");
 
-    result[0] = block->color;
-    result[1] = key_getz(block->position);
+    result[0] = libvxl_map_get(map, x, y, z);
+    result[1] = z;
 }
 
 static void libvxl_map_set_internal(struct libvxl_map* map, int x, int y, int z,
@@ -660,25 +1091,7 @@ static void libvxl_map_setair_internal(struct libvxl_map* map, int x, int y,
     if (!libvxl_geometry_get(map, x, y, z))
         return;
 
-    struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
-
-    struct libvxl_block* loc = bsearch(
-        &(struct libvxl_block) {
-            .position = pos_key(x, y, z),
-        },
-        chunk->blocks, chunk->index, sizeof(struct libvxl_block), cmp);
-
-    if (loc) {
-        memmove(loc, loc + 1,
-                (chunk->blocks + (--chunk->index) - loc)
-                    * sizeof(struct libvxl_block));
-
-        if (chunk->index * LIBVXL_CHUNK_SHRINK <= chunk->length) {
-            chunk->length /= LIBVXL_CHUNK_GROWTH;
-            chunk->blocks = libvxl_mem_realloc(
-                chunk->blocks, chunk->length * sizeof(struct libvxl_block));
-        }
-    }
+    libvxl_chunk_erase(chunk_fposition(map, x, y), pos_key(x, y, z));
 }
 
 void libvxl_map_set(struct libvxl_map* map, int x, int y, int z,
@@ -757,6 +1170,11 @@ void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy) {
 
     libvxl_mem_free(copy->geometry);
     libvxl_mem_free(copy->blocks_sorted);
+    copy->geometry = NULL;
+    copy->geometry_capacity = 0;
+    copy->blocks_sorted = NULL;
+    copy->blocks_sorted_count = 0;
+    copy->blocks_sorted_capacity = 0;
 }
 
 uint32_t libvxl_copy_chunk_get_color(struct libvxl_chunk_copy* copy, size_t x,
@@ -779,30 +1197,78 @@ bool libvxl_copy_chunk_is_solid(struct libvxl_chunk_copy* copy, size_t x,
     if (!copy || x >= copy->width || y >= copy->height || z >= copy->depth)
         return true;
 
-    size_t offset = z + (x + y * copy->width) * copy->depth;
+    size_t dx = (x + copy->width - copy->x) % copy->width;
+    size_t dy = (y + copy->height - copy->y) % copy->height;
+
+    libvxl_assert(dx < copy->size_x && dy < copy->size_y,
+                  "position is outside of copied window");
+
+    size_t offset = z + (dx + dy * copy->size_x) * copy->depth;
     return copy->geometry[offset / (sizeof(size_t) * 8)]
         & ((size_t)1 << (offset % (sizeof(size_t) * 8)));
 }
 
 void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
-                       size_t x, size_t y) {
+                       size_t x, size_t y, size_t halo, size_t halo_behind) {
     if (!map || !copy || x >= map->width || y >= map->height)
         return;
 
-    size_t sg
-        = (map->width * map->height * map->depth + (sizeof(size_t) * 8 - 1))
-        / (sizeof(size_t) * 8) * sizeof(size_t);
-    copy->geometry = libvxl_mem_malloc(sg);
-    memcpy(copy->geometry, map->geometry, sg);
-
-    struct libvxl_chunk* c = chunk_fposition(map, x, y);
-    copy->blocks_sorted
-        = libvxl_mem_malloc(c->index * sizeof(struct libvxl_block));
-    copy->blocks_sorted_count = c->index;
-    memcpy(copy->blocks_sorted, c->blocks,
-           c->index * sizeof(struct libvxl_block));
+    size_t start_x = x / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+    size_t start_y = y / LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
 
     copy->width = map->width;
     copy->height = map->height;
     copy->depth = map->depth;
+    copy->size_x = min(LIBVXL_CHUNK_SIZE + 2 * halo, map->width);
+    copy->size_y = min(LIBVXL_CHUNK_SIZE + 2 * halo + halo_behind, map->height);
+    copy->x = (start_x + map->width - halo % map->width) % map->width;
+    copy->y = (start_y + map->height - (halo + halo_behind) % map->height)
+        % map->height;
+
+    size_t sg = (copy->size_x * copy->size_y * copy->depth
+                 + (sizeof(size_t) * 8 - 1))
+        / (sizeof(size_t) * 8);
+    if (copy->geometry_capacity < sg) {
+        copy->geometry_capacity = sg;
+        copy->geometry = libvxl_mem_realloc(copy->geometry,
+                                            sg * sizeof(size_t));
+    }
+
+    if (map->depth % (sizeof(size_t) * 8) == 0) {
+        // columns are word aligned, copy them as a whole
+        size_t words = map->depth / (sizeof(size_t) * 8);
+        for (size_t dy = 0; dy < copy->size_y; dy++) {
+            size_t sy = (copy->y + dy) % map->height;
+            for (size_t dx = 0; dx < copy->size_x; dx++) {
+                size_t sx = (copy->x + dx) % map->width;
+                memcpy(copy->geometry + (dx + dy * copy->size_x) * words,
+                       map->geometry + (sx + sy * map->width) * words,
+                       words * sizeof(size_t));
+            }
+        }
+    } else {
+        memset(copy->geometry, 0, sg * sizeof(size_t));
+        for (size_t dy = 0; dy < copy->size_y; dy++) {
+            size_t sy = (copy->y + dy) % map->height;
+            for (size_t dx = 0; dx < copy->size_x; dx++) {
+                size_t sx = (copy->x + dx) % map->width;
+                for (size_t z = 0; z < map->depth; z++) {
+                    size_t offset = z + (dx + dy * copy->size_x) * copy->depth;
+                    if (libvxl_geometry_get(map, sx, sy, z))
+                        copy->geometry[offset / (sizeof(size_t) * 8)]
+                            |= (size_t)1 << (offset % (sizeof(size_t) * 8));
+                }
+            }
+        }
+    }
+
+    struct libvxl_chunk* c = chunk_fposition(map, x, y);
+    if (copy->blocks_sorted_capacity < c->index) {
+        copy->blocks_sorted_capacity = c->index;
+        copy->blocks_sorted = libvxl_mem_realloc(
+            copy->blocks_sorted, c->index * sizeof(struct libvxl_block));
+    }
+
+    copy->blocks_sorted_count = c->index;
+    libvxl_chunk_gather(c, copy->blocks_sorted);
 }
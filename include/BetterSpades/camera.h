@@ -20,6 +20,12 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <BetterSpades/entitysystem.h>
+
 typedef enum {
     CAMERAMODE_SELECTION,
     CAMERAMODE_FPS,
@@ -40,6 +46,14 @@ typedef struct {
 extern float frustum[6][4];
 extern Camera camera;
 
+// Boxes collected to be tested against the frustum all at once, each coordinate is kept in its own array.
+typedef struct {
+    size_t count, length;
+    size_t culled; // boxes tested by the last cull
+    float * bounds[6]; // min x, y, z and max x, y, z
+    uint32_t * visible; // bit k % 32 of word k / 32 is set when box k is in view
+} CameraBoxes;
+
 typedef struct {
     char type;
     float x, y, z, distance;
@@ -59,11 +73,26 @@ void camera_hit(CameraHit *, int exclude_player, float x, float y, float z, floa
                 float ray_z, float range);
 void camera_hit_mask(CameraHit *, int exclude_player, float x, float y, float z, float ray_x,
                      float ray_y, float ray_z, float range);
+// Same as camera_hit() for several rays from one point, e.g. all pellets of a shotgun shot.
+void camera_hit_many(CameraHit *, size_t count, int exclude_player, float x, float y, float z, Vector3f * rays,
+                     float range);
 
 float camera_fov_scaled();
 void camera_ExtractFrustum(void);
 unsigned char camera_PointInFrustum(float x, float y, float z);
 int camera_CubeInFrustum(float x, float y, float z, float size, float size_y);
+// Sets bit k % 32 of visible[k / 32] when box k is at least partially inside the frustum, clears it otherwise.
+void camera_BoxesInFrustum(size_t count, float * min_x, float * min_y, float * min_z, float * max_x, float * max_y,
+                           float * max_z, uint32_t * visible);
+void camera_boxes_clear(CameraBoxes *);
+void camera_boxes_add(CameraBoxes *, float x0, float y0, float z0, float x1, float y1, float z1);
+void camera_boxes_cull(CameraBoxes *);
+// Boxes added after the last cull are always visible.
+bool camera_boxes_visible(CameraBoxes *, size_t index);
+// Replaces the boxes with those of all entities and culls them, box writes min x, y, z and max x, y, z of one.
+void camera_boxes_collect(CameraBoxes *, EntitySystem *, void (*box)(void * object, float * bounds));
+// Calls callback for the entities whose box is visible, they must not have changed since the boxes were collected.
+void camera_boxes_iterate(CameraBoxes *, EntitySystem *, void * user, bool (*callback)(void * object, void * user));
 int * camera_terrain_pick(unsigned char mode);
 int * camera_terrain_pickEx(unsigned char mode, float x, float y, float z, float ray_x, float ray_y, float ray_z);
 void camera_overflow_adjust(void);
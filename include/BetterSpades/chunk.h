@@ -28,31 +28,104 @@
 #include <BetterSpades/glx.h>
 #include <BetterSpades/tesselator.h>
 
+#include <AceOfSpades/types.h>
 #include <libvxl.h>
 
 #define CHUNK_SIZE 16
+#define CHUNK_HEIGHT 64
 #define CHUNKS_PER_DIM (512 / CHUNK_SIZE)
 
+// Chunks are meshed and drawn in sections along y, so that an edit only remeshes the sections around it.
+#define CHUNK_SECTION_HEIGHT 16
+#define CHUNK_SECTIONS (CHUNK_HEIGHT / CHUNK_SECTION_HEIGHT)
+#define CHUNK_SECTIONS_ALL ((1 << CHUNK_SECTIONS) - 1)
+
+// Far away chunks are drawn from coarser meshes, level k merges cubes of 2^k blocks.
+#define CHUNK_LODS 2
+
+// Each chunk keeps a grid of boxes known to be solid, for hiding what is behind them.
+#define CHUNK_OCCLUDERS 4
+#define CHUNK_OCCLUDER_SIZE (CHUNK_SIZE / CHUNK_OCCLUDERS)
+
+// Neighbours read by the meshers are at most one block away, except for
+// solid_sunblock() which walks up to 9 blocks towards -z.
+#define CHUNK_HALO 1
+#define CHUNK_HALO_SUNBLOCK 8
+
+#define CHUNK_VOXELS_X (CHUNK_SIZE + 2 * CHUNK_HALO)
+#define CHUNK_VOXELS_Y (CHUNK_HEIGHT + 2)
+#define CHUNK_VOXELS_Z (CHUNK_SIZE + 2 * CHUNK_HALO + CHUNK_HALO_SUNBLOCK)
+
+// Dense copy of a chunk and its halo the meshers work on, in game coordinates.
+// Each column is padded with one solid voxel below and one air voxel above.
 typedef struct {
-    GLXDisplayList display_list;
+    int x, z;
+    uint8_t solid[CHUNK_VOXELS_X * CHUNK_VOXELS_Y * CHUNK_VOXELS_Z];
+    uint32_t color[CHUNK_SIZE * CHUNK_HEIGHT * CHUNK_SIZE];
+    struct libvxl_block * blocks;
+    size_t blocks_count;
+} ChunkVoxels;
+
+typedef struct {
+    GLXDisplayList display_list[CHUNK_SECTIONS];
+    GLXDisplayList lod[CHUNK_LODS];
+    int lod_level; // of the closest copy last frame, 0 is full detail
     int max_height;
-    bool updated;
+    uint8_t occluder[CHUNK_OCCLUDERS * CHUNK_OCCLUDERS]; // all columns of a cell are solid up to this height
     bool created;
     int x, y;
+
+    // scheduling state, only accessed with the scheduler lock held
+    uint32_t generation; // bumped on every rebuild request
+    uint32_t section_generation[CHUNK_SECTIONS]; // generation of the last request covering each section
+    uint8_t pending; // sections waiting for a worker
+    bool pending_rebuild;
+    bool pending_lod; // coarse meshes waiting for a worker
+    bool lod_stale; // coarse meshes are older than the sections, they are refreshed later
+    bool busy; // a worker is meshing this chunk
+    float priority; // lower is built first
 } Chunk;
 
 extern Chunk chunks[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
+extern int chunk_draw_count;
+extern int chunk_draw_triangles;
+
+// averages over chunk updates caused by block changes
+extern float chunk_update_time;
+extern float chunk_update_bytes;
+extern int chunk_jobs_queued;
+extern float chunk_jobs_wasted; // per second, superseded before they were uploaded
+// sections hidden behind terrain last frame and the time to find them, of those checked on the gpu
+// after being culled some were still visible, since only their bounding box is tested
+extern int chunk_occluded;
+extern float chunk_occlusion_time;
+extern int chunk_occlusion_checked;
+extern int chunk_occlusion_visible;
+// results waiting for upload and bytes uploaded in the last frame
+extern int chunk_upload_queued;
+extern int chunk_upload_bytes;
 
 #define CHUNK_WORKERS_MAX 16
 
 void chunk_init(void);
 
 void chunk_block_update(int x, int y, int z);
+// Same as chunk_block_update() for several blocks, the update queue is locked only once.
+void chunk_block_update_many(Vector3i * blocks, size_t count);
 void chunk_update_all(void);
 void * chunk_generate(void * data);
-void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, size_t start_z, Tesselator * tess,
+void chunk_voxels_expand(ChunkVoxels * voxels, struct libvxl_chunk_copy * copy, size_t start_x, size_t start_z);
+// The meshers take one tesselator per section and only fill those set in the sections mask.
+void chunk_generate_greedy(ChunkVoxels * blocks, size_t start_x, size_t start_z, Tesselator * tess, uint8_t sections,
                            int * max_height);
-void chunk_generate_naive(struct libvxl_chunk_copy * blocks, Tesselator * tess, int * max_height, int ao);
+void chunk_generate_bitmask(ChunkVoxels * blocks, size_t start_x, size_t start_z, Tesselator * tess, uint8_t sections,
+                            int * max_height);
+void chunk_generate_naive(ChunkVoxels * blocks, Tesselator * tess, uint8_t sections, int * max_height, int ao);
+void chunk_generate_lod(ChunkVoxels * blocks, Tesselator * tess, int scale);
+// Level of detail for a chunk at this distance from the camera, 0 is full detail. Current is the level it was
+// drawn at last frame.
+int chunk_lod_level(float distance, int current);
+void chunk_generate_occluders(ChunkVoxels * blocks, uint8_t * heights);
 void chunk_rebuild_all(void);
 void chunk_draw_visible(void);
 void chunk_queue_blocks();
@@ -155,6 +155,7 @@ extern int chat_input_mode;
 extern float last_cy;
 
 extern int fps;
+extern float frame_time;
 
 extern char chat[2][10][256];
 extern TrueColor chat_color[2][10];
@@ -43,6 +43,13 @@ typedef struct {
     char value[32];
 } ConfigFileEntry;
 
+// Values of settings.greedy_meshing, anything non-zero joins faces.
+enum {
+    MESHING_NAIVE   = 0,
+    MESHING_GREEDY  = 1,
+    MESHING_BITMASK = 2,
+};
+
 typedef struct {
     char  name[16];
     int   min_lan_port;
@@ -78,6 +85,8 @@ typedef struct {
     int   toggle_sprint;
     int   enable_shadows;
     int   enable_particles;
+    int   map_cache_size;
+    int   chunk_lod;
 } Options;
 
 extern Options settings, settings_tmp;
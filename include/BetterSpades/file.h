@@ -21,6 +21,7 @@
 #define FILE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 void * file_open(const char * name, const char * mode);
 void file_printf(void * file, const char * fmt, ...);
@@ -30,6 +31,10 @@ int file_dir_exists(const char * path);
 int file_dir_create(const char * path);
 int file_exists(const char * name);
 uint8_t * file_load(const char * name);
+void * file_map(const char * name, size_t * size);
+void file_unmap(void * data, size_t size);
+void file_touch(const char * name);
+void file_dir_trim(const char * path, const char * extension, size_t max_size);
 void file_url(char * url);
 
 #endif
@@ -27,20 +27,53 @@
 
 extern int glx_version;
 extern int glx_fog;
+extern int glx_draw_calls;
 
 typedef struct {
+    size_t start, size;
+} GLXArenaRange;
+
+struct GLXDisplayList;
+
+#define GLX_ARENA_STAGING_SIZE (4 * 1024 * 1024)
+
+// Vertex buffers shared by many display lists with short vertices and colors, so all of them can be drawn at once.
+// With a shader program, vertices are TesselatorPackedVertex instead and there is no color buffer.
+typedef struct {
+    bool enabled;
+    int program;
+    int attrib_xz, attrib_yrgb;
+    size_t vertex_size, color_size;
+    uint32_t vertices, colors;
+    size_t capacity;
+    uint32_t staging; // ring buffer updates are copied through, 0 if not supported
+    size_t staging_size, staging_offset;
+    GLXArenaRange * free;
+    size_t free_count, free_capacity;
+    struct GLXDisplayList ** lists;
+    size_t lists_count, lists_capacity;
+    int * draw_first;
+    int * draw_count;
+    void ** draw_indices;
+    size_t draw_capacity;
+} GLXArena;
+
+typedef struct GLXDisplayList {
     uint32_t legacy;
     uint32_t modern;
     size_t size;
     size_t buffer_size;
     bool has_normal;
     bool has_color;
+    GLXArena * arena;
+    size_t arena_start;
 } GLXDisplayList;
 
 enum {
     GLX_DISPLAYLIST_NORMAL,
     GLX_DISPLAYLIST_ENHANCED,
     GLX_DISPLAYLIST_POINTS,
+    GLX_DISPLAYLIST_PACKED,
 };
 
 void glx_init(void);
@@ -50,9 +83,20 @@ int glx_shader(const char * vertex, const char * fragment);
 void glx_enable_sphericalfog(void);
 void glx_disable_sphericalfog(void);
 
+// Draws quads from separate, tightly packed vertex arrays as indexed triangles, all using one shared index buffer.
+// The pointers are offsets if an array buffer is bound, color and normal may be NULL.
+void glx_draw_quads(size_t vertices, int type, const void * vertex, const void * color, const void * normal);
+
 void glx_displaylist_create(GLXDisplayList *, bool has_color, bool has_normal);
 void glx_displaylist_destroy(GLXDisplayList *);
 void glx_displaylist_update(GLXDisplayList *, size_t size, int type, void* color, void* vertex, void* normal);
 void glx_displaylist_draw(GLXDisplayList *, int type);
 
+// program is the shader drawing packed vertices, 0 for short vertices and colors
+void glx_arena_create(GLXArena *, size_t capacity, int program);
+// falls back to a display list of its own if the arena is not enabled
+void glx_displaylist_create_arena(GLXDisplayList *, GLXArena *);
+// draws all lists with one call, all of them must belong to the arena
+void glx_arena_draw(GLXArena *, GLXDisplayList ** lists, size_t count);
+
 #endif
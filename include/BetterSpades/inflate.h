@@ -0,0 +1,44 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fills buffer with the next bytes of compressed input, may block until some are available.
+// Returns 0 once there is no more input.
+typedef size_t (*InflateInput)(void * user, uint8_t * buffer, size_t length);
+
+// Called whenever output grew, the first output_length bytes are final.
+typedef void (*InflateProgress)(void * user, const uint8_t * output, size_t output_length);
+
+typedef enum {
+    INFLATE_SUCCESS,
+    INFLATE_BAD_DATA,
+    INFLATE_SHORT_INPUT,
+} InflateResult;
+
+// Decompresses a zlib stream while its input arrives, unlike libdeflate which needs all of it at once.
+// *output is allocated by this function and must be freed by the caller, also on failure.
+InflateResult inflate_zlib(InflateInput input, InflateProgress progress, void * user, uint8_t ** output,
+                           size_t * output_length);
+
+#endif
@@ -41,17 +41,43 @@ void map_damaged_voxels_render();
 void map_update_physics(int x, int y, int z);
 float map_sunblock(int x, int y, int z);
 bool map_isair(int x, int y, int z);
+void map_isair_many(Vector3i * pos, bool * result, size_t count);
+
+typedef struct {
+    int x, y, z;    // voxel that was hit
+    int xb, yb, zb; // voxel the ray came from
+} MapRayHit;
+
+// Finds the first solid voxel along the ray from (x, y, z) to (x, y, z) + (dx, dy, dz) * length. With from_air,
+// solid voxels are skipped until the ray passed through air, e.g. when it starts inside terrain.
+bool map_raycast(float x, float y, float z, float dx, float dy, float dz, float length, bool from_air,
+                 MapRayHit * hit);
+// Same as map_raycast() for many rays from one origin, all of them see the same state of the map.
+void map_raycast_many(Vector3f origin, Vector3f * directions, size_t count, float length, bool from_air,
+                      MapRayHit * hits, bool * found);
 TrueColor map_get(int x, int y, int z);
+void map_get_many(Vector3i * pos, TrueColor * result, size_t count);
 void map_set(int x, int y, int z, TrueColor);
+// Colors may be NULL to remove all given voxels.
+void map_set_many(Vector3i * pos, TrueColor * colors, size_t count);
+// Changes between these are applied together on commit under a single lock, neighbours of all removed
+// voxels are then checked for falling as one batch. Only for use by the main thread.
+void map_edit_begin(void);
+void map_edit_set(int x, int y, int z, TrueColor color);
+void map_edit_commit(void);
 int map_cube_line(int x1, int y1, int z1, int x2, int y2, int z2, Vector3i * cube_array);
 void map_vxl_setgeom(int x, int y, int z, unsigned int t, unsigned int * map);
 void map_vxl_setcolor(int x, int y, int z, unsigned int t, unsigned int * map);
 int map_placedblock_color(int color);
-void map_vxl_load(void * v, size_t size);
+bool map_vxl_load(void * v, size_t size);
+void map_vxl_stream_begin(void);
+void map_vxl_stream_feed(void * data, size_t size);
+bool map_vxl_stream_finish(void);
+bool map_cache_load(uint32_t crc32);
 void map_collapsing_render(void);
 void map_collapsing_update(float dt);
 int map_height_at(int x, int z);
 void map_save_file(char * filename);
-void map_copy_blocks(struct libvxl_chunk_copy * copy, size_t x, size_t y);
+void map_copy_blocks(struct libvxl_chunk_copy * copy, size_t x, size_t y, size_t halo, size_t halo_behind);
 
 #endif
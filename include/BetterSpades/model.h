@@ -91,6 +91,8 @@ void kv6_calclight(int x, int y, int z);
 void kv6_rebuild_complete(void);
 void kv6_rebuild(kv6 *);
 void kv6_render(kv6 *, unsigned char team);
+// distance from the pivot to the farthest corner of the model
+float kv6_radius(kv6 *);
 void kv6_load(kv6 *, const char *, uint8_t * buff, float scale);
 void kv6_init(void);
 
@@ -0,0 +1,40 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+
+#include <BetterSpades/matrix.h>
+
+// Coarse depth buffer that faces of what is known to be solid are drawn into on the cpu, so that geometry
+// hidden behind them can be skipped before it is submitted. Width must be a multiple of 4.
+#define OCCLUSION_WIDTH 128
+#define OCCLUSION_HEIGHT 64
+
+void occlusion_begin(mat4 view_projection);
+// Vertices go around a convex, planar quad. Quads sharing an edge must use the same two vertices for it.
+void occlusion_add_quad(float vertices[4][3]);
+// Must be called after all occluders were added and before testing.
+void occlusion_end(void);
+// True when the box is hidden behind the occluders everywhere on screen.
+bool occlusion_test_box(float x0, float y0, float z0, float x1, float y1, float z1);
+
+#endif
@@ -21,6 +21,7 @@
 #define PLAYER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <BetterSpades/aabb.h>
 #include <BetterSpades/network.h>
@@ -100,23 +101,10 @@ extern int player_intersection_player;
 extern float player_intersection_dist;
 
 typedef struct {
-    bool head;
-    bool torso;
-    bool leg_left;
-    bool leg_right;
-    bool arms;
-
-    struct {
-        float head;
-        float torso;
-        float leg_left;
-        float leg_right;
-        float arms;
-    } distance;
-} Hit;
-
-bool player_intersection_exists(Hit * s);
-int player_intersection_choose(Hit * s, float * distance);
+    int player; // -1 if no player was hit
+    int type;   // HITTYPE_* of the section that was hit
+    float distance;
+} PlayerRayHit;
 
 typedef struct {
     char name[17];
@@ -169,7 +157,9 @@ void player_reposition(Player *);
 void player_update(float dt, int locked);
 void player_render_all(void);
 void player_render(Player * p, int id);
-void player_collision(const Player *, Ray * ray, Hit * intersects);
+// Tests all rays against the hitboxes of the players that candidates[id] is set for, as they were on the last
+// player_update(). hits[k].distance must hold the distance up to which ray k is tested.
+void player_collision_many(Ray * rays, size_t count, bool * candidates, PlayerRayHit * hits);
 void player_reset(Player *);
 int player_move(Player *, float fsynctics, int id);
 int player_uncrouch(Player *);
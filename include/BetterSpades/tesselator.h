@@ -21,20 +21,25 @@
 #define TESSELATOR_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include <BetterSpades/glx.h>
 
-#ifdef OPENGL_ES
-#define TESSELATE_TRIANGLES
-#else
-#define TESSELATE_QUADS
-#endif
-
 typedef enum {
     VERTEX_INT,
     VERTEX_FLOAT,
+    VERTEX_PACKED,
 } TesselatorVertexType;
 
+// Interleaved 8 byte vertex of VERTEX_PACKED, position and color in one, without alpha.
+// Can only be drawn by a shader, as fixed function vertex arrays know no unsigned positions.
+typedef struct {
+    uint16_t x, z;
+    uint8_t y;
+    uint8_t r, g, b;
+} TesselatorPackedVertex;
+
 typedef struct {
     void * vertices;
     int8_t * normals;
@@ -47,6 +52,16 @@ typedef struct {
     TesselatorVertexType vertex_type;
 } Tesselator;
 
+// Keeps the buffers of released tesselators, so that tesselators can be taken from it again without any
+// allocations once the pool is warm. Taking and releasing may happen on different threads.
+typedef struct {
+    TesselatorVertexType vertex_type;
+    int has_normal;
+    Tesselator * free;
+    size_t free_count, free_capacity;
+    pthread_mutex_t lock;
+} TesselatorPool;
+
 typedef enum {
     CUBE_FACE_X_N,
     CUBE_FACE_X_P,
@@ -59,6 +74,11 @@ typedef enum {
 void tesselator_create(Tesselator *, TesselatorVertexType type, int has_normal);
 void tesselator_clear(Tesselator *);
 void tesselator_free(Tesselator *);
+void tesselator_pool_create(TesselatorPool *, TesselatorVertexType type, int has_normal);
+// like tesselator_create, but reuses storage of a tesselator released to the pool if there is one
+void tesselator_pool_take(TesselatorPool *, Tesselator *);
+// like tesselator_free, the storage goes back to the pool instead
+void tesselator_pool_release(TesselatorPool *, Tesselator *);
 void tesselator_draw(Tesselator *, int with_color);
 void tesselator_glx(Tesselator *, GLXDisplayList *);
 void tesselator_set_color(Tesselator *, TrueColor color);
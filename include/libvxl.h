@@ -20,6 +20,11 @@
 //! @brief How many blocks the buffer will grow once it is full
 #define LIBVXL_CHUNK_GROWTH		2
 #define LIBVXL_CHUNK_SHRINK		4
+//! @brief Number of columns in a chunk
+#define LIBVXL_CHUNK_COLUMNS	(LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+//! @brief Free blocks every column gets when a chunk is laid out again
+//! @note Edits only move blocks of their own column as long as it has free blocks left
+#define LIBVXL_COLUMN_SLACK		2
 
 #ifndef libvxl_mem_malloc
 #define libvxl_mem_malloc(sz) malloc(sz)
@@ -65,9 +70,17 @@ struct libvxl_block {
 	uint32_t color;
 };
 
+//! @brief Blocks of a chunk, sorted by position within each column
+//!
+//! Column x + y * LIBVXL_CHUNK_SIZE (relative to the chunk) owns column_capacity[] blocks from column_start[] on,
+//! of which the first column_count[] are used. Going through the columns in order visits all blocks sorted by
+//! position. Columns that run full move to the free blocks from tail on.
 struct libvxl_chunk {
 	struct libvxl_block* blocks;
-	size_t length, index;
+	size_t length, index, tail;
+	uint32_t column_start[LIBVXL_CHUNK_COLUMNS];
+	uint16_t column_count[LIBVXL_CHUNK_COLUMNS];
+	uint16_t column_capacity[LIBVXL_CHUNK_COLUMNS];
 };
 
 struct libvxl_map {
@@ -79,13 +92,18 @@ struct libvxl_map {
 
 struct libvxl_stream {
 	struct libvxl_map* map;
-	size_t* chunk_offsets;
 	size_t chunk_size;
 	void* buffer;
 	size_t buffer_offset;
 	size_t pos;
 };
 
+//! @brief State of a map that is loaded piece by piece, see libvxl_loader_begin()
+struct libvxl_loader {
+	struct libvxl_map* map;
+	size_t x, y;
+};
+
 struct __attribute((packed)) libvxl_kv6 {
 	char magic[4];
 	int width, height, depth;
@@ -100,23 +118,48 @@ struct __attribute((packed)) libvxl_kv6_block {
 	unsigned char normal;
 };
 
+//! @brief Snapshot of a single chunk and the geometry surrounding it
+//!
+//! Only the columns [x, x + size_x) by [y, y + size_y) (wrapping around map edges) are copied,
+//! queries outside of this window are invalid. The buffers are reused by subsequent calls to
+//! libvxl_copy_chunk(), so a zero-initialized copy can be kept per thread.
 struct libvxl_chunk_copy {
 	size_t width, height, depth;
+	size_t x, y, size_x, size_y;
 	size_t* geometry;
+	size_t geometry_capacity;
 	struct libvxl_block* blocks_sorted;
-	size_t blocks_sorted_count;
+	size_t blocks_sorted_count, blocks_sorted_capacity;
 };
 
+//! @brief Free all buffers held by a chunk copy
+//! @param copy Copy to free, can be reused afterwards
 void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy);
 
+//! @brief Read block color from a chunk copy
+//! @note Only blocks of the copied chunk itself are available, not those of its halo
+//! @returns color of block in format *0x00RRGGBB*, *0* if there is no such block
 uint32_t libvxl_copy_chunk_get_color(struct libvxl_chunk_copy* copy, size_t x,
 									 size_t y, size_t z);
 
+//! @brief Tells if a block is solid in a chunk copy
+//! @note [x,y] must be inside the map and inside the copied window
+//! @returns solid=1, air=0
 bool libvxl_copy_chunk_is_solid(struct libvxl_chunk_copy* copy, size_t x,
 								size_t y, size_t z);
 
+//! @brief Take a snapshot of the chunk containing [x,y]
+//!
+//! Sorted blocks of the chunk are copied together with the geometry of the chunk
+//! and of a halo of columns around it, following the same wrap-around as libvxl_map_issolid().
+//! @param map Map to copy from
+//! @param copy Destination, its buffers are grown if needed
+//! @param x x-coordinate of any column inside the chunk
+//! @param y y-coordinate of any column inside the chunk
+//! @param halo Columns of geometry to copy on every side of the chunk
+//! @param halo_behind Additional columns of geometry to copy in front of the chunk (towards y=0)
 void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
-					   size_t x, size_t y);
+					   size_t x, size_t y, size_t halo, size_t halo_behind);
 
 //! @brief Load a map from memory or create an empty one
 //!
@@ -135,12 +178,75 @@ void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
 //! @returns 1 on success
 bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d, const void* data, size_t len);
 
+//! @brief Load a map from memory using multiple threads
+//!
+//! Same as libvxl_create(), but bands of chunk rows are decoded concurrently after a quick scan for where each
+//! of them starts in data. Chunk block arrays are allocated at their final size right away.
+//! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
+//! @param w Width of map (x-coord)
+//! @param h Height of map (y-coord)
+//! @param d Depth of map (z-coord)
+//! @param data Pointer to valid map data, left unmodified also not freed
+//! @param len map data size in bytes
+//! @param threads Number of threads to use, including the calling one
+//! @returns 1 on success
+bool libvxl_create_parallel(struct libvxl_map* map, size_t w, size_t h, size_t d, const void* data, size_t len,
+							size_t threads);
+
+//! @brief Start loading a map from data that becomes available over time
+//!
+//! The map is allocated right away, columns are filled in as they are passed to libvxl_loader_feed().
+//! @param loader Loader state to initialize
+//! @param map Map to load into, must be freed with libvxl_free() even if loading fails
+//! @param w Width of map (x-coord)
+//! @param h Height of map (y-coord)
+//! @param d Depth of map (z-coord)
+void libvxl_loader_begin(struct libvxl_loader* loader, struct libvxl_map* map, size_t w, size_t h, size_t d);
+
+//! @brief Load all complete columns at the start of data
+//! @param loader Loader state
+//! @param data Map data following the bytes consumed by previous calls
+//! @param len Bytes available in data
+//! @returns number of bytes consumed, the remaining bytes must be passed again once more data is available
+size_t libvxl_loader_feed(struct libvxl_loader* loader, const void* data, size_t len);
+
+//! @brief Complete loading a map
+//! @param loader Loader state
+//! @returns 1 on success, 0 if not all columns were passed to libvxl_loader_feed()
+bool libvxl_loader_finish(struct libvxl_loader* loader);
+
 //! @brief Write a map to disk, uses the libvxl_stream API internally
 //! @param map Map to be written
 //! @param name Filename of output file
 //! @returns total bytes written to disk
 size_t libvxl_writefile(struct libvxl_map* map, char* name);
 
+//! @brief Receives the encoded columns of one band of a map, see libvxl_write_parallel()
+//! @param user Pointer passed to libvxl_write_parallel()
+//! @param band Index of the band, bands are in map order
+//! @param data Encoded columns, must be freed with libvxl_mem_free() by the callee
+//! @param size Byte size of data
+typedef void (*libvxl_write_callback)(void* user, size_t band, void* data, size_t size);
+
+//! @brief Compress the map back to vxl format using multiple threads
+//!
+//! The map is split into bands of chunk rows, each is encoded on its own thread and passed to callback from there.
+//! Concatenating all bands in order gives the same output as libvxl_write().
+//! @note The map must not be modified until this returns, see libvxl_snapshot()
+//! @param map Map to compress
+//! @param threads Maximum number of bands and threads, including the calling one
+//! @param callback Function called once for every band, from the thread that encoded it
+//! @param user Pointer passed to callback
+//! @returns number of bands the map was split into
+size_t libvxl_write_parallel(struct libvxl_map* map, size_t threads, libvxl_write_callback callback, void* user);
+
+//! @brief Copy a map, for example to save it while the original keeps being modified
+//!
+//! Chunks only get as much memory as their current blocks need.
+//! @param map Map to copy
+//! @param copy Pointer to a struct that receives the copy, must be freed with libvxl_free()
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* copy);
+
 //! @brief Compress the map back to vxl format and save it in *out*, the total byte size will be written to *size*
 //! @param map Map to compress
 //! @param out pointer to memory where the vxl will be stored
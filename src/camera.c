@@ -18,9 +18,16 @@
 */
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <float.h>
 
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 #include <BetterSpades/common.h>
 #include <BetterSpades/cameracontroller.h>
 #include <BetterSpades/player.h>
@@ -115,57 +122,83 @@ void camera_hit(CameraHit * hit, int exclude_player, float x, float y, float z,
 
 void camera_hit_mask(CameraHit * hit, int exclude_player, float x, float y, float z, float ray_x,
                      float ray_y, float ray_z, float range) {
-    Ray dir = (Ray) {
-        .origin = {x, y, z},
-        .direction = {ray_x, ray_y, ray_z},
-    };
+    camera_hit_many(hit, 1, exclude_player, x, y, z, &(Vector3f) {ray_x, ray_y, ray_z}, range);
+}
 
+static void camera_hit_block(CameraHit * hit, float x, float y, float z, Vector3f * ray, float range,
+                             MapRayHit * block, bool block_found) {
     hit->type = CAMERA_HITTYPE_NONE;
     hit->distance = FLT_MAX;
 
 #if HACKS_ENABLED && HACK_WALLHACK
     if (players[local_player.id].held_item != TOOL_GUN) {
 #endif
-    int * pos = camera_terrain_pickEx(1, x, y, z, ray_x, ray_y, ray_z);
-    if (pos != NULL && norm3f(x, y, z, pos[0], pos[1], pos[2]) <= sqrf(range)) {
-        AABB block = (AABB) {
-            .min = {pos[0], pos[1], pos[2]},
-            .max = {pos[0] + 1, pos[1] + 1, pos[2] + 1},
+    if (block_found && norm3f(x, y, z, block->x, block->y, block->z) <= sqrf(range)) {
+        AABB box = (AABB) {
+            .min = {block->x, block->y, block->z},
+            .max = {block->x + 1, block->y + 1, block->z + 1},
+        };
+
+        Ray dir = (Ray) {
+            .origin = {x, y, z},
+            .direction = {ray->x, ray->y, ray->z},
         };
 
         float d;
-        if (aabb_intersection_ray(&block, &dir, &d)) {
+        if (aabb_intersection_ray(&box, &dir, &d)) {
             hit->type     = CAMERA_HITTYPE_BLOCK;
             hit->distance = d;
-            hit->x        = pos[0];
-            hit->y        = pos[1];
-            hit->z        = pos[2];
-            hit->xb       = pos[3];
-            hit->yb       = pos[4];
-            hit->zb       = pos[5];
+            hit->x        = block->x;
+            hit->y        = block->y;
+            hit->z        = block->z;
+            hit->xb       = block->xb;
+            hit->yb       = block->yb;
+            hit->zb       = block->zb;
         }
     }
 #if HACKS_ENABLED && HACK_WALLHACK
     }
 #endif
+}
+
+void camera_hit_many(CameraHit * hits, size_t count, int exclude_player, float x, float y, float z, Vector3f * rays,
+                     float range) {
+    MapRayHit blocks[count];
+    bool found[count];
+    map_raycast_many((Vector3f) {x, y, z}, rays, count, 128.0F, false, blocks, found);
+
+    Ray dirs[count];
+    PlayerRayHit targets[count];
+
+    for (size_t k = 0; k < count; k++) {
+        camera_hit_block(hits + k, x, y, z, rays + k, range, blocks + k, found[k]);
 
-    for (int i = 0; i < PLAYERS_MAX; i++) {
-        float l = norm2f(x, z, players[i].pos.x, players[i].pos.z);
-        if (players[i].connected && players[i].alive && l < range * range
-           && (exclude_player < 0 || (exclude_player >= 0 && exclude_player != i))) {
-            Hit intersects = {0};
-            player_collision(players + i, &dir, &intersects);
-
-            float d; int type = player_intersection_choose(&intersects, &d);
-            if (player_intersection_exists(&intersects) && d < hit->distance) {
-                hit->type           = CAMERA_HITTYPE_PLAYER;
-                hit->distance       = d;
-                hit->x              = players[i].pos.x;
-                hit->y              = players[i].pos.y;
-                hit->z              = players[i].pos.z;
-                hit->player_id      = i;
-                hit->player_section = type;
-            }
+        dirs[k] = (Ray) {
+            .origin = {x, y, z},
+            .direction = {rays[k].x, rays[k].y, rays[k].z},
+        };
+        targets[k].distance = hits[k].distance;
+    }
+
+    // all rays start at the same point, so the players in range are the same for each of them
+    bool candidates[PLAYERS_MAX];
+    for (int i = 0; i < PLAYERS_MAX; i++)
+        candidates[i] = players[i].connected && players[i].alive
+            && norm2f(x, z, players[i].pos.x, players[i].pos.z) < range * range && exclude_player != i;
+
+    player_collision_many(dirs, count, candidates, targets);
+
+    for (size_t k = 0; k < count; k++) {
+        if (targets[k].player >= 0) {
+            int i = targets[k].player;
+
+            hits[k].type           = CAMERA_HITTYPE_PLAYER;
+            hits[k].distance       = targets[k].distance;
+            hits[k].x              = players[i].pos.x;
+            hits[k].y              = players[i].pos.y;
+            hits[k].z              = players[i].pos.z;
+            hits[k].player_id      = i;
+            hits[k].player_section = targets[k].type;
         }
     }
 }
@@ -175,105 +208,31 @@ int * camera_terrain_pick(unsigned char mode) {
                                  cos(camera.rot.y), cos(camera.rot.x) * sin(camera.rot.y));
 }
 
-// kindly borrowed from
-// https://stackoverflow.com/questions/16505905/walk-a-line-between-two-points-in-a-3d-voxel-space-visiting-all-cells
-// adapted, original code by Wivlaro
 int * camera_terrain_pickEx(unsigned char mode, float gx0, float gy0, float gz0, float ray_x, float ray_y, float ray_z) {
-    float gx1 = gx0 + ray_x * 128.0F;
-    float gy1 = gy0 + ray_y * 128.0F;
-    float gz1 = gz0 + ray_z * 128.0F;
-
-    int gx0idx = floor(gx0);
-    int gy0idx = floor(gy0);
-    int gz0idx = floor(gz0);
-
-    int gx1idx = floor(gx1);
-    int gy1idx = floor(gy1);
-    int gz1idx = floor(gz1);
-
-    int sx = gx1idx > gx0idx ? 1 : gx1idx < gx0idx ? -1 : 0;
-    int sy = gy1idx > gy0idx ? 1 : gy1idx < gy0idx ? -1 : 0;
-    int sz = gz1idx > gz0idx ? 1 : gz1idx < gz0idx ? -1 : 0;
-
-    int gx = gx0idx;
-    int gy = gy0idx;
-    int gz = gz0idx;
-
-    int gxp = gx0idx + (gx1idx > gx0idx ? 1 : 0);
-    int gyp = gy0idx + (gy1idx > gy0idx ? 1 : 0);
-    int gzp = gz0idx + (gz1idx > gz0idx ? 1 : 0);
-
-    float vx = gx1 == gx0 ? 1 : gx1 - gx0;
-    float vy = gy1 == gy0 ? 1 : gy1 - gy0;
-    float vz = gz1 == gz0 ? 1 : gz1 - gz0;
-
-    float vxvy = vx * vy;
-    float vxvz = vx * vz;
-    float vyvz = vy * vz;
-
-    float errx = (gxp - gx0) * vyvz;
-    float erry = (gyp - gy0) * vxvz;
-    float errz = (gzp - gz0) * vxvy;
-
-    float derrx = sx * vyvz;
-    float derry = sy * vxvz;
-    float derrz = sz * vxvy;
-
-    int gx_pre = gx, gy_pre = gy, gz_pre = gz;
-
     static int ret[6];
-    ret[0] = ret[1] = ret[2] = 0;
-    ret[3] = ret[4] = ret[5] = 0;
+    MapRayHit hit;
 
-    for (;;) {
-        if (gx >= map_size_x || gx < 0 || gy < 0 || gz >= map_size_z || gz < 0) {
-            return NULL;
-        }
-        switch (mode) {
-            case 0:
-                if (!map_isair(gx, gy, gz) && map_isair(gx_pre, gy_pre, gz_pre)) {
-                    ret[0] = gx_pre;
-                    ret[1] = gy_pre;
-                    ret[2] = gz_pre;
-                    return ret;
-                }
-                break;
-            case 1:
-                if (!map_isair(gx, gy, gz)) {
-                    ret[0] = gx;
-                    ret[1] = gy;
-                    ret[2] = gz;
-                    ret[3] = gx_pre;
-                    ret[4] = gy_pre;
-                    ret[5] = gz_pre;
-                    return ret;
-                }
-                break;
-        }
-        gx_pre = gx;
-        gy_pre = gy;
-        gz_pre = gz;
+    if (!map_raycast(gx0, gy0, gz0, ray_x, ray_y, ray_z, 128.0F, mode == 0, &hit))
+        return NULL;
 
-        if (gx == gx1idx && gy == gy1idx && gz == gz1idx)
+    switch (mode) {
+        case 0:
+            ret[0] = hit.xb;
+            ret[1] = hit.yb;
+            ret[2] = hit.zb;
+            ret[3] = ret[4] = ret[5] = 0;
+            break;
+        case 1:
+            ret[0] = hit.x;
+            ret[1] = hit.y;
+            ret[2] = hit.z;
+            ret[3] = hit.xb;
+            ret[4] = hit.yb;
+            ret[5] = hit.zb;
             break;
-
-        int xr = fabsf(errx);
-        int yr = fabsf(erry);
-        int zr = fabsf(errz);
-
-        if (sx != 0 && (sy == 0 || xr < yr) && (sz == 0 || xr < zr)) {
-            gx += sx;
-            errx += derrx;
-        } else if (sy != 0 && (sz == 0 || yr < zr)) {
-            gy += sy;
-            erry += derry;
-        } else if (sz != 0) {
-            gz += sz;
-            errz += derrz;
-        }
     }
 
-    return NULL;
+    return ret;
 }
 
 void camera_ExtractFrustum() {
@@ -406,3 +365,137 @@ int camera_CubeInFrustum(float x, float y, float z, float size, float size_y) {
 
     return (c2 == 6) ? 2 : 1;
 }
+
+// A box is outside if it is completely behind one of the planes, which only the corner farthest along the
+// plane normal has to be tested for. That corner is the same for all boxes, so each plane picks its arrays once.
+void camera_BoxesInFrustum(size_t count, float * min_x, float * min_y, float * min_z, float * max_x, float * max_y,
+                           float * max_z, uint32_t * visible) {
+    float * corner[6][3];
+
+    for (int p = 0; p < 6; p++) {
+        corner[p][0] = frustum[p][0] > 0 ? max_x : min_x;
+        corner[p][1] = frustum[p][1] > 0 ? max_y : min_y;
+        corner[p][2] = frustum[p][2] > 0 ? max_z : min_z;
+    }
+
+    memset(visible, 0, (count + 31) / 32 * sizeof(uint32_t));
+
+    size_t k = 0;
+
+#if defined(__AVX__)
+    for (; k + 8 <= count; k += 8) {
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (int p = 0; p < 6; p++) {
+            __m256 d = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(frustum[p][0]), _mm256_loadu_ps(corner[p][0] + k)),
+                              _mm256_mul_ps(_mm256_set1_ps(frustum[p][1]), _mm256_loadu_ps(corner[p][1] + k))),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(frustum[p][2]), _mm256_loadu_ps(corner[p][2] + k)),
+                              _mm256_set1_ps(frustum[p][3])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GT_OQ));
+        }
+
+        visible[k / 32] |= (uint32_t) _mm256_movemask_ps(inside) << (k % 32);
+    }
+#elif defined(__SSE2__)
+    for (; k + 4 <= count; k += 4) {
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (int p = 0; p < 6; p++) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(frustum[p][0]), _mm_loadu_ps(corner[p][0] + k)),
+                                             _mm_mul_ps(_mm_set1_ps(frustum[p][1]), _mm_loadu_ps(corner[p][1] + k))),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(frustum[p][2]), _mm_loadu_ps(corner[p][2] + k)),
+                                             _mm_set1_ps(frustum[p][3])));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, _mm_setzero_ps()));
+        }
+
+        visible[k / 32] |= (uint32_t) _mm_movemask_ps(inside) << (k % 32);
+    }
+#endif
+
+    for (; k < count; k++) {
+        bool inside = true;
+
+        for (int p = 0; p < 6; p++)
+            inside &= frustum[p][0] * corner[p][0][k] + frustum[p][1] * corner[p][1][k]
+                    + frustum[p][2] * corner[p][2][k] + frustum[p][3]
+                > 0;
+
+        if (inside)
+            visible[k / 32] |= 1U << (k % 32);
+    }
+}
+
+void camera_boxes_clear(CameraBoxes * boxes) {
+    boxes->count = 0;
+    boxes->culled = 0;
+}
+
+void camera_boxes_add(CameraBoxes * boxes, float x0, float y0, float z0, float x1, float y1, float z1) {
+    if (boxes->count >= boxes->length) {
+        boxes->length = boxes->length ? boxes->length * 2 : 64;
+
+        for (int k = 0; k < 6; k++) {
+            boxes->bounds[k] = realloc(boxes->bounds[k], boxes->length * sizeof(float));
+            CHECK_ALLOCATION_ERROR(boxes->bounds[k])
+        }
+
+        boxes->visible = realloc(boxes->visible, boxes->length / 32 * sizeof(uint32_t));
+        CHECK_ALLOCATION_ERROR(boxes->visible)
+    }
+
+    boxes->bounds[0][boxes->count] = x0;
+    boxes->bounds[1][boxes->count] = y0;
+    boxes->bounds[2][boxes->count] = z0;
+    boxes->bounds[3][boxes->count] = x1;
+    boxes->bounds[4][boxes->count] = y1;
+    boxes->bounds[5][boxes->count] = z1;
+    boxes->count++;
+}
+
+void camera_boxes_cull(CameraBoxes * boxes) {
+    if (boxes->count > 0)
+        camera_BoxesInFrustum(boxes->count, boxes->bounds[0], boxes->bounds[1], boxes->bounds[2], boxes->bounds[3],
+                              boxes->bounds[4], boxes->bounds[5], boxes->visible);
+
+    boxes->culled = boxes->count;
+}
+
+bool camera_boxes_visible(CameraBoxes * boxes, size_t index) {
+    return index >= boxes->culled || (boxes->visible[index / 32] >> (index % 32)) & 1;
+}
+
+typedef struct {
+    CameraBoxes * boxes;
+    size_t index;
+    void (*box)(void * object, float * bounds);
+    bool (*callback)(void * object, void * user);
+    void * user;
+} CameraBoxesEntities;
+
+static bool camera_boxes_collect_single(void * obj, void * user) {
+    CameraBoxesEntities * info = (CameraBoxesEntities *) user;
+
+    float b[6];
+    info->box(obj, b);
+    camera_boxes_add(info->boxes, b[0], b[1], b[2], b[3], b[4], b[5]);
+
+    return false;
+}
+
+void camera_boxes_collect(CameraBoxes * boxes, EntitySystem * es, void (*box)(void * object, float * bounds)) {
+    camera_boxes_clear(boxes);
+    entitysys_iterate(es, &(CameraBoxesEntities) {.boxes = boxes, .box = box}, camera_boxes_collect_single);
+    camera_boxes_cull(boxes);
+}
+
+static bool camera_boxes_iterate_single(void * obj, void * user) {
+    CameraBoxesEntities * info = (CameraBoxesEntities *) user;
+    return camera_boxes_visible(info->boxes, info->index++) && info->callback(obj, info->user);
+}
+
+void camera_boxes_iterate(CameraBoxes * boxes, EntitySystem * es, void * user,
+                          bool (*callback)(void * object, void * user)) {
+    entitysys_iterate(es, &(CameraBoxesEntities) {.boxes = boxes, .callback = callback, .user = user},
+                      camera_boxes_iterate_single);
+}
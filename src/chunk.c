@@ -24,13 +24,21 @@
 #include <float.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 #include <BetterSpades/common.h>
+#include <BetterSpades/opengl.h>
 #include <BetterSpades/window.h>
 #include <BetterSpades/config.h>
 #include <BetterSpades/texture.h>
 #include <BetterSpades/matrix.h>
 #include <BetterSpades/map.h>
 #include <BetterSpades/camera.h>
+#include <BetterSpades/occlusion.h>
 #include <BetterSpades/tesselator.h>
 #include <BetterSpades/chunk.h>
 #include <BetterSpades/channel.h>
@@ -41,28 +49,114 @@
 Chunk chunks[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
 
 HashTable chunk_block_queue;
-Channel chunk_work_queue, chunk_result_queue;
+Channel chunk_result_queue;
 pthread_mutex_t chunk_block_queue_lock;
 
+// Chunks waiting to be meshed. Workers always take the most urgent one, requests for a chunk that is
+// already waiting are merged into its entry.
+static struct {
+    Chunk * pending[CHUNKS_PER_DIM * CHUNKS_PER_DIM];
+    size_t pending_count;
+    int wasted;
+    pthread_mutex_t lock;
+    pthread_cond_t signal;
+} chunk_scheduler;
+
 typedef struct {
     size_t chunk_x;
     size_t chunk_y;
     Chunk * chunk;
+    uint8_t sections;
+    bool rebuild;
+    bool with_lod;
+    uint32_t generation;
 } ChunkWorkPacket;
 
 typedef struct {
     Chunk * chunk;
+    bool rebuild;
+    uint32_t generation;
     int max_height;
-    Tesselator tesselator;
-    uint32_t * minimap_data;
+    uint8_t sections;
+    bool with_lod;
+    Tesselator tesselator[CHUNK_SECTIONS];
+    Tesselator lod[CHUNK_LODS]; // of the whole chunk, only if with_lod
+    TesselatorPool * pool; // of the worker, the tesselators are released to it after upload
+    uint32_t minimap_data[CHUNK_SIZE * CHUNK_SIZE];
+    uint8_t occluder[CHUNK_OCCLUDERS * CHUNK_OCCLUDERS];
+    float time;
 } ChunkResultPacket;
 
 typedef struct {
     Chunk * chunk;
     int mirror_x;
     int mirror_y;
+    float distance;
+    uint8_t sections;
+    int lod_level;
 } ChunkRenderCall;
 
+// bounds of all sections in range, tested against the frustum at once
+static CameraBoxes chunk_bounds;
+
+// all chunk meshes live in here, so that those visible can be drawn with few calls
+static GLXArena chunk_arena;
+
+// packed vertices need a shader to be drawn, without one chunks use short vertices and colors
+static int chunk_program = 0;
+static TesselatorVertexType chunk_vertex_type = VERTEX_INT;
+
+static TesselatorPool chunk_pools[CHUNK_WORKERS_MAX];
+
+int chunk_draw_count = 0;
+int chunk_draw_triangles = 0;
+
+// coarser meshes start at half and three quarters of the render distance
+#define CHUNK_LOD_START 0.25F
+#define CHUNK_LOD_STEP 0.25F
+// blocks a chunk has to move past a boundary before its level changes, so that it does not flicker
+#define CHUNK_LOD_HYSTERESIS 4.0F
+// coarse meshes of edited chunks are rebuilt at most this often, after all other jobs
+#define CHUNK_LOD_REFRESH 1.0F
+static float chunk_lod_refresh_start;
+
+// chunks this close are drawn into the occlusion buffer, closest first
+#define CHUNK_OCCLUDER_DISTANCE 96.0F
+#define CHUNK_OCCLUDERS_MAX 64
+
+int chunk_occluded = 0;
+float chunk_occlusion_time = 0.0F;
+int chunk_occlusion_checked = 0;
+int chunk_occlusion_visible = 0;
+
+#ifndef OPENGL_ES
+static GLuint chunk_occlusion_query = 0;
+static bool chunk_occlusion_query_pending = false;
+#endif
+
+float chunk_update_time = 0.0F;
+float chunk_update_bytes = 0.0F;
+int chunk_jobs_queued = 0;
+float chunk_jobs_wasted = 0.0F;
+static float chunk_jobs_wasted_start;
+
+// finished meshes uploaded per frame, more would cause hitches after a map load
+#define CHUNK_UPLOAD_BUDGET (2 * 1024 * 1024)
+#define CHUNK_UPLOAD_BUDGET_TIME 0.004F
+
+int chunk_upload_queued = 0;
+int chunk_upload_bytes = 0;
+
+// copy of the minimap texture, rows between top and bottom have changed since the last upload
+#define CHUNK_MINIMAP_SIZE (CHUNKS_PER_DIM * CHUNK_SIZE)
+static uint32_t chunk_minimap[CHUNK_MINIMAP_SIZE * CHUNK_MINIMAP_SIZE];
+static int chunk_minimap_top = CHUNK_MINIMAP_SIZE;
+static int chunk_minimap_bottom = 0;
+
+// used to report how long a full rebuild after a map change took
+static float chunk_rebuild_start;
+static int chunk_rebuild_pending;
+
 void chunk_init() {
     for (size_t x = 0; x < CHUNKS_PER_DIM; x++) {
         for (size_t y = 0; y < CHUNKS_PER_DIM; y++) {
@@ -74,26 +168,230 @@ void chunk_init() {
         }
     }
 
-    channel_create(&chunk_work_queue, sizeof(ChunkWorkPacket), CHUNKS_PER_DIM * CHUNKS_PER_DIM);
+    chunk_scheduler.pending_count = 0;
+    chunk_scheduler.wasted = 0;
+    pthread_mutex_init(&chunk_scheduler.lock, NULL);
+    pthread_cond_init(&chunk_scheduler.signal, NULL);
+
     channel_create(&chunk_result_queue, sizeof(ChunkResultPacket), CHUNKS_PER_DIM * CHUNKS_PER_DIM);
-    ht_setup(&chunk_block_queue, sizeof(Chunk *), sizeof(ChunkResultPacket), 64);
+    ht_setup(&chunk_block_queue, sizeof(Chunk *), sizeof(ChunkWorkPacket), 64);
 
     pthread_mutex_init(&chunk_block_queue_lock, NULL);
 
+#ifndef OPENGL_ES
+    if (glx_version && !settings.force_displaylist) {
+        chunk_program = glx_shader("attribute vec2 xz;\n"
+                                   "attribute vec4 yrgb;\n"
+                                   "uniform vec3 fog;\n"
+                                   "uniform vec2 camera;\n"
+                                   "uniform vec2 offset;\n"
+                                   "uniform float dist_factor;\n"
+                                   "void main(void) {\n"
+                                   "    vec4 position = vec4(xz.x, yrgb.x, xz.y, 1.0);\n"
+                                   "    gl_Position = gl_ModelViewProjectionMatrix*position;\n"
+                                   "    float dist = length(position.xz+offset-camera)*dist_factor;\n"
+                                   "    gl_FrontColor = mix(vec4(yrgb.yzw/255.0,1.0),vec4(fog,1.0),min(dist,1.0));\n"
+                                   "}\n",
+                                   "void main(void) {\n"
+                                   "    gl_FragColor = gl_Color;\n"
+                                   "}\n");
+
+        int linked = 0;
+        glGetProgramiv(chunk_program, GL_LINK_STATUS, &linked);
+
+        if (!linked) {
+            log_warn("Chunk shader failed to link, using fixed function chunk vertices");
+            glDeleteProgram(chunk_program);
+            chunk_program = 0;
+        }
+    }
+#endif
+
+    // 256K vertices to start with, the arena grows with the map when it is compacted
+    glx_arena_create(&chunk_arena, 1 << 18, chunk_program);
+    chunk_vertex_type = chunk_arena.enabled && chunk_program ? VERTEX_PACKED : VERTEX_INT;
+
     int chunk_enabled_cores = clamp(1, CHUNK_WORKERS_MAX, window_cpucores() / 2);
     log_info("%i cores enabled for chunk generation", chunk_enabled_cores);
 
     pthread_t threads[chunk_enabled_cores];
 
-    for (size_t k = 0; k < chunk_enabled_cores; k++)
-        pthread_create(threads + k, NULL, chunk_generate, NULL);
+    // each worker has its own pool, so that workers do not contend on it or on malloc
+    for (size_t k = 0; k < chunk_enabled_cores; k++) {
+        tesselator_pool_create(chunk_pools + k, chunk_vertex_type, 0);
+        pthread_create(threads + k, NULL, chunk_generate, chunk_pools + k);
+    }
+}
+
+// Lower is more urgent: the distance to the closest copy of the chunk, those out of view or out of render
+// distance come after all others. The frustum is only checked on the main thread.
+static float chunk_priority(Chunk * c, bool frustum) {
+    float dx = (c->x + 0.5F) * CHUNK_SIZE - camera.pos.x;
+    float dz = (c->y + 0.5F) * CHUNK_SIZE - camera.pos.z;
+    dx -= map_size_x * roundf(dx / map_size_x);
+    dz -= map_size_z * roundf(dz / map_size_z);
+
+    float distance = sqrtf(dx * dx + dz * dz);
+
+    if (distance > settings.render_distance + 1.414F * CHUNK_SIZE
+       || (frustum
+           && !camera_CubeInFrustum(camera.pos.x + dx, 0.0F, camera.pos.z + dz, CHUNK_SIZE / 2, CHUNK_HEIGHT)))
+        distance += map_size_x + map_size_z;
+
+    // only coarse meshes waiting, those come last
+    if (!c->pending)
+        distance += 2 * (map_size_x + map_size_z);
+
+    return distance;
+}
+
+// must be called with the scheduler lock held
+static void chunk_queue(Chunk * c, uint8_t sections, bool rebuild, bool with_lod) {
+    bool queued = c->pending || c->pending_lod;
+
+    c->pending |= sections;
+    c->pending_rebuild |= rebuild;
+
+    if (with_lod) {
+        c->pending_lod = true;
+        c->lod_stale = false;
+    }
+
+    c->priority = chunk_priority(c, false);
+
+    if (!queued) {
+        chunk_scheduler.pending[chunk_scheduler.pending_count++] = c;
+        pthread_cond_signal(&chunk_scheduler.signal);
+    }
+}
+
+// Coarse meshes are only built along with a full rebuild. After edits they are refreshed later on their own,
+// so that an edit only costs the sections it touches. Must be called with the scheduler lock held.
+static void chunk_request(Chunk * c, uint8_t sections, bool rebuild) {
+    c->generation++;
+
+    for (int s = 0; s < CHUNK_SECTIONS; s++)
+        if (sections & (1 << s))
+            c->section_generation[s] = c->generation;
+
+    bool with_lod = rebuild && settings.chunk_lod;
+
+    if (!with_lod && !c->pending_lod)
+        c->lod_stale = true;
+
+    chunk_queue(c, sections, rebuild, with_lod);
+}
+
+// A job is superseded once every section it covers has been requested again, and for its coarse meshes
+// once any section has, its result would be replaced anyway. Must be called with the scheduler lock held.
+static bool chunk_superseded(Chunk * c, uint8_t sections, bool with_lod, uint32_t generation) {
+    bool changed = false;
+
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+        if (c->section_generation[s] > generation)
+            changed = true;
+        else if (sections & (1 << s))
+            return false;
+    }
+
+    return !with_lod || changed;
+}
+
+// blocks until there is a chunk no other worker is meshing
+static void chunk_schedule_next(ChunkWorkPacket * work) {
+    pthread_mutex_lock(&chunk_scheduler.lock);
+
+    while (1) {
+        int best = -1;
+
+        for (size_t k = 0; k < chunk_scheduler.pending_count; k++) {
+            Chunk * c = chunk_scheduler.pending[k];
+
+            if (!c->busy && (best < 0 || c->priority < chunk_scheduler.pending[best]->priority))
+                best = k;
+        }
+
+        if (best >= 0) {
+            Chunk * c = chunk_scheduler.pending[best];
+            chunk_scheduler.pending[best] = chunk_scheduler.pending[--chunk_scheduler.pending_count];
+
+            *work = (ChunkWorkPacket) {
+                .chunk      = c,
+                .chunk_x    = c->x,
+                .chunk_y    = c->y,
+                .sections   = c->pending,
+                .rebuild    = c->pending_rebuild,
+                .with_lod   = c->pending_lod,
+                .generation = c->generation,
+            };
+
+            c->pending = 0;
+            c->pending_rebuild = false;
+            c->pending_lod = false;
+            c->busy = true;
+            break;
+        }
+
+        pthread_cond_wait(&chunk_scheduler.signal, &chunk_scheduler.lock);
+    }
+
+    pthread_mutex_unlock(&chunk_scheduler.lock);
+}
+
+// Ends a job and tells if its result is still of use. Otherwise the chunk is already waiting again
+// and will be built with the rebuild flag of this job.
+static bool chunk_schedule_done(ChunkWorkPacket * work) {
+    pthread_mutex_lock(&chunk_scheduler.lock);
+
+    Chunk * c = work->chunk;
+    bool superseded = chunk_superseded(c, work->sections, work->with_lod, work->generation);
+
+    if (superseded) {
+        chunk_queue(c, 0, work->rebuild, work->with_lod);
+        chunk_scheduler.wasted++;
+    }
+
+    c->busy = false;
+
+    // another worker might have skipped this chunk while it was busy
+    if (c->pending || c->pending_lod)
+        pthread_cond_signal(&chunk_scheduler.signal);
+
+    pthread_mutex_unlock(&chunk_scheduler.lock);
+
+    return !superseded;
+}
+
+int chunk_lod_level(float distance, int current) {
+    int level = 0;
+
+    if (settings.chunk_lod) {
+        for (int l = 1; l <= CHUNK_LODS; l++) {
+            float start = settings.render_distance * (CHUNK_LOD_START + CHUNK_LOD_STEP * l);
+
+            if (distance > start + (current < l ? CHUNK_LOD_HYSTERESIS : -CHUNK_LOD_HYSTERESIS))
+                level = l;
+        }
+    }
+
+    return level;
+}
+
+// level of detail to draw a chunk at, current is the level it was drawn at last frame
+static int chunk_lod_select(Chunk * c, float distance, int current) {
+    int level = chunk_lod_level(distance, current);
+
+    // a coarse mesh is only empty if it has not been built yet or the chunk is empty anyway
+    while (level > 0 && c->lod[level - 1].size == 0)
+        level--;
+
+    return level;
 }
 
 static int chunk_sort(const void * a, const void * b) {
     ChunkRenderCall * aa = (ChunkRenderCall *) a;
     ChunkRenderCall * bb = (ChunkRenderCall *) b;
-    return norm2f(aa->chunk->x * CHUNK_SIZE + CHUNK_SIZE / 2, aa->chunk->y * CHUNK_SIZE + CHUNK_SIZE / 2, camera.pos.x, camera.pos.z)
-         - norm2f(bb->chunk->x * CHUNK_SIZE + CHUNK_SIZE / 2, bb->chunk->y * CHUNK_SIZE + CHUNK_SIZE / 2, camera.pos.x, camera.pos.z);
+    return (aa->distance > bb->distance) - (aa->distance < bb->distance);
 }
 
 void chunk_render(ChunkRenderCall * c) {
@@ -104,7 +402,13 @@ void chunk_render(ChunkRenderCall * c) {
 
         // glPolygonMode(GL_FRONT, GL_LINE);
 
-        glx_displaylist_draw(&c->chunk->display_list, GLX_DISPLAYLIST_NORMAL);
+        if (c->lod_level > 0) {
+            glx_displaylist_draw(c->chunk->lod + c->lod_level - 1, GLX_DISPLAYLIST_NORMAL);
+        } else {
+            for (int s = 0; s < CHUNK_SECTIONS; s++)
+                if (c->sections & (1 << s))
+                    glx_displaylist_draw(c->chunk->display_list + s, GLX_DISPLAYLIST_NORMAL);
+        }
 
         // glPolygonMode(GL_FRONT, GL_FILL);
 
@@ -112,56 +416,346 @@ void chunk_render(ChunkRenderCall * c) {
     }
 }
 
+// height of an occluder cell anywhere around the map, cells of chunks not built yet are empty
+static int chunk_occluder_height(int x, int z) {
+    uint32_t cell_x = ((uint32_t) x) % (CHUNKS_PER_DIM * CHUNK_OCCLUDERS);
+    uint32_t cell_z = ((uint32_t) z) % (CHUNKS_PER_DIM * CHUNK_OCCLUDERS);
+    Chunk * c = chunks + cell_x / CHUNK_OCCLUDERS + (cell_z / CHUNK_OCCLUDERS) * CHUNKS_PER_DIM;
+
+    return c->created ? c->occluder[cell_x % CHUNK_OCCLUDERS + (cell_z % CHUNK_OCCLUDERS) * CHUNK_OCCLUDERS] : 0;
+}
+
+// Draws the occluders of the closest chunks into the occlusion buffer and removes all sections hidden behind
+// them from the calls. One of those culled is returned in box, to check it on the gpu.
+static int chunk_occlusion_cull(ChunkRenderCall * calls, int count, float * box) {
+    float start = window_time();
+
+    mat4 view_projection;
+    matrix_load(view_projection, matrix_view);
+    matrix_multiply(view_projection, matrix_projection);
+
+    occlusion_begin(view_projection);
+
+    for (int k = 0; k < min(count, CHUNK_OCCLUDERS_MAX) && calls[k].distance < sqrf(CHUNK_OCCLUDER_DISTANCE);
+         k++) {
+        Chunk * c = calls[k].chunk;
+
+        for (int j = 0; j < CHUNK_OCCLUDERS; j++) {
+            for (int i = 0; i < CHUNK_OCCLUDERS; i++) {
+                int cell_x = (c->x + calls[k].mirror_x * CHUNKS_PER_DIM) * CHUNK_OCCLUDERS + i;
+                int cell_z = (c->y + calls[k].mirror_y * CHUNKS_PER_DIM) * CHUNK_OCCLUDERS + j;
+                float x0 = cell_x * CHUNK_OCCLUDER_SIZE, x1 = x0 + CHUNK_OCCLUDER_SIZE;
+                float z0 = cell_z * CHUNK_OCCLUDER_SIZE, z1 = z0 + CHUNK_OCCLUDER_SIZE;
+                float h = c->occluder[i + j * CHUNK_OCCLUDERS];
+
+                if (h == 0)
+                    continue;
+
+                if (camera.pos.y > h)
+                    occlusion_add_quad((float[4][3]) {{x0, h, z0}, {x1, h, z0}, {x1, h, z1}, {x0, h, z1}});
+
+                // sides are only drawn where they stick out of the neighbouring cell
+                float n;
+                if (camera.pos.x < x0 && (n = chunk_occluder_height(cell_x - 1, cell_z)) < h)
+                    occlusion_add_quad((float[4][3]) {{x0, n, z0}, {x0, h, z0}, {x0, h, z1}, {x0, n, z1}});
+                if (camera.pos.x > x1 && (n = chunk_occluder_height(cell_x + 1, cell_z)) < h)
+                    occlusion_add_quad((float[4][3]) {{x1, n, z0}, {x1, h, z0}, {x1, h, z1}, {x1, n, z1}});
+                if (camera.pos.z < z0 && (n = chunk_occluder_height(cell_x, cell_z - 1)) < h)
+                    occlusion_add_quad((float[4][3]) {{x0, n, z0}, {x1, n, z0}, {x1, h, z0}, {x0, h, z0}});
+                if (camera.pos.z > z1 && (n = chunk_occluder_height(cell_x, cell_z + 1)) < h)
+                    occlusion_add_quad((float[4][3]) {{x0, n, z1}, {x1, n, z1}, {x1, h, z1}, {x0, h, z1}});
+            }
+        }
+    }
+
+    occlusion_end();
+
+    int culled = 0;
+    int left = 0;
+
+    for (int k = 0; k < count; k++) {
+        Chunk * c = calls[k].chunk;
+        float x = (c->x + calls[k].mirror_x * CHUNKS_PER_DIM) * CHUNK_SIZE;
+        float z = (c->y + calls[k].mirror_y * CHUNKS_PER_DIM) * CHUNK_SIZE;
+
+        for (int s = 0; s < CHUNK_SECTIONS; s++) {
+            if (calls[k].sections & (1 << s)) {
+                // coarse meshes may reach up to one cell above the highest block
+                int bottom = s * CHUNK_SECTION_HEIGHT;
+                int top = min(bottom + CHUNK_SECTION_HEIGHT, c->max_height + (1 << CHUNK_LODS) - 1);
+
+                if (occlusion_test_box(x, bottom, z, x + CHUNK_SIZE, top, z + CHUNK_SIZE)) {
+                    calls[k].sections &= ~(1 << s);
+
+                    // any of them is equally likely to be checked
+                    if (rand() % ++culled == 0) {
+                        box[0] = x;
+                        box[1] = bottom;
+                        box[2] = z;
+                        box[3] = x + CHUNK_SIZE;
+                        box[4] = top;
+                        box[5] = z + CHUNK_SIZE;
+                    }
+                }
+            }
+        }
+
+        if (calls[k].sections)
+            calls[left++] = calls[k];
+    }
+
+    chunk_occluded = culled;
+    chunk_occlusion_time += (window_time() - start - chunk_occlusion_time) / 16.0F;
+
+    return left;
+}
+
+// Tests the box of a culled section against the terrain drawn with an occlusion query, its result is only read
+// a frame later so that the cpu never waits for it.
+static void chunk_occlusion_check(float * box) {
+#ifndef OPENGL_ES
+    if (!glx_version)
+        return;
+
+    if (!chunk_occlusion_query)
+        glGenQueries(1, &chunk_occlusion_query);
+
+    if (chunk_occlusion_query_pending) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(chunk_occlusion_query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (!available)
+            return;
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(chunk_occlusion_query, GL_QUERY_RESULT, &samples);
+        chunk_occlusion_checked++;
+        if (samples > 0)
+            chunk_occlusion_visible++;
+        chunk_occlusion_query_pending = false;
+
+        // older checks fade out, so that the counts follow the current view
+        if (chunk_occlusion_checked >= 1000) {
+            chunk_occlusion_checked /= 2;
+            chunk_occlusion_visible /= 2;
+        }
+    }
+
+    if (!box)
+        return;
+
+    static const int faces[6][4] = {
+        {0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6},
+    };
+
+    float vertices[6 * 4 * 3];
+    for (int f = 0; f < 6; f++) {
+        for (int k = 0; k < 4; k++) {
+            int corner = faces[f][k];
+            vertices[(f * 4 + k) * 3 + 0] = box[(corner & 1) ? 3 : 0];
+            vertices[(f * 4 + k) * 3 + 1] = box[(corner & 2) ? 4 : 1];
+            vertices[(f * 4 + k) * 3 + 2] = box[(corner & 4) ? 5 : 2];
+        }
+    }
+
+    matrix_upload();
+    glDisable(GL_CULL_FACE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    glBeginQuery(GL_SAMPLES_PASSED, chunk_occlusion_query);
+    glx_draw_quads(6 * 4, GLX_DISPLAYLIST_ENHANCED, vertices, NULL, NULL);
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glEnable(GL_CULL_FACE);
+
+    chunk_occlusion_query_pending = true;
+#endif
+}
+
 void chunk_draw_visible() {
     ChunkRenderCall chunks_draw[CHUNKS_PER_DIM * CHUNKS_PER_DIM * 2];
     int index = 0;
+    int sections = 0;
 
     int overshoot = (settings.render_distance + CHUNK_SIZE - 1) / CHUNK_SIZE + 1;
 
-    // go through all possible chunks and store all in range and view
+    camera_boxes_clear(&chunk_bounds);
+
+    // go through all possible chunks and store all in range, with the bounds of each of their sections
     for (int y = -overshoot; y < CHUNKS_PER_DIM + overshoot; y++) {
         for (int x = -overshoot; x < CHUNKS_PER_DIM + overshoot; x++) {
-            if (norm2f((x + 0.5F) * CHUNK_SIZE, (y + 0.5F) * CHUNK_SIZE, camera.pos.x, camera.pos.z) <=
-                sqrf(settings.render_distance + 1.414F * CHUNK_SIZE)) {
+            float distance = norm2f((x + 0.5F) * CHUNK_SIZE, (y + 0.5F) * CHUNK_SIZE, camera.pos.x, camera.pos.z);
+
+            if (distance <= sqrf(settings.render_distance + 1.414F * CHUNK_SIZE)) {
                 uint32_t tmp_x = ((uint32_t) x) % CHUNKS_PER_DIM;
                 uint32_t tmp_y = ((uint32_t) y) % CHUNKS_PER_DIM;
 
                 Chunk * c = chunks + tmp_x + tmp_y * CHUNKS_PER_DIM;
 
-                if (camera_CubeInFrustum((x + 0.5F) * CHUNK_SIZE, 0.0F, (y + 0.5F) * CHUNK_SIZE, CHUNK_SIZE / 2,
-                                        c->max_height))
+                if (c->created) {
                     chunks_draw[index++] = (ChunkRenderCall) {
                         .chunk = c,
                         .mirror_x = (x < 0) ? -1 : ((x >= CHUNKS_PER_DIM) ? 1 : 0),
                         .mirror_y = (y < 0) ? -1 : ((y >= CHUNKS_PER_DIM) ? 1 : 0),
+                        .distance = distance,
                     };
+
+                    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                        int bottom = s * CHUNK_SECTION_HEIGHT;
+                        int top = min(bottom + CHUNK_SECTION_HEIGHT, c->max_height);
+
+                        camera_boxes_add(&chunk_bounds, x * CHUNK_SIZE, bottom, y * CHUNK_SIZE, (x + 1) * CHUNK_SIZE,
+                                         max(top, bottom), (y + 1) * CHUNK_SIZE);
+                    }
+                }
+            }
+        }
+    }
+
+    // keep those with sections in view
+    camera_boxes_cull(&chunk_bounds);
+
+    int candidates = index;
+    index = 0;
+
+    for (int k = 0; k < candidates; k++) {
+        uint8_t visible = 0;
+
+        for (int s = 0; s < CHUNK_SECTIONS; s++) {
+            if (chunks_draw[k].chunk->display_list[s].size > 0
+                && camera_boxes_visible(&chunk_bounds, k * CHUNK_SECTIONS + s)) {
+                visible |= 1 << s;
+                sections++;
             }
         }
+
+        if (visible) {
+            chunks_draw[index] = chunks_draw[k];
+            chunks_draw[index++].sections = visible;
+        }
     }
 
     // sort all chunks to draw those in front first
     qsort(chunks_draw, index, sizeof(ChunkRenderCall), chunk_sort);
 
-    for (int k = 0; k < index; k++)
-        chunk_render(chunks_draw + k);
+    float check[6];
+    index = chunk_occlusion_cull(chunks_draw, index, check);
+    sections -= chunk_occluded;
+
+    // the closest copy of a chunk decides its level, others only compare against it
+    bool seen[CHUNKS_PER_DIM * CHUNKS_PER_DIM] = {false};
+    int triangles = 0;
+
+    for (int k = 0; k < index; k++) {
+        Chunk * c = chunks_draw[k].chunk;
+        int level = chunk_lod_select(c, sqrtf(chunks_draw[k].distance), c->lod_level);
+
+        if (!seen[c - chunks]) {
+            seen[c - chunks] = true;
+            c->lod_level = level;
+        }
+
+        chunks_draw[k].lod_level = level;
+
+        if (level > 0) {
+            sections -= __builtin_popcount(chunks_draw[k].sections) - 1;
+            triangles += c->lod[level - 1].size / 2;
+        } else {
+            for (int s = 0; s < CHUNK_SECTIONS; s++)
+                if (chunks_draw[k].sections & (1 << s))
+                    triangles += c->display_list[s].size / 2;
+        }
+    }
+
+    chunk_draw_count = sections;
+    chunk_draw_triangles = triangles;
+
+    if (!chunk_arena.enabled) {
+        for (int k = 0; k < index; k++)
+            chunk_render(chunks_draw + k);
+        chunk_occlusion_check(chunk_occluded ? check : NULL);
+        return;
+    }
+
+    // one draw call for each map copy around the map, starting with the closest one
+    GLXDisplayList * lists[sections];
+    bool drawn[9] = {false};
+
+#ifndef OPENGL_ES
+    if (chunk_arena.program) {
+        glUseProgram(chunk_arena.program);
+        glUniform1f(glGetUniformLocation(chunk_arena.program, "dist_factor"),
+                    glx_fog ? 1.0F / settings.render_distance : 0.0F);
+        glUniform3f(glGetUniformLocation(chunk_arena.program, "fog"), fog_color[0], fog_color[1], fog_color[2]);
+        glUniform2f(glGetUniformLocation(chunk_arena.program, "camera"), camera.pos.x, camera.pos.z);
+    }
+#endif
+
+    for (int k = 0; k < index; k++) {
+        int mirror_x = chunks_draw[k].mirror_x;
+        int mirror_y = chunks_draw[k].mirror_y;
+
+        if (drawn[(mirror_x + 1) + (mirror_y + 1) * 3])
+            continue;
+
+        drawn[(mirror_x + 1) + (mirror_y + 1) * 3] = true;
+
+        size_t count = 0;
+        for (int i = k; i < index; i++)
+            if (chunks_draw[i].mirror_x == mirror_x && chunks_draw[i].mirror_y == mirror_y) {
+                if (chunks_draw[i].lod_level > 0) {
+                    lists[count++] = chunks_draw[i].chunk->lod + chunks_draw[i].lod_level - 1;
+                } else {
+                    for (int s = 0; s < CHUNK_SECTIONS; s++)
+                        if (chunks_draw[i].sections & (1 << s))
+                            lists[count++] = chunks_draw[i].chunk->display_list + s;
+                }
+            }
+
+        matrix_push(matrix_model);
+        matrix_translate(matrix_model, mirror_x * map_size_x, 0.0F, mirror_y * map_size_z);
+        matrix_upload();
+
+#ifndef OPENGL_ES
+        if (chunk_arena.program)
+            glUniform2f(glGetUniformLocation(chunk_arena.program, "offset"), mirror_x * map_size_x,
+                        mirror_y * map_size_z);
+#endif
+
+        glx_arena_draw(&chunk_arena, lists, count);
+
+        matrix_pop(matrix_model);
+    }
+
+#ifndef OPENGL_ES
+    if (chunk_arena.program)
+        glUseProgram(0);
+#endif
+
+    chunk_occlusion_check(chunk_occluded ? check : NULL);
 }
 
-static __attribute__((always_inline)) inline bool solid_array_isair(struct libvxl_chunk_copy * blocks, uint32_t x,
-                                                                    int32_t y, uint32_t z) {
-    if (y < 0)
-        return false;
-    if (y >= map_size_y)
-        return true;
+static __attribute__((always_inline)) inline bool solid_array_isair(ChunkVoxels * blocks, int x, int y, int z) {
+    return !blocks->solid[(y + 1)
+                          + CHUNK_VOXELS_Y
+                              * ((x - blocks->x + CHUNK_HALO)
+                                 + CHUNK_VOXELS_X * (z - blocks->z + CHUNK_HALO + CHUNK_HALO_SUNBLOCK))];
+}
 
-    return !libvxl_copy_chunk_is_solid(blocks, x % map_size_x, z % map_size_z, map_size_y - 1 - y);
+static __attribute__((always_inline)) inline uint32_t solid_array_color(ChunkVoxels * blocks, int x, int y, int z) {
+    return blocks->color[y + CHUNK_HEIGHT * ((x - blocks->x) + CHUNK_SIZE * (z - blocks->z))];
 }
 
-static __attribute__((always_inline)) inline float solid_sunblock(struct libvxl_chunk_copy * blocks, uint32_t x,
-                                                                  uint32_t y, uint32_t z) {
+static __attribute__((always_inline)) inline float solid_sunblock(ChunkVoxels * blocks, int x, int y, int z) {
     int dec = 18;
     int i = 127;
 
-    while (dec && y < map_size_y) {
+    while (dec && y < CHUNK_HEIGHT) {
         if (!solid_array_isair(blocks, x, ++y, --z))
             i -= dec;
         dec -= 2;
@@ -170,31 +764,116 @@ static __attribute__((always_inline)) inline float solid_sunblock(struct libvxl_
     return (float) i / 127.0F;
 }
 
+void chunk_voxels_expand(ChunkVoxels * voxels, struct libvxl_chunk_copy * copy, size_t start_x, size_t start_z) {
+    voxels->x = start_x;
+    voxels->z = start_z;
+    voxels->blocks = copy->blocks_sorted;
+    voxels->blocks_count = copy->blocks_sorted_count;
+
+    // The halo of the copy lines up with ours, so its geometry bits can be read in window order.
+    for (size_t z = 0; z < CHUNK_VOXELS_Z; z++) {
+        for (size_t x = 0; x < CHUNK_VOXELS_X; x++) {
+            uint8_t * column = voxels->solid + CHUNK_VOXELS_Y * (x + CHUNK_VOXELS_X * z);
+            size_t offset = (x + z * copy->size_x) * copy->depth;
+
+            column[0] = 1;
+            for (size_t k = 0; k < CHUNK_HEIGHT; k++, offset++)
+                column[CHUNK_HEIGHT - k] = (copy->geometry[offset / (sizeof(size_t) * 8)]
+                                            >> (offset % (sizeof(size_t) * 8)))
+                    & 1;
+            column[CHUNK_VOXELS_Y - 1] = 0;
+        }
+    }
+
+    memset(voxels->color, 0, sizeof(voxels->color));
+
+    for (size_t k = 0; k < copy->blocks_sorted_count; k++) {
+        struct libvxl_block * blk = copy->blocks_sorted + k;
+        size_t x = key_getx(blk->position) - start_x;
+        size_t z = key_gety(blk->position) - start_z;
+        size_t y = CHUNK_HEIGHT - 1 - key_getz(blk->position);
+        voxels->color[y + CHUNK_HEIGHT * (x + CHUNK_SIZE * z)] = blk->color & 0xFFFFFF;
+    }
+}
+
 // This grid is 1 pixel off on the right and bottom, but I doubt no one will notice.
 #define ISGRID(x, z) ((x) % 64 == 0 || (z) % 64 == 0 || (x) == 511 || (z) == 511)
 
 void * chunk_generate(void * data) {
     pthread_detach(pthread_self());
 
+    struct libvxl_chunk_copy blocks = {0};
+    ChunkVoxels * voxels = malloc(sizeof(ChunkVoxels));
+    TesselatorPool * pool = (TesselatorPool *) data;
+
     while (1) {
         ChunkWorkPacket work;
-        channel_await(&chunk_work_queue, &work);
+        chunk_schedule_next(&work);
+
+        float start = window_time();
+
+        map_copy_blocks(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE, CHUNK_HALO,
+                        CHUNK_HALO_SUNBLOCK);
 
-        if (!work.chunk) break;
+        // the map might have changed again while this job was waiting
+        pthread_mutex_lock(&chunk_scheduler.lock);
+        bool superseded = chunk_superseded(work.chunk, work.sections, work.with_lod, work.generation);
+        pthread_mutex_unlock(&chunk_scheduler.lock);
+
+        if (superseded) {
+            chunk_schedule_done(&work);
+            continue;
+        }
 
         ChunkResultPacket result;
         result.chunk = work.chunk;
-        result.minimap_data = malloc(CHUNK_SIZE * CHUNK_SIZE * sizeof(uint32_t));
-        tesselator_create(&result.tesselator, VERTEX_INT, 0);
+        result.rebuild = work.rebuild;
+        result.generation = work.generation;
+        result.sections = work.sections;
+        result.with_lod = work.with_lod;
+        result.pool = pool;
+
+        for (int s = 0; s < CHUNK_SECTIONS; s++)
+            if (result.sections & (1 << s))
+                tesselator_pool_take(pool, result.tesselator + s);
+
+        chunk_voxels_expand(voxels, &blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE);
+
+        // jobs that only refresh the coarse meshes have no sections to mesh
+        result.max_height = 0;
+
+        if (result.sections) {
+            switch (settings.greedy_meshing) {
+                case MESHING_NAIVE:
+                    chunk_generate_naive(voxels, result.tesselator, result.sections, &result.max_height,
+                                         settings.ambient_occlusion);
+                    break;
+                case MESHING_GREEDY:
+                    chunk_generate_greedy(voxels, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE,
+                                          result.tesselator, result.sections, &result.max_height);
+                    break;
+                default:
+                    chunk_generate_bitmask(voxels, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE,
+                                           result.tesselator, result.sections, &result.max_height);
+                    break;
+            }
+        }
+
+        for (int l = 0; l < CHUNK_LODS && result.with_lod; l++) {
+            tesselator_pool_take(pool, result.lod + l);
+            chunk_generate_lod(voxels, result.lod + l, 2 << l);
+        }
 
-        struct libvxl_chunk_copy blocks;
-        map_copy_blocks(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE);
+        chunk_generate_occluders(voxels, result.occluder);
 
-        if (settings.greedy_meshing)
-            chunk_generate_greedy(&blocks, work.chunk_x * CHUNK_SIZE, work.chunk_y * CHUNK_SIZE, &result.tesselator,
-                                  &result.max_height);
-        else
-            chunk_generate_naive(&blocks, &result.tesselator, &result.max_height, settings.ambient_occlusion);
+        if (!chunk_schedule_done(&work)) {
+            for (int s = 0; s < CHUNK_SECTIONS; s++)
+                if (result.sections & (1 << s))
+                    tesselator_pool_release(pool, result.tesselator + s);
+            for (int l = 0; l < CHUNK_LODS && result.with_lod; l++)
+                tesselator_pool_release(pool, result.lod + l);
+            continue;
+        }
 
         // Use the fact that libvxl orders libvxl_blocks by top-down coordinate first in its data structure.
         size_t chunk_x = work.chunk_x * CHUNK_SIZE;
@@ -222,46 +901,53 @@ void * chunk_generate(void * data) {
             }
         }
 
-        libvxl_copy_chunk_destroy(&blocks);
+        result.time = window_time() - start;
 
         channel_put(&chunk_result_queue, &result);
     }
 
+    libvxl_copy_chunk_destroy(&blocks);
+    free(voxels);
+
     return NULL;
 }
 
-void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, size_t start_z, Tesselator * tess,
-                           int * max_height) {
+void chunk_generate_greedy(ChunkVoxels * blocks, size_t start_x, size_t start_z, Tesselator * tess_sections,
+                           uint8_t sections, int * max_height) {
     *max_height = 0;
 
     int checked_voxels[2][CHUNK_SIZE * CHUNK_SIZE];
-    int checked_voxels2[2][CHUNK_SIZE * map_size_y];
+    int checked_voxels2[2][CHUNK_SIZE * CHUNK_HEIGHT];
 
     for (int z = start_z; z < start_z + CHUNK_SIZE; z++) {
-        memset(checked_voxels2[0], 0, sizeof(int) * CHUNK_SIZE * map_size_y);
-        memset(checked_voxels2[1], 0, sizeof(int) * CHUNK_SIZE * map_size_y);
+        memset(checked_voxels2[0], 0, sizeof(int) * CHUNK_SIZE * CHUNK_HEIGHT);
+        memset(checked_voxels2[1], 0, sizeof(int) * CHUNK_SIZE * CHUNK_HEIGHT);
 
         for (int x = start_x; x < start_x + CHUNK_SIZE; x++) {
-            for (int y = 0; y < map_size_y; y++) {
+            for (int y = 0; y < CHUNK_HEIGHT; y++) {
                 if (!solid_array_isair(blocks, x, y, z)) {
                     if (*max_height < y)
                         *max_height = y;
 
-                    uint32_t value = libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - y);
+                    if (!(sections & (1 << (y / CHUNK_SECTION_HEIGHT))))
+                        continue;
+
+                    Tesselator * tess = tess_sections + y / CHUNK_SECTION_HEIGHT;
+                    int section_end = (y / CHUNK_SECTION_HEIGHT + 1) * CHUNK_SECTION_HEIGHT;
+
+                    uint32_t value = solid_array_color(blocks, x, y, z);
                     TrueColor color = readBGR(&value);
 
-                    if ((z == 0 && solid_array_isair(blocks, x, y, map_size_z - 1))
-                       || (z > 0 && solid_array_isair(blocks, x, y, z - 1))) {
-                        if (checked_voxels2[0][y + (x - start_x) * map_size_y] == 0) {
+                    if (solid_array_isair(blocks, x, y, z - 1)) {
+                        if (checked_voxels2[0][y + (x - start_x) * CHUNK_HEIGHT] == 0) {
                             int len_y = 1;
                             int len_x = 1;
 
-                            for (int a = 1; a < map_size_y - y; a++) {
+                            for (int a = 1; a < section_end - y; a++) {
                                 if (!solid_array_isair(blocks, x, y + a, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - (y + a)) == value
-                                   && checked_voxels2[0][y + a + (x - start_x) * map_size_y] == 0
-                                   && ((z == 0 && solid_array_isair(blocks, x, y + a, map_size_z - 1))
-                                       || (z > 0 && solid_array_isair(blocks, x, y + a, z - 1))))
+                                   && solid_array_color(blocks, x, y + a, z) == value
+                                   && checked_voxels2[0][y + a + (x - start_x) * CHUNK_HEIGHT] == 0
+                                   && solid_array_isair(blocks, x, y + a, z - 1))
                                     len_y++;
                                 else
                                     break;
@@ -271,10 +957,9 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_y; a++) {
                                     if (solid_array_isair(blocks, x + b, y + a, z)
-                                       || libvxl_copy_chunk_get_color(blocks, x + b, z, map_size_y - 1 - (y + a)) != value
-                                       || checked_voxels2[0][y + a + (x + b - start_x) * map_size_y] != 0
-                                       || !((z == 0 && solid_array_isair(blocks, x + b, y + a, map_size_z - 1))
-                                            || (z > 0 && solid_array_isair(blocks, x + b, y + a, z - 1))))
+                                       || solid_array_color(blocks, x + b, y + a, z) != value
+                                       || checked_voxels2[0][y + a + (x + b - start_x) * CHUNK_HEIGHT] != 0
+                                       || !solid_array_isair(blocks, x + b, y + a, z - 1))
                                         break;
                                 }
                                 if (a == len_y)
@@ -285,7 +970,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
 
                             for (int b = 0; b < len_x; b++)
                                 for (int a = 0; a < len_y; a++)
-                                    checked_voxels2[0][y + a + (x + b - start_x) * map_size_y] = 1;
+                                    checked_voxels2[0][y + a + (x + b - start_x) * CHUNK_HEIGHT] = 1;
 
                             tesselator_set_color(tess, (TrueColor) {color.r * 0.875F, color.g * 0.875F, color.b * 0.875F, 255});
                             tesselator_addi_simple(
@@ -293,18 +978,16 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                         }
                     }
 
-                    if ((z == map_size_z - 1 && solid_array_isair(blocks, x, y, 0))
-                       || (z < map_size_z - 1 && solid_array_isair(blocks, x, y, z + 1))) {
-                        if (checked_voxels2[1][y + (x - start_x) * map_size_y] == 0) {
+                    if (solid_array_isair(blocks, x, y, z + 1)) {
+                        if (checked_voxels2[1][y + (x - start_x) * CHUNK_HEIGHT] == 0) {
                             int len_y = 1;
                             int len_x = 1;
 
-                            for (int a = 1; a < map_size_y - y; a++) {
+                            for (int a = 1; a < section_end - y; a++) {
                                 if (!solid_array_isair(blocks, x, y + a, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - (y + a)) == value
-                                   && checked_voxels2[1][y + a + (x - start_x) * map_size_y] == 0
-                                   && ((z == map_size_z - 1 && solid_array_isair(blocks, x, y + a, 0))
-                                       || (z < map_size_z - 1 && solid_array_isair(blocks, x, y + a, z + 1))))
+                                   && solid_array_color(blocks, x, y + a, z) == value
+                                   && checked_voxels2[1][y + a + (x - start_x) * CHUNK_HEIGHT] == 0
+                                   && solid_array_isair(blocks, x, y + a, z + 1))
                                     len_y++;
                                 else
                                     break;
@@ -314,10 +997,9 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_y; a++) {
                                     if (solid_array_isair(blocks, x + b, y + a, z)
-                                       || libvxl_copy_chunk_get_color(blocks, x + b, z, map_size_y - 1 - (y + a)) != value
-                                       || checked_voxels2[1][y + a + (x + b - start_x) * map_size_y] != 0
-                                       || !((z == map_size_z - 1 && solid_array_isair(blocks, x + b, y + a, 0))
-                                            || (z < map_size_z - 1 && solid_array_isair(blocks, x + b, y + a, z + 1))))
+                                       || solid_array_color(blocks, x + b, y + a, z) != value
+                                       || checked_voxels2[1][y + a + (x + b - start_x) * CHUNK_HEIGHT] != 0
+                                       || !solid_array_isair(blocks, x + b, y + a, z + 1))
                                         break;
                                 }
                                 if (a == len_y)
@@ -328,7 +1010,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
 
                             for (int b = 0; b < len_x; b++)
                                 for (int a = 0; a < len_y; a++)
-                                    checked_voxels2[1][y + a + (x + b - start_x) * map_size_y] = 1;
+                                    checked_voxels2[1][y + a + (x + b - start_x) * CHUNK_HEIGHT] = 1;
 
                             tesselator_set_color(tess, (TrueColor) {color.r * 0.625F, color.g * 0.625F, color.b * 0.625F, 255});
                             tesselator_addi_simple(tess,
@@ -342,31 +1024,35 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
     }
 
     for (int x = start_x; x < start_x + CHUNK_SIZE; x++) {
-        memset(checked_voxels2[0], 0, sizeof(int) * CHUNK_SIZE * map_size_y);
-        memset(checked_voxels2[1], 0, sizeof(int) * CHUNK_SIZE * map_size_y);
+        memset(checked_voxels2[0], 0, sizeof(int) * CHUNK_SIZE * CHUNK_HEIGHT);
+        memset(checked_voxels2[1], 0, sizeof(int) * CHUNK_SIZE * CHUNK_HEIGHT);
 
         for (int z = start_z; z < start_z + CHUNK_SIZE; z++) {
-            for (int y = 0; y < map_size_y; y++) {
+            for (int y = 0; y < CHUNK_HEIGHT; y++) {
                 if (!solid_array_isair(blocks, x, y, z)) {
                     if (*max_height < y) {
                         *max_height = y;
                     }
 
-                    uint32_t value = libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - y);
+                    if (!(sections & (1 << (y / CHUNK_SECTION_HEIGHT))))
+                        continue;
+
+                    Tesselator * tess = tess_sections + y / CHUNK_SECTION_HEIGHT;
+                    int section_end = (y / CHUNK_SECTION_HEIGHT + 1) * CHUNK_SECTION_HEIGHT;
+
+                    uint32_t value = solid_array_color(blocks, x, y, z);
                     TrueColor color = readBGR(&value);
 
-                    if ((x == 0 && solid_array_isair(blocks, map_size_x - 1, y, z))
-                       || (x > 0 && solid_array_isair(blocks, x - 1, y, z))) {
-                        if (checked_voxels2[0][y + (z - start_z) * map_size_y] == 0) {
+                    if (solid_array_isair(blocks, x - 1, y, z)) {
+                        if (checked_voxels2[0][y + (z - start_z) * CHUNK_HEIGHT] == 0) {
                             int len_y = 1;
                             int len_z = 1;
 
-                            for (int a = 1; a < map_size_y - y; a++) {
+                            for (int a = 1; a < section_end - y; a++) {
                                 if (!solid_array_isair(blocks, x, y + a, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - (y + a)) == value
-                                   && checked_voxels2[0][y + a + (z - start_z) * map_size_y] == 0
-                                   && ((x == 0 && solid_array_isair(blocks, map_size_x - 1, y + a, z))
-                                       || (x > 0 && solid_array_isair(blocks, x - 1, y + a, z))))
+                                   && solid_array_color(blocks, x, y + a, z) == value
+                                   && checked_voxels2[0][y + a + (z - start_z) * CHUNK_HEIGHT] == 0
+                                   && solid_array_isair(blocks, x - 1, y + a, z))
                                     len_y++;
                                 else
                                     break;
@@ -376,10 +1062,9 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_y; a++) {
                                     if (solid_array_isair(blocks, x, y + a, z + b)
-                                       || libvxl_copy_chunk_get_color(blocks, x, z + b, map_size_y - 1 - (y + a)) != value
-                                       || checked_voxels2[0][y + a + (z + b - start_z) * map_size_y] != 0
-                                       || !((x == 0 && solid_array_isair(blocks, map_size_x - 1, y + a, z + b))
-                                            || (x > 0 && solid_array_isair(blocks, x - 1, y + a, z + b))))
+                                       || solid_array_color(blocks, x, y + a, z + b) != value
+                                       || checked_voxels2[0][y + a + (z + b - start_z) * CHUNK_HEIGHT] != 0
+                                       || !solid_array_isair(blocks, x - 1, y + a, z + b))
                                         break;
                                 }
                                 if (a == len_y)
@@ -390,7 +1075,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
 
                             for (int b = 0; b < len_z; b++)
                                 for (int a = 0; a < len_y; a++)
-                                    checked_voxels2[0][y + a + (z + b - start_z) * map_size_y] = 1;
+                                    checked_voxels2[0][y + a + (z + b - start_z) * CHUNK_HEIGHT] = 1;
 
                             tesselator_set_color(tess, (TrueColor) {color.r * 0.75F, color.g * 0.75F, color.b * 0.75F, 255});
                             tesselator_addi_simple(
@@ -398,17 +1083,15 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                         }
                     }
 
-                    if ((x == map_size_x - 1 && solid_array_isair(blocks, 0, y, z))
-                       || (x < map_size_x - 1 && solid_array_isair(blocks, x + 1, y, z))) {
-                        if (checked_voxels2[1][y + (z - start_z) * map_size_y] == 0) {
+                    if (solid_array_isair(blocks, x + 1, y, z)) {
+                        if (checked_voxels2[1][y + (z - start_z) * CHUNK_HEIGHT] == 0) {
                             int len_y = 1, len_z = 1;
 
-                            for (int a = 1; a < map_size_y - y; a++) {
+                            for (int a = 1; a < section_end - y; a++) {
                                 if (!solid_array_isair(blocks, x, y + a, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - (y + a)) == value
-                                   && checked_voxels2[1][y + a + (z - start_z) * map_size_y] == 0
-                                   && ((x == map_size_x - 1 && solid_array_isair(blocks, 0, y + a, z))
-                                       || (x < map_size_x - 1 && solid_array_isair(blocks, x + 1, y + a, z))))
+                                   && solid_array_color(blocks, x, y + a, z) == value
+                                   && checked_voxels2[1][y + a + (z - start_z) * CHUNK_HEIGHT] == 0
+                                   && solid_array_isair(blocks, x + 1, y + a, z))
                                     len_y++;
                                 else
                                     break;
@@ -418,10 +1101,9 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_y; a++) {
                                     if (solid_array_isair(blocks, x, y + a, z + b)
-                                       || libvxl_copy_chunk_get_color(blocks, x, z + b, map_size_y - 1 - (y + a)) != value
-                                       || checked_voxels2[1][y + a + (z + b - start_z) * map_size_y] != 0
-                                       || !((x == map_size_x - 1 && solid_array_isair(blocks, 0, y + a, z + b))
-                                            || (x < map_size_x - 1 && solid_array_isair(blocks, x + 1, y + a, z + b))))
+                                       || solid_array_color(blocks, x, y + a, z + b) != value
+                                       || checked_voxels2[1][y + a + (z + b - start_z) * CHUNK_HEIGHT] != 0
+                                       || !solid_array_isair(blocks, x + 1, y + a, z + b))
                                         break;
                                 }
                                 if (a == len_y)
@@ -432,7 +1114,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
 
                             for (unsigned char b = 0; b < len_z; b++)
                                 for (unsigned char a = 0; a < len_y; a++)
-                                    checked_voxels2[1][y + a + (z + b - start_z) * map_size_y] = 1;
+                                    checked_voxels2[1][y + a + (z + b - start_z) * CHUNK_HEIGHT] = 1;
 
                             tesselator_set_color(tess, (TrueColor) {color.r * 0.75F, color.g * 0.75F, color.b * 0.75F, 255});
                             tesselator_addi_simple(tess,
@@ -445,7 +1127,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
         }
     }
 
-    for (int y = 0; y < map_size_y; y++) {
+    for (int y = 0; y < CHUNK_HEIGHT; y++) {
         memset(checked_voxels[0], 0, sizeof(int) * CHUNK_SIZE * CHUNK_SIZE);
         memset(checked_voxels[1], 0, sizeof(int) * CHUNK_SIZE * CHUNK_SIZE);
 
@@ -455,19 +1137,24 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                     if (*max_height < y)
                         *max_height = y;
 
-                    uint32_t value = libvxl_copy_chunk_get_color(blocks, x, z, map_size_y - 1 - y);
+                    if (!(sections & (1 << (y / CHUNK_SECTION_HEIGHT))))
+                        continue;
+
+                    Tesselator * tess = tess_sections + y / CHUNK_SECTION_HEIGHT;
+
+                    uint32_t value = solid_array_color(blocks, x, y, z);
                     TrueColor color = readBGR(&value);
 
-                    if (y == map_size_y - 1 || solid_array_isair(blocks, x, y + 1, z)) {
+                    if (y == CHUNK_HEIGHT - 1 || solid_array_isair(blocks, x, y + 1, z)) {
                         if (checked_voxels[0][(x - start_x) + (z - start_z) * CHUNK_SIZE] == 0) {
                             int len_x = 1;
                             int len_z = 1;
 
                             for (int a = 1; a < (start_x + CHUNK_SIZE - x); a++) {
                                 if (!solid_array_isair(blocks, x + a, y, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x + a, z, map_size_y - 1 - y) == value
+                                   && solid_array_color(blocks, x + a, y, z) == value
                                    && checked_voxels[0][(x + a - start_x) + (z - start_z) * CHUNK_SIZE] == 0
-                                   && (y == map_size_y - 1 || solid_array_isair(blocks, x + a, y + 1, z)))
+                                   && (y == CHUNK_HEIGHT - 1 || solid_array_isair(blocks, x + a, y + 1, z)))
                                     len_x++;
                                 else
                                     break;
@@ -477,9 +1164,9 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_x; a++) {
                                     if (solid_array_isair(blocks, x + a, y, z + b)
-                                       || libvxl_copy_chunk_get_color(blocks, x + a, z + b, map_size_y - 1 - y) != value
+                                       || solid_array_color(blocks, x + a, y, z + b) != value
                                        || checked_voxels[0][(x + a - start_x) + (z + b - start_z) * CHUNK_SIZE] != 0
-                                       || !(y == map_size_y - 1 || solid_array_isair(blocks, x + a, y + 1, z + b)))
+                                       || !(y == CHUNK_HEIGHT - 1 || solid_array_isair(blocks, x + a, y + 1, z + b)))
                                         break;
                                 }
                                 if (a == len_x)
@@ -506,7 +1193,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
 
                             for (int a = 1; a < (start_x + CHUNK_SIZE - x); a++) {
                                 if (!solid_array_isair(blocks, x + a, y, z)
-                                   && libvxl_copy_chunk_get_color(blocks, x + a, z, map_size_y - 1 - y) == value
+                                   && solid_array_color(blocks, x + a, y, z) == value
                                    && checked_voxels[1][(x + a - start_x) + (z - start_z) * CHUNK_SIZE] == 0
                                    && (y > 0 && solid_array_isair(blocks, x + a, y - 1, z)))
                                     len_x++;
@@ -518,7 +1205,7 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
                                 int a;
                                 for (a = 0; a < len_x; a++) {
                                     if (solid_array_isair(blocks, x + a, y, z + b)
-                                       || libvxl_copy_chunk_get_color(blocks, x + a, z + b, map_size_y - 1 - y) != value
+                                       || solid_array_color(blocks, x + a, y, z + b) != value
                                        || checked_voxels[1][(x + a - start_x) + (z + b - start_z) * CHUNK_SIZE] != 0
                                        || !(y > 0 && solid_array_isair(blocks, x + a, y - 1, z + b)))
                                         break;
@@ -546,6 +1233,244 @@ void chunk_generate_greedy(struct libvxl_chunk_copy * blocks, size_t start_x, si
     (*max_height)++;
 }
 
+// Bit columns along y of a chunk, as used by chunk_generate_bitmask(). Bit y of a column is voxel y.
+typedef struct {
+    uint64_t solid[CHUNK_SIZE + 2][CHUNK_SIZE + 2]; // [z][x], including one column of halo on each side
+    uint64_t same_y[CHUNK_SIZE][CHUNK_SIZE];         // color equals the voxel at y - 1
+    uint64_t same_x[CHUNK_SIZE][CHUNK_SIZE];         // color equals the voxel at x - 1
+    uint64_t same_z[CHUNK_SIZE][CHUNK_SIZE];         // color equals the voxel at z - 1
+} ChunkBitmask;
+
+typedef struct {
+    int u, v, len_u, len_v;
+} ChunkQuad;
+
+// Packs 64 bytes into one bit each, set when the byte is non-zero.
+static uint64_t bitmask_nonzero(const uint8_t * bytes) {
+    uint64_t res = 0;
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    for (int k = 0; k < 64; k += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (bytes + k));
+        res |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) << k;
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (int k = 0; k < 64; k += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (bytes + k));
+        res |= (uint64_t) (~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF) << k;
+    }
+#else
+    for (int k = 0; k < 64; k++)
+        res |= (uint64_t) (bytes[k] != 0) << k;
+#endif
+    return res;
+}
+
+// Bit k is set when a[k] == b[k], for the first length entries.
+static uint64_t bitmask_equal(const uint32_t * a, const uint32_t * b, int length) {
+    uint64_t res = 0;
+    int k = 0;
+#if defined(__AVX2__)
+    for (; k + 8 <= length; k += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) (a + k)),
+                                        _mm256_loadu_si256((const __m256i*) (b + k)));
+        res |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << k;
+    }
+#elif defined(__SSE2__)
+    for (; k + 4 <= length; k += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (a + k)), _mm_loadu_si128((const __m128i*) (b + k)));
+        res |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(eq)) << k;
+    }
+#endif
+    for (; k < length; k++)
+        res |= (uint64_t) (a[k] == b[k]) << k;
+    return res;
+}
+
+static int bitmask_run(uint64_t bits) {
+    return ~bits ? __builtin_ctzll(~bits) : 64;
+}
+
+// Joins faces stored as bit columns along v (one per u), extending along v first, then along u.
+static size_t bitmask_merge_columns(uint64_t * faces, uint64_t * same_v, uint64_t * same_u, ChunkQuad * out) {
+    uint64_t checked[CHUNK_SIZE] = {0};
+    size_t count = 0;
+
+    for (int u = 0; u < CHUNK_SIZE; u++) {
+        uint64_t remaining;
+        while ((remaining = faces[u] & ~checked[u])) {
+            int v = __builtin_ctzll(remaining);
+            int len_v = bitmask_run((remaining & (same_v[u] | (1ULL << v))) >> v);
+            uint64_t mask = (len_v == 64 ? ~0ULL : (1ULL << len_v) - 1) << v;
+
+            int len_u = 1;
+            while (u + len_u < CHUNK_SIZE
+                   && (faces[u + len_u] & ~checked[u + len_u] & same_u[u + len_u] & mask) == mask)
+                len_u++;
+
+            for (int k = 0; k < len_u; k++)
+                checked[u + k] |= mask;
+
+            out[count++] = (ChunkQuad) {u, v, len_u, len_v};
+        }
+    }
+
+    return count;
+}
+
+// Joins faces stored as bit rows along v (one per u), extending along u first, then along v.
+static size_t bitmask_merge_rows(uint32_t * faces, uint32_t * same_u, uint32_t * same_v, ChunkQuad * out) {
+    uint32_t checked[CHUNK_SIZE] = {0};
+    size_t count = 0;
+
+    for (int u = 0; u < CHUNK_SIZE; u++) {
+        uint32_t remaining;
+        while ((remaining = faces[u] & ~checked[u])) {
+            int v = __builtin_ctz(remaining);
+
+            int len_u = 1;
+            while (u + len_u < CHUNK_SIZE && (faces[u + len_u] & ~checked[u + len_u] & same_u[u + len_u] & (1U << v)))
+                len_u++;
+
+            int len_v = CHUNK_SIZE;
+            for (int k = 0; k < len_u; k++)
+                len_v = min(len_v, 1 + __builtin_ctz(~((faces[u + k] & ~checked[u + k] & same_v[u + k]) >> (v + 1))));
+
+            uint32_t mask = ((1U << len_v) - 1) << v;
+            for (int k = 0; k < len_u; k++)
+                checked[u + k] |= mask;
+
+            out[count++] = (ChunkQuad) {u, v, len_u, len_v};
+        }
+    }
+
+    return count;
+}
+
+static void bitmask_emit(ChunkVoxels * blocks, Tesselator * tess, TesselatorCubeFace face, float shade, int x, int y,
+                         int z, int sx, int sy, int sz) {
+    uint32_t value = solid_array_color(blocks, x, y, z);
+    TrueColor color = readBGR(&value);
+
+    if (shade < 1.0F)
+        color = (TrueColor) {color.r * shade, color.g * shade, color.b * shade, 255};
+
+    tesselator_set_color(tess, color);
+    tesselator_addi_cube_face_adv(tess, face, x, y, z, sx, sy, sz);
+}
+
+// Produces the same set of faces as chunk_generate_greedy(), but finds and joins them on
+// 64 bit voxel columns instead of visiting every voxel.
+void chunk_generate_bitmask(ChunkVoxels * blocks, size_t start_x, size_t start_z, Tesselator * tess,
+                            uint8_t sections, int * max_height) {
+    ChunkBitmask bits;
+    ChunkQuad quads[CHUNK_SIZE * CHUNK_HEIGHT];
+
+    *max_height = 0;
+
+    // faces are only looked for in the requested sections and never joined across sections
+    uint64_t selected = 0, section_starts = 0;
+    for (int y = 0; y < CHUNK_HEIGHT; y++) {
+        if (sections & (1 << (y / CHUNK_SECTION_HEIGHT)))
+            selected |= 1ULL << y;
+        if (y % CHUNK_SECTION_HEIGHT == 0)
+            section_starts |= 1ULL << y;
+    }
+
+    for (int z = 0; z < CHUNK_SIZE + 2; z++) {
+        for (int x = 0; x < CHUNK_SIZE + 2; x++) {
+            uint8_t * column = blocks->solid
+                + CHUNK_VOXELS_Y * ((x - 1 + CHUNK_HALO) + CHUNK_VOXELS_X * (z - 1 + CHUNK_HALO + CHUNK_HALO_SUNBLOCK));
+            bits.solid[z][x] = bitmask_nonzero(column + 1);
+        }
+    }
+
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint32_t * color = blocks->color + CHUNK_HEIGHT * (x + CHUNK_SIZE * z);
+            uint64_t solid = bits.solid[z + 1][x + 1];
+
+            bits.same_y[z][x] = bitmask_equal(color + 1, color, CHUNK_HEIGHT - 1) << 1;
+            bits.same_x[z][x] = x > 0 ? bitmask_equal(color, color - CHUNK_HEIGHT, CHUNK_HEIGHT) : 0;
+            bits.same_z[z][x] = z > 0 ? bitmask_equal(color, color - CHUNK_HEIGHT * CHUNK_SIZE, CHUNK_HEIGHT) : 0;
+
+            if (solid)
+                *max_height = max(*max_height, 63 - __builtin_clzll(solid));
+        }
+    }
+
+    uint64_t faces[2][CHUNK_SIZE], same_v[CHUNK_SIZE], same_u[CHUNK_SIZE];
+
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint64_t solid = bits.solid[z + 1][x + 1];
+            faces[0][x] = solid & ~bits.solid[z][x + 1] & selected;
+            faces[1][x] = solid & ~bits.solid[z + 2][x + 1] & selected;
+            same_v[x] = bits.same_y[z][x] & ~section_starts;
+            same_u[x] = bits.same_x[z][x];
+        }
+
+        for (int side = 0; side < 2; side++) {
+            size_t count = bitmask_merge_columns(faces[side], same_v, same_u, quads);
+            for (size_t k = 0; k < count; k++)
+                bitmask_emit(blocks, tess + quads[k].v / CHUNK_SECTION_HEIGHT, side ? CUBE_FACE_Z_P : CUBE_FACE_Z_N,
+                             side ? 0.625F : 0.875F, start_x + quads[k].u, quads[k].v, start_z + z, quads[k].len_u,
+                             quads[k].len_v, 1);
+        }
+    }
+
+    for (int x = 0; x < CHUNK_SIZE; x++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            uint64_t solid = bits.solid[z + 1][x + 1];
+            faces[0][z] = solid & ~bits.solid[z + 1][x] & selected;
+            faces[1][z] = solid & ~bits.solid[z + 1][x + 2] & selected;
+            same_v[z] = bits.same_y[z][x] & ~section_starts;
+            same_u[z] = bits.same_z[z][x];
+        }
+
+        for (int side = 0; side < 2; side++) {
+            size_t count = bitmask_merge_columns(faces[side], same_v, same_u, quads);
+            for (size_t k = 0; k < count; k++)
+                bitmask_emit(blocks, tess + quads[k].v / CHUNK_SECTION_HEIGHT, side ? CUBE_FACE_X_P : CUBE_FACE_X_N,
+                             0.75F, start_x + x, quads[k].v, start_z + quads[k].u, 1, quads[k].len_v, quads[k].len_u);
+        }
+    }
+
+    // Top and bottom faces are joined within a y layer, so transpose them into rows along z.
+    uint32_t rows[2][CHUNK_HEIGHT][CHUNK_SIZE] = {0};
+    uint32_t rows_same_x[2][CHUNK_HEIGHT][CHUNK_SIZE] = {0};
+    uint32_t rows_same_z[2][CHUNK_HEIGHT][CHUNK_SIZE] = {0};
+
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint64_t solid = bits.solid[z + 1][x + 1];
+            uint64_t side_faces[2] = {solid & ~(solid >> 1) & selected, solid & ~(solid << 1) & ~1ULL & selected};
+
+            for (int side = 0; side < 2; side++) {
+                for (uint64_t f = side_faces[side]; f; f &= f - 1) {
+                    int y = __builtin_ctzll(f);
+                    rows[side][y][x] |= 1U << z;
+                    rows_same_x[side][y][x] |= ((bits.same_x[z][x] >> y) & 1) << z;
+                    rows_same_z[side][y][x] |= ((bits.same_z[z][x] >> y) & 1) << z;
+                }
+            }
+        }
+    }
+
+    for (int y = 0; y < CHUNK_HEIGHT; y++) {
+        for (int side = 0; side < 2; side++) {
+            size_t count = bitmask_merge_rows(rows[side][y], rows_same_x[side][y], rows_same_z[side][y], quads);
+            for (size_t k = 0; k < count; k++)
+                bitmask_emit(blocks, tess + y / CHUNK_SECTION_HEIGHT, side ? CUBE_FACE_Y_N : CUBE_FACE_Y_P,
+                             side ? 0.5F : 1.0F, start_x + quads[k].u, y, start_z + quads[k].v, quads[k].len_u, 1,
+                             quads[k].len_v);
+        }
+    }
+
+    (*max_height)++;
+}
+
 //+X = 0.75
 //-X = 0.75
 //+Y = 1.0
@@ -559,18 +1484,23 @@ static float vertexAO(int side1, int side2, int corner) {
     return 0.75F - (!side1 + !side2 + !corner) * 0.25F + 0.25F;
 }
 
-void chunk_generate_naive(struct libvxl_chunk_copy * blocks, Tesselator * tess, int * max_height, int ao) {
+void chunk_generate_naive(ChunkVoxels * blocks, Tesselator * tess_sections, uint8_t sections, int * max_height,
+                          int ao) {
     *max_height = 0;
 
-    for (size_t k = 0; k < blocks->blocks_sorted_count; k++) {
-        struct libvxl_block * blk = blocks->blocks_sorted + k;
+    for (size_t k = 0; k < blocks->blocks_count; k++) {
+        struct libvxl_block * blk = blocks->blocks + k;
 
         int x = key_getx(blk->position);
-        int y = map_size_y - 1 - key_getz(blk->position);
+        int y = CHUNK_HEIGHT - 1 - key_getz(blk->position);
         int z = key_gety(blk->position);
 
         *max_height = max(*max_height, y);
 
+        if (!(sections & (1 << (y / CHUNK_SECTION_HEIGHT))))
+            continue;
+
+        Tesselator * tess = tess_sections + y / CHUNK_SECTION_HEIGHT;
         TrueColor color = readBGR(&blk->color);
 
         if (settings.enable_shadows) {
@@ -693,7 +1623,7 @@ void chunk_generate_naive(struct libvxl_chunk_copy * blocks, Tesselator * tess,
             }
         }
 
-        if (y == map_size_y - 1 || solid_array_isair(blocks, x, y + 1, z)) {
+        if (y == CHUNK_HEIGHT - 1 || solid_array_isair(blocks, x, y + 1, z)) {
             if (ao) {
                 float A
                     = vertexAO(solid_array_isair(blocks, x - 1, y + 1, z), solid_array_isair(blocks, x, y + 1, z - 1),
@@ -755,103 +1685,393 @@ void chunk_generate_naive(struct libvxl_chunk_copy * blocks, Tesselator * tess,
     (*max_height)++;
 }
 
-void chunk_update_all() {
-    size_t drain = channel_size(&chunk_result_queue);
+// color of the topmost block in a cell
+static TrueColor lod_color(ChunkVoxels * blocks, int x, int y, int z, int scale) {
+    for (int by = y + scale - 1; by >= y; by--) {
+        for (int bz = z; bz < z + scale; bz++) {
+            for (int bx = x; bx < x + scale; bx++) {
+                int wx = blocks->x + bx, wz = blocks->z + bz;
 
-    if (drain > 0) {
-        ChunkResultPacket results[drain];
+                if (!solid_array_isair(blocks, wx, by, wz)) {
+                    uint32_t value = solid_array_color(blocks, wx, by, wz);
+                    TrueColor color = readBGR(&value);
+
+                    if (settings.enable_shadows) {
+                        float shade = solid_sunblock(blocks, wx, by, wz);
+                        color.r *= shade;
+                        color.g *= shade;
+                        color.b *= shade;
+                    }
 
-        for (size_t k = 0; k < drain; k++) {
-            channel_await(&chunk_result_queue, results + k);
-            results[k].chunk->updated = false;
+                    return color;
+                }
+            }
         }
+    }
+
+    return (TrueColor) {0, 0, 0, 255};
+}
+
+// A coarse cell is solid if any of its blocks is and takes the color of its topmost block. A neighbour may be
+// drawn at a finer level, so a face on the side of the chunk is only left out if all blocks next to it are
+// solid. This adds hidden faces between coarse chunks, but never leaves holes.
+void chunk_generate_lod(ChunkVoxels * blocks, Tesselator * tess, int scale) {
+    int size = CHUNK_SIZE / scale;
+    int height = CHUNK_HEIGHT / scale;
+
+    // Solid cells as rows of bits along x and along z. Index and bit 0 are the border, which is taken from the
+    // halo and the column padding.
+    uint16_t rows_x[height + 2][size + 2];
+    uint16_t rows_z[height + 2][size + 2];
+    TrueColor color[height][size][size];
+    bool colored[height][size][size];
+
+    memset(rows_x, 0, sizeof(rows_x));
+    memset(rows_z, 0, sizeof(rows_z));
+    memset(colored, 0, sizeof(colored));
+
+    for (int k = 0; k < size + 2; k++)
+        rows_x[0][k] = rows_z[0][k] = 0xFFFF;
+
+    // border cells start out solid and are cleared by any block next to them that is air
+    uint16_t inner = ((1 << size) - 1) << 1;
+    uint16_t outer = 1 | (1 << (size + 1));
+
+    for (int y = 1; y <= height; y++) {
+        rows_x[y][0] = rows_x[y][size + 1] = rows_z[y][0] = rows_z[y][size + 1] = inner;
+
+        for (int k = 1; k <= size; k++)
+            rows_x[y][k] = rows_z[y][k] = outer;
+    }
+
+    uint64_t cell_mask = (1 << scale) - 1;
+
+    for (int bz = -CHUNK_HALO; bz < CHUNK_SIZE + CHUNK_HALO; bz++) {
+        for (int bx = -CHUNK_HALO; bx < CHUNK_SIZE + CHUNK_HALO; bx++) {
+            int x = bx < 0 ? -1 : (bx >= CHUNK_SIZE ? size : bx / scale);
+            int z = bz < 0 ? -1 : (bz >= CHUNK_SIZE ? size : bz / scale);
+            bool border = x < 0 || x >= size || z < 0 || z >= size;
 
-        ChunkResultPacket * result = results + drain - 1;
+            if ((x < 0 || x >= size) && (z < 0 || z >= size))
+                continue;
 
-        for (size_t k = 0; k < drain; k++, result--) {
-            if (!result->chunk->updated) {
-                result->chunk->updated = true;
+            uint8_t * column = blocks->solid
+                + CHUNK_VOXELS_Y * ((bx + CHUNK_HALO) + CHUNK_VOXELS_X * (bz + CHUNK_HALO + CHUNK_HALO_SUNBLOCK));
 
-                if (!result->chunk->created) {
-                    glx_displaylist_create(&result->chunk->display_list, true, false);
-                    result->chunk->created = true;
+            uint64_t bits = bitmask_nonzero(column + 1);
+
+            for (int y = 0; y < height && (bits || border); y++, bits >>= scale) {
+                if (border && (bits & cell_mask) != cell_mask) {
+                    rows_x[y + 1][z + 1] &= ~(1 << (x + 1));
+                    rows_z[y + 1][x + 1] &= ~(1 << (z + 1));
+                } else if (!border && (bits & cell_mask)) {
+                    rows_x[y + 1][z + 1] |= 1 << (x + 1);
+                    rows_z[y + 1][x + 1] |= 1 << (z + 1);
                 }
+            }
+        }
+    }
 
-                result->chunk->max_height = result->max_height;
+    // faces of cells next to each other in a row are joined if they have the same color
+    static const struct {
+        TesselatorCubeFace face;
+        int x, y, z;
+        float shade;
+    } faces[] = {
+        {CUBE_FACE_Z_N, 0, 0, -1, 0.875F}, {CUBE_FACE_Z_P, 0, 0, 1, 0.625F}, {CUBE_FACE_X_N, -1, 0, 0, 0.75F},
+        {CUBE_FACE_X_P, 1, 0, 0, 0.75F},   {CUBE_FACE_Y_P, 0, 1, 0, 1.0F},   {CUBE_FACE_Y_N, 0, -1, 0, 0.5F},
+    };
+
+    for (size_t f = 0; f < sizeof(faces) / sizeof(*faces); f++) {
+        // rows run along x for faces pointing along z, along z otherwise
+        bool along_x = faces[f].z != 0;
+
+        for (int y = 0; y < height; y++) {
+            for (int a = 0; a < size; a++) {
+                uint16_t visible = along_x
+                    ? rows_x[y + 1][a + 1] & ~rows_x[y + 1 + faces[f].y][a + 1 + faces[f].z]
+                    : rows_z[y + 1][a + 1] & ~rows_z[y + 1 + faces[f].y][a + 1 + faces[f].x];
+                visible = (visible >> 1) & ((1 << size) - 1);
+
+                int run = 0;
+                TrueColor run_color;
+
+                for (int b = 0; visible || run > 0; b++, visible >>= 1) {
+                    int x = along_x ? b : a;
+                    int z = along_x ? a : b;
+
+                    // most cells are buried, so colors are only looked up once a face is found
+                    if ((visible & 1) && !colored[y][z][x]) {
+                        color[y][z][x] = lod_color(blocks, x * scale, y * scale, z * scale, scale);
+                        colored[y][z][x] = true;
+                    }
 
-                tesselator_glx(&result->tesselator, &result->chunk->display_list);
+                    if (run > 0
+                        && (!(visible & 1) || color[y][z][x].r != run_color.r || color[y][z][x].g != run_color.g
+                            || color[y][z][x].b != run_color.b)) {
+                        int wx = blocks->x + (along_x ? b - run : a) * scale;
+                        int wz = blocks->z + (along_x ? a : b - run) * scale;
+                        float shade = faces[f].shade;
+
+                        tesselator_set_color(tess, (TrueColor) {run_color.r * shade, run_color.g * shade,
+                                                                run_color.b * shade, 255});
+                        tesselator_addi_cube_face_adv(tess, faces[f].face, wx, y * scale, wz,
+                                                      along_x ? run * scale : scale, scale,
+                                                      along_x ? scale : run * scale);
+                        run = 0;
+                    }
 
-                texture_subimage(
-                    texture_minimap, result->chunk->x * CHUNK_SIZE, result->chunk->y * CHUNK_SIZE,
-                    CHUNK_SIZE, CHUNK_SIZE, result->minimap_data
-                );
+                    if (visible & 1) {
+                        if (run == 0)
+                            run_color = color[y][z][x];
+                        run++;
+                    }
+                }
             }
+        }
+    }
+}
+
+// Occluders are boxes from the bottom of the map up to the lowest height all columns of a cell are solid
+// without a gap, so that they are always inside the terrain.
+void chunk_generate_occluders(ChunkVoxels * blocks, uint8_t * heights) {
+    memset(heights, CHUNK_HEIGHT, CHUNK_OCCLUDERS * CHUNK_OCCLUDERS);
+
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint8_t * column = blocks->solid
+                + CHUNK_VOXELS_Y * ((x + CHUNK_HALO) + CHUNK_VOXELS_X * (z + CHUNK_HALO + CHUNK_HALO_SUNBLOCK));
+            uint64_t air = ~bitmask_nonzero(column + 1);
+            uint8_t * cell = heights + x / CHUNK_OCCLUDER_SIZE + (z / CHUNK_OCCLUDER_SIZE) * CHUNK_OCCLUDERS;
 
-            tesselator_free(&result->tesselator);
-            free(result->minimap_data);
+            *cell = min(*cell, air ? __builtin_ctzll(air) : CHUNK_HEIGHT);
         }
     }
 }
 
-void chunk_rebuild_all() {
-    channel_clear(&chunk_work_queue);
-
-    for (int k = CHUNKS_PER_DIM / 2; k >= 0; k--) {
-        for (int i = k; i < CHUNKS_PER_DIM - k; i++) {
-            Chunk * build[] = {
-                chunks + i + k * CHUNKS_PER_DIM,
-                chunks + i + (CHUNKS_PER_DIM - k - 1) * CHUNKS_PER_DIM,
-                chunks + k + i * CHUNKS_PER_DIM,
-                chunks + (CHUNKS_PER_DIM - k - 1) + i * CHUNKS_PER_DIM,
-            };
+void chunk_update_all() {
+    // the camera moves every frame, so does what should be built first
+    pthread_mutex_lock(&chunk_scheduler.lock);
+    for (size_t k = 0; k < chunk_scheduler.pending_count; k++)
+        chunk_scheduler.pending[k]->priority = chunk_priority(chunk_scheduler.pending[k], true);
+    chunk_jobs_queued = chunk_scheduler.pending_count;
+
+    float now = window_time();
+    if (now - chunk_jobs_wasted_start >= 1.0F) {
+        chunk_jobs_wasted = chunk_scheduler.wasted / (now - chunk_jobs_wasted_start);
+        chunk_jobs_wasted_start = now;
+        chunk_scheduler.wasted = 0;
+    }
+
+    if (settings.chunk_lod && now - chunk_lod_refresh_start >= CHUNK_LOD_REFRESH) {
+        chunk_lod_refresh_start = now;
+
+        for (size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++)
+            if (chunks[k].lod_stale)
+                chunk_queue(chunks + k, 0, false, true);
+    }
+    pthread_mutex_unlock(&chunk_scheduler.lock);
 
-            for (size_t j = 0; j < sizeof(build) / sizeof(*build); j++) {
-                channel_put(&chunk_work_queue,
-                            &(ChunkWorkPacket) {
-                                .chunk   = build[j],
-                                .chunk_x = build[j]->x,
-                                .chunk_y = build[j]->y,
-                            });
+    float start = window_time();
+    size_t vertex_size
+        = chunk_vertex_type == VERTEX_PACKED ? sizeof(TesselatorPackedVertex) : sizeof(int16_t) * 3 + 4;
+    size_t uploaded = 0;
+    bool rebuilt = false;
+
+    size_t queued = channel_size(&chunk_result_queue);
+
+    // results left over are uploaded in the next frames, at least one is always taken
+    while (queued > 0
+           && (uploaded == 0
+               || (uploaded < CHUNK_UPLOAD_BUDGET && window_time() - start < CHUNK_UPLOAD_BUDGET_TIME))) {
+        ChunkResultPacket result;
+        channel_await(&chunk_result_queue, &result);
+        queued--;
+
+        Chunk * chunk = result.chunk;
+
+        // sections requested again since the job started will be replaced by a newer result anyway,
+        // everything of the whole chunk is outdated once any section is
+        uint8_t fresh = 0;
+        bool current = true;
+
+        pthread_mutex_lock(&chunk_scheduler.lock);
+        for (int s = 0; s < CHUNK_SECTIONS; s++) {
+            if (chunk->section_generation[s] > result.generation)
+                current = false;
+            else if (result.sections & (1 << s))
+                fresh |= 1 << s;
+        }
+
+        bool lod_fresh = current && result.with_lod;
+
+        if (!fresh && !lod_fresh) {
+            // built from a map that has changed since, e.g. by a map load
+            chunk_scheduler.wasted++;
+
+            if (chunk->pending)
+                chunk_queue(chunk, 0, result.rebuild, result.with_lod);
+        } else if (result.rebuild && chunk_rebuild_pending > 0 && --chunk_rebuild_pending == 0) {
+            rebuilt = true;
+        }
+        pthread_mutex_unlock(&chunk_scheduler.lock);
+
+        size_t bytes = 0;
+
+        if (fresh || lod_fresh) {
+            if (!chunk->created) {
+                for (int s = 0; s < CHUNK_SECTIONS; s++)
+                    glx_displaylist_create_arena(chunk->display_list + s, &chunk_arena);
+                for (int l = 0; l < CHUNK_LODS; l++)
+                    glx_displaylist_create_arena(chunk->lod + l, &chunk_arena);
+                chunk->created = true;
+            }
+
+            if (fresh)
+                chunk->max_height = result.max_height;
+
+            for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                if (fresh & (1 << s)) {
+                    tesselator_glx(result.tesselator + s, chunk->display_list + s);
+                    bytes += result.tesselator[s].quad_count * 4 * vertex_size;
+                }
+            }
+
+            for (int l = 0; l < CHUNK_LODS && lod_fresh; l++) {
+                tesselator_glx(result.lod + l, chunk->lod + l);
+                bytes += result.lod[l].quad_count * 4 * vertex_size;
+            }
+
+            if (current)
+                memcpy(chunk->occluder, result.occluder, sizeof(chunk->occluder));
+
+            for (int j = 0; j < CHUNK_SIZE; j++)
+                memcpy(chunk_minimap + chunk->x * CHUNK_SIZE + (chunk->y * CHUNK_SIZE + j) * CHUNK_MINIMAP_SIZE,
+                       result.minimap_data + j * CHUNK_SIZE, CHUNK_SIZE * sizeof(uint32_t));
+
+            chunk_minimap_top = min(chunk_minimap_top, chunk->y * CHUNK_SIZE);
+            chunk_minimap_bottom = max(chunk_minimap_bottom, (chunk->y + 1) * CHUNK_SIZE);
+
+            // refreshed coarse meshes alone are not caused by a single edit
+            if (!result.rebuild && fresh) {
+                chunk_update_time += (result.time - chunk_update_time) / 16.0F;
+                chunk_update_bytes += (bytes - chunk_update_bytes) / 16.0F;
             }
         }
+
+        for (int s = 0; s < CHUNK_SECTIONS; s++)
+            if (result.sections & (1 << s))
+                tesselator_pool_release(result.pool, result.tesselator + s);
+
+        for (int l = 0; l < CHUNK_LODS && result.with_lod; l++)
+            tesselator_pool_release(result.pool, result.lod + l);
+
+        uploaded += bytes;
+    }
+
+    // all minimap tiles changed this frame in one upload, whole rows so that the buffer stays tightly packed
+    if (chunk_minimap_top < chunk_minimap_bottom) {
+        texture_subimage(texture_minimap, 0, chunk_minimap_top, CHUNK_MINIMAP_SIZE,
+                         chunk_minimap_bottom - chunk_minimap_top, chunk_minimap + chunk_minimap_top * CHUNK_MINIMAP_SIZE);
+        uploaded += (chunk_minimap_bottom - chunk_minimap_top) * CHUNK_MINIMAP_SIZE * sizeof(uint32_t);
+        chunk_minimap_top = CHUNK_MINIMAP_SIZE;
+        chunk_minimap_bottom = 0;
+    }
+
+    chunk_upload_queued = queued;
+    chunk_upload_bytes = uploaded;
+
+    if (rebuilt) {
+        float elapsed = window_time() - chunk_rebuild_start;
+
+        size_t vertices = 0;
+        for (size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++)
+            if (chunks[k].created)
+                for (int s = 0; s < CHUNK_SECTIONS; s++)
+                    vertices += chunks[k].display_list[s].size;
+
+        log_info("Rebuilt all chunks in %.0f ms (%.0f chunks/s, %s meshing, %.1f MiB of meshes)",
+                 elapsed * 1000.0F, CHUNKS_PER_DIM * CHUNKS_PER_DIM / max(elapsed, 0.001F),
+                 settings.greedy_meshing == MESHING_NAIVE ? "naive"
+                     : settings.greedy_meshing == MESHING_GREEDY ? "greedy"
+                                                                 : "bitmask",
+                 vertices * vertex_size / 1048576.0F);
     }
+}
+
+void chunk_rebuild_all() {
+    chunk_rebuild_start = window_time();
+    chunk_rebuild_pending = CHUNKS_PER_DIM * CHUNKS_PER_DIM;
 
-    uint32_t * buff = malloc(map_size_x * map_size_z * sizeof(uint32_t));
+    // jobs still running for the previous map are superseded by these requests
+    pthread_mutex_lock(&chunk_scheduler.lock);
+    for (size_t k = 0; k < CHUNKS_PER_DIM * CHUNKS_PER_DIM; k++)
+        chunk_request(chunks + k, CHUNK_SECTIONS_ALL, true);
+    pthread_cond_broadcast(&chunk_scheduler.signal);
+    pthread_mutex_unlock(&chunk_scheduler.lock);
 
     // Clean up “texture_minimap” as it can hold previous map or GPU garbage.
-    for (size_t x = 0; x < map_size_x; x++) {
-        for (size_t z = 0; z < map_size_z; z++) {
-            uint32_t * out = buff + x + z * map_size_z;
+    for (size_t x = 0; x < CHUNK_MINIMAP_SIZE; x++) {
+        for (size_t z = 0; z < CHUNK_MINIMAP_SIZE; z++) {
+            uint32_t * out = chunk_minimap + x + z * CHUNK_MINIMAP_SIZE;
             writeRGBA(out, ISGRID(x, z) ? White : Sky);
         }
     }
 
-    texture_subimage(texture_minimap, 0, 0, map_size_x, map_size_z, buff);
-    free(buff);
+    chunk_minimap_top = 0;
+    chunk_minimap_bottom = CHUNK_MINIMAP_SIZE;
 }
 
-void chunk_block_update(int x, int y, int z) {
+// must be called with chunk_block_queue_lock held
+static void chunk_block_queue_add(int x, int y, int z) {
     Chunk * c = chunks + (x / CHUNK_SIZE) + (z / CHUNK_SIZE) * CHUNKS_PER_DIM;
 
+    // faces and ambient occlusion of the blocks above and below change too, shadows reach further down
+    int bottom = max(y - (settings.enable_shadows ? CHUNK_HALO_SUNBLOCK + 1 : 1), 0);
+    int top = min(y + 1, CHUNK_HEIGHT - 1);
+
+    uint8_t sections = 0;
+    for (int s = bottom / CHUNK_SECTION_HEIGHT; s <= top / CHUNK_SECTION_HEIGHT; s++)
+        sections |= 1 << s;
+
+    ChunkWorkPacket * queued = ht_lookup(&chunk_block_queue, &c);
+
+    if (queued) {
+        queued->sections |= sections;
+    } else {
+        ht_insert(&chunk_block_queue, &c,
+                  &(ChunkWorkPacket) {
+                      .chunk    = c,
+                      .chunk_x  = c->x,
+                      .chunk_y  = c->y,
+                      .sections = sections,
+                  });
+    }
+}
+
+void chunk_block_update(int x, int y, int z) {
+    chunk_block_update_many(&(Vector3i) {x, y, z}, 1);
+}
+
+void chunk_block_update_many(Vector3i * blocks, size_t count) {
     pthread_mutex_lock(&chunk_block_queue_lock);
-    ht_insert(&chunk_block_queue, &c,
-              &(ChunkWorkPacket) {
-                  .chunk   = c,
-                  .chunk_x = c->x,
-                  .chunk_y = c->y,
-              });
+    for (size_t k = 0; k < count; k++)
+        chunk_block_queue_add(blocks[k].x, blocks[k].y, blocks[k].z);
     pthread_mutex_unlock(&chunk_block_queue_lock);
 }
 
 static bool iterate_chunk_updates(void * key, void * value, void * user) {
-    channel_put(&chunk_work_queue, value);
+    ChunkWorkPacket * work = value;
+    chunk_request(work->chunk, work->sections, false);
 
     return true;
 }
 
 void chunk_queue_blocks() {
     pthread_mutex_lock(&chunk_block_queue_lock);
+    pthread_mutex_lock(&chunk_scheduler.lock);
     ht_iterate(&chunk_block_queue, NULL, iterate_chunk_updates);
+    pthread_mutex_unlock(&chunk_scheduler.lock);
     ht_clear(&chunk_block_queue);
     pthread_mutex_unlock(&chunk_block_queue_lock);
 }
@@ -72,6 +72,8 @@ Options settings = {
     .toggle_sprint     = 0,
     .enable_shadows    = 1,
     .enable_particles  = 1,
+    .map_cache_size    = 256,
+    .chunk_lod         = 1,
 };
 
 Options settings_tmp = {0};
@@ -145,6 +147,8 @@ void config_save() {
     config_seti("client", "toggle_sprint",     settings.toggle_sprint);
     config_seti("client", "enable_shadows",    settings.enable_shadows);
     config_seti("client", "enable_particles",  settings.enable_particles);
+    config_seti("client", "map_cache_size",    settings.map_cache_size);
+    config_seti("client", "chunk_lod",         settings.chunk_lod);
 
     for (int k = 0; k < list_size(&config_keys); k++) {
         ConfigKeyPair * e = list_get(&config_keys, k);
@@ -211,7 +215,7 @@ static int config_read_key(void * user, const char * section, const char * name,
         } else if (!strcmp(name, "multisamples")) {
             settings.multisamples = atoi(value);
         } else if (!strcmp(name, "greedy_meshing")) {
-            settings.greedy_meshing = atoi(value);
+            settings.greedy_meshing = clamp(MESHING_NAIVE, MESHING_BITMASK, atoi(value));
         } else if (!strcmp(name, "vsync")) {
             settings.vsync = atoi(value);
         } else if (!strcmp(name, "mouse_sensitivity")) {
@@ -257,6 +261,10 @@ static int config_read_key(void * user, const char * section, const char * name,
             settings.enable_shadows = atoi(value);
         } else if (!strcmp(name, "enable_particles")) {
             settings.enable_particles = atoi(value);
+        } else if (!strcmp(name, "map_cache_size")) {
+            settings.map_cache_size = max(0, atoi(value));
+        } else if (!strcmp(name, "chunk_lod")) {
+            settings.chunk_lod = atoi(value);
         }
     }
 
@@ -346,6 +354,22 @@ static void config_label_msaa(char * buffer, size_t length, int value, size_t in
     }
 }
 
+static void config_label_cache(char * buffer, size_t length, int value, size_t index) {
+    if (value == 0) {
+        snprintf(buffer, length, "disabled");
+    } else {
+        snprintf(buffer, length, "%i MiB", value);
+    }
+}
+
+static void config_label_meshing(char * buffer, size_t length, int value, size_t index) {
+    switch (value) {
+        case MESHING_NAIVE: snprintf(buffer, length, "disabled"); break;
+        case MESHING_GREEDY: snprintf(buffer, length, "greedy"); break;
+        default: snprintf(buffer, length, "bitmask"); break;
+    }
+}
+
 static const char * config_key_category = NULL;
 #define CATEGORY(x) { config_key_category = (x); }
 
@@ -594,6 +618,19 @@ void config_reload() {
                  .help     = "Show news on server list",
                  .category = "Interface"
              });
+    list_add(&config_settings,
+             &(Setting) {
+                 .value           = &settings_tmp.map_cache_size,
+                 .type            = CONFIG_TYPE_INT,
+                 .min             = 0,
+                 .max             = INT_MAX,
+                 .name            = "Map cache",
+                 .help            = "Disk space for downloaded maps",
+                 .category        = "Interface",
+                 .defaults        = {0, 64, 256, 1024, 4096},
+                 .defaults_length = 5,
+                 .label_callback  = config_label_cache
+             });
     list_add(&config_settings,
              &(Setting) {
                  .value    = &settings_tmp.camera_fov,
@@ -677,13 +714,16 @@ void config_reload() {
              });
     list_add(&config_settings,
              &(Setting) {
-                 .value    = &settings_tmp.greedy_meshing,
-                 .type     = CONFIG_TYPE_INT,
-                 .min      = 0,
-                 .max      = 1,
-                 .help     = "Join similar mesh faces",
-                 .name     = "Greedy meshing",
-                 .category = "Graphics"
+                 .value           = &settings_tmp.greedy_meshing,
+                 .type            = CONFIG_TYPE_INT,
+                 .min             = MESHING_NAIVE,
+                 .max             = MESHING_BITMASK,
+                 .help            = "Join similar mesh faces",
+                 .name            = "Greedy meshing",
+                 .category        = "Graphics",
+                 .defaults        = {MESHING_NAIVE, MESHING_GREEDY, MESHING_BITMASK},
+                 .defaults_length = 3,
+                 .label_callback  = config_label_meshing
              });
     list_add(&config_settings,
              &(Setting) {
@@ -715,6 +755,16 @@ void config_reload() {
                  .name     = "Ambient occlusion",
                  .category = "Graphics"
              });
+    list_add(&config_settings,
+             &(Setting) {
+                 .value    = &settings_tmp.chunk_lod,
+                 .type     = CONFIG_TYPE_INT,
+                 .min      = 0,
+                 .max      = 1,
+                 .help     = "Less detail far away",
+                 .name     = "Distant LOD",
+                 .category = "Graphics"
+             });
     list_add(&config_settings,
              &(Setting) {
                  .value    = &settings_tmp.enable_particles,
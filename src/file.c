@@ -24,6 +24,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <utime.h>
+
+#if defined(OS_WINDOWS)
+    #include <windows.h>
+#elif !defined(USE_ANDROID_FILE)
+    #include <sys/mman.h>
+#endif
 
 #include <BetterSpades/common.h>
 #include <BetterSpades/file.h>
@@ -185,6 +192,130 @@ uint8_t * file_load(const char * name) {
 #endif
 }
 
+void * file_map(const char * name, size_t * size) {
+#if defined(OS_WINDOWS)
+    HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+
+    void * data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (data)
+        *size = length.QuadPart;
+    return data;
+#elif defined(USE_ANDROID_FILE)
+    if (!file_exists(name))
+        return NULL;
+
+    *size = file_size(name);
+    return file_load(name);
+#else
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return data;
+#endif
+}
+
+void file_unmap(void * data, size_t size) {
+#if defined(OS_WINDOWS)
+    UnmapViewOfFile(data);
+#elif defined(USE_ANDROID_FILE)
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+void file_touch(const char * name) {
+    utime(name, NULL);
+}
+
+typedef struct {
+    char name[512];
+    time_t modified;
+    size_t size;
+} FileEntry;
+
+static int file_entry_cmp(const void * a, const void * b) {
+    time_t A = ((FileEntry *) a)->modified, B = ((FileEntry *) b)->modified;
+    return (A > B) - (A < B);
+}
+
+void file_dir_trim(const char * path, const char * extension, size_t max_size) {
+    DIR * d = opendir(path);
+    if (!d)
+        return;
+
+    size_t count = 0, length = 16, total = 0;
+    FileEntry * entries = malloc(length * sizeof(FileEntry));
+    CHECK_ALLOCATION_ERROR(entries)
+
+    struct dirent * entry;
+    while ((entry = readdir(d))) {
+        size_t name_length = strlen(entry->d_name);
+
+        if (name_length < strlen(extension) || strcmp(entry->d_name + name_length - strlen(extension), extension))
+            continue;
+
+        if (count == length) {
+            length *= 2;
+            entries = realloc(entries, length * sizeof(FileEntry));
+            CHECK_ALLOCATION_ERROR(entries)
+        }
+
+        struct stat st;
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s/%s", path, entry->d_name);
+
+        if (!stat(entries[count].name, &st)) {
+            entries[count].modified = st.st_mtime;
+            entries[count].size = st.st_size;
+            total += st.st_size;
+            count++;
+        }
+    }
+
+    closedir(d);
+
+    // least recently used files go first
+    qsort(entries, count, sizeof(FileEntry), file_entry_cmp);
+
+    for (size_t k = 0; k < count && total > max_size; k++) {
+        if (!remove(entries[k].name)) {
+            log_info("Removed %s from cache", entries[k].name);
+            total -= entries[k].size;
+        }
+    }
+
+    free(entries);
+}
+
 void * file_open(const char * name, const char * mode) {
 #ifdef USE_ANDROID_FILE
     Handle * handle = malloc(sizeof(Handle));
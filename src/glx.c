@@ -18,8 +18,12 @@
 */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
 
+#include <log.h>
+
 #include <BetterSpades/common.h>
 #include <BetterSpades/camera.h>
 #include <BetterSpades/config.h>
@@ -27,6 +31,7 @@
 #include <BetterSpades/matrix.h>
 #include <BetterSpades/texture.h>
 #include <BetterSpades/glx.h>
+#include <BetterSpades/tesselator.h>
 #include <BetterSpades/opengl.h>
 
 // for future opengl-es abstraction layer
@@ -35,6 +40,23 @@ int glx_version = 0;
 
 int glx_fog = 0;
 
+int glx_draw_calls = 0;
+
+#ifdef OPENGL_ES
+// OpenGL ES 2 only guarantees short indices, so larger meshes are drawn in parts
+typedef GLushort GLXQuadIndex;
+#define GLX_QUAD_INDEX_TYPE GL_UNSIGNED_SHORT
+#define GLX_QUADS_PER_DRAW ((size_t) 65536 / 4)
+#else
+typedef GLuint GLXQuadIndex;
+#define GLX_QUAD_INDEX_TYPE GL_UNSIGNED_INT
+#define GLX_QUADS_PER_DRAW SIZE_MAX
+#endif
+
+// element buffer shared by everything drawing quads as triangles, quad k uses vertices 4k to 4k + 3
+static uint32_t glx_quad_indices = 0;
+static size_t glx_quad_indices_count = 0;
+
 static int glx_major_ver() {
 #ifdef OPENGL_ES
     return 2;
@@ -69,7 +91,7 @@ int glx_shader(const char * vertex, const char * fragment) {
     int program = glCreateProgram();
     if (vertex)
         glAttachShader(program, v);
-    if (vertex)
+    if (fragment)
         glAttachShader(program, f);
     glLinkProgram(program);
     return program;
@@ -78,9 +100,82 @@ int glx_shader(const char * vertex, const char * fragment) {
 #endif
 }
 
+// Binds the shared quad index buffer, after growing it to hold at least the given number of quads.
+static void glx_quad_indices_bind(size_t quads) {
+    if (!glx_quad_indices)
+        glGenBuffers(1, &glx_quad_indices);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glx_quad_indices);
+
+    if (quads > glx_quad_indices_count) {
+        size_t count = max(glx_quad_indices_count, 4096);
+        while (count < quads)
+            count *= 2;
+        count = min(count, GLX_QUADS_PER_DRAW);
+
+        GLXQuadIndex * indices = malloc(count * 6 * sizeof(GLXQuadIndex));
+        CHECK_ALLOCATION_ERROR(indices)
+
+        // same split as GL_QUADS, into triangles 0 1 2 and 0 2 3
+        for (size_t k = 0; k < count; k++) {
+            indices[k * 6 + 0] = k * 4 + 0;
+            indices[k * 6 + 1] = k * 4 + 1;
+            indices[k * 6 + 2] = k * 4 + 2;
+            indices[k * 6 + 3] = k * 4 + 0;
+            indices[k * 6 + 4] = k * 4 + 2;
+            indices[k * 6 + 5] = k * 4 + 3;
+        }
+
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * 6 * sizeof(GLXQuadIndex), indices, GL_STATIC_DRAW);
+        free(indices);
+
+        glx_quad_indices_count = count;
+    }
+}
+
+void glx_draw_quads(size_t vertices, int type, const void * vertex, const void * color, const void * normal) {
+    size_t len_vertex = ((type == GLX_DISPLAYLIST_NORMAL) ? sizeof(GLshort) : sizeof(GLfloat)) * 3;
+    size_t quads = vertices / 4;
+
+#ifndef OPENGL_ES
+    // without buffer objects there is no index buffer either
+    if (!glx_version) {
+        glVertexPointer(3, (type == GLX_DISPLAYLIST_NORMAL) ? GL_SHORT : GL_FLOAT, 0, vertex);
+        if (color)
+            glColorPointer(4, GL_UNSIGNED_BYTE, 0, color);
+        if (normal)
+            glNormalPointer(GL_BYTE, 0, normal);
+
+        glDrawArrays(GL_QUADS, 0, vertices);
+        return;
+    }
+#endif
+
+    if (!quads)
+        return;
+
+    glx_quad_indices_bind(min(quads, GLX_QUADS_PER_DRAW));
+
+    for (size_t first = 0; first < quads; first += GLX_QUADS_PER_DRAW) {
+        size_t count = min(quads - first, GLX_QUADS_PER_DRAW);
+
+        glVertexPointer(3, (type == GLX_DISPLAYLIST_NORMAL) ? GL_SHORT : GL_FLOAT, 0,
+                        (const uint8_t *) vertex + first * 4 * len_vertex);
+        if (color)
+            glColorPointer(4, GL_UNSIGNED_BYTE, 0, (const uint8_t *) color + first * 4 * sizeof(GLubyte) * 4);
+        if (normal)
+            glNormalPointer(GL_BYTE, 0, (const uint8_t *) normal + first * 4 * sizeof(GLbyte) * 3);
+
+        glDrawElements(GL_TRIANGLES, count * 6, GLX_QUAD_INDEX_TYPE, NULL);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 void glx_displaylist_create(GLXDisplayList * x, bool has_color, bool has_normal) {
     x->has_color = has_color;
     x->has_normal = has_normal;
+    x->arena = NULL;
 
 #ifndef OPENGL_ES
     if (!glx_version || settings.force_displaylist) {
@@ -94,7 +189,26 @@ void glx_displaylist_create(GLXDisplayList * x, bool has_color, bool has_normal)
     x->buffer_size = 0;
 }
 
+static void glx_arena_release(GLXArena * a, size_t start, size_t size);
+
 void glx_displaylist_destroy(GLXDisplayList * x) {
+    if (x->arena) {
+        GLXArena * a = x->arena;
+
+        if (x->buffer_size > 0)
+            glx_arena_release(a, x->arena_start, x->buffer_size);
+
+        for (size_t k = 0; k < a->lists_count; k++) {
+            if (a->lists[k] == x) {
+                a->lists[k] = a->lists[--a->lists_count];
+                break;
+            }
+        }
+
+        x->arena = NULL;
+        return;
+    }
+
 #ifndef OPENGL_ES
     if (!glx_version || settings.force_displaylist) {
         glDeleteLists(x->legacy, 1);
@@ -106,7 +220,14 @@ void glx_displaylist_destroy(GLXDisplayList * x) {
 #endif
 }
 
+static void glx_arena_update(GLXDisplayList * x, size_t size, void * color, void * vertex);
+
 void glx_displaylist_update(GLXDisplayList * x, size_t size, int type, void* color, void* vertex, void* normal) {
+    if (x->arena) {
+        glx_arena_update(x, size, color, vertex);
+        return;
+    }
+
     int grow_buffer = size > x->buffer_size;
     x->buffer_size = max(x->buffer_size, size);
     x->size = size;
@@ -132,6 +253,8 @@ void glx_displaylist_update(GLXDisplayList * x, size_t size, int type, void* col
 
             if (x->has_normal)
                 glNormalPointer(GL_BYTE, 0, normal);
+
+            // indices from a buffer object can not be compiled into a display list
             glDrawArrays((type == GLX_DISPLAYLIST_POINTS) ? GL_POINTS : GL_QUADS, 0, x->size);
         }
         glEndList();
@@ -170,6 +293,13 @@ void glx_displaylist_update(GLXDisplayList * x, size_t size, int type, void* col
 }
 
 void glx_displaylist_draw(GLXDisplayList * x, int type) {
+    if (x->arena) {
+        glx_arena_draw(x->arena, &x, 1);
+        return;
+    }
+
+    glx_draw_calls++;
+
 #ifndef OPENGL_ES
     if (!glx_version || settings.force_displaylist) {
         glCallList(x->legacy);
@@ -180,36 +310,30 @@ void glx_displaylist_draw(GLXDisplayList * x, int type) {
 
         size_t len_vertex = ((type == GLX_DISPLAYLIST_NORMAL) ? sizeof(GLshort) : sizeof(GLfloat)) * 3;
         size_t len_color = x->has_color ? (sizeof(GLubyte) * 4) : 0;
-        // size_t len_normal = x->has_normal ? (sizeof(GLbyte) * 3) : 0;
 
-        switch (type) {
-            case GLX_DISPLAYLIST_NORMAL: glVertexPointer(3, GL_SHORT, 0, NULL); break;
-            case GLX_DISPLAYLIST_POINTS:
-            case GLX_DISPLAYLIST_ENHANCED: glVertexPointer(3, GL_FLOAT, 0, NULL); break;
-        }
+        const void * color = x->has_color ? (const void*)(x->size * len_vertex) : NULL;
+        const void * normal = x->has_normal ? (const void*)(x->size * (len_vertex + len_color)) : NULL;
 
-        if (x->has_color) {
+        if (x->has_color)
             glEnableClientState(GL_COLOR_ARRAY);
-            glColorPointer(4, GL_UNSIGNED_BYTE, 0, (const void*)(x->size * len_vertex));
-        }
 
-        if (x->has_normal) {
+        if (x->has_normal)
             glEnableClientState(GL_NORMAL_ARRAY);
-            glNormalPointer(GL_BYTE, 0, (const void*)(x->size * (len_vertex + len_color)));
-        }
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         if (type == GLX_DISPLAYLIST_POINTS) {
+            glVertexPointer(3, GL_FLOAT, 0, NULL);
+            if (color)
+                glColorPointer(4, GL_UNSIGNED_BYTE, 0, color);
+            if (normal)
+                glNormalPointer(GL_BYTE, 0, normal);
+
             glDrawArrays(GL_POINTS, 0, x->size);
         } else {
-#ifdef OPENGL_ES
-            glDrawArrays(GL_TRIANGLES, 0, x->size);
-#else
-        glDrawArrays(GL_QUADS, 0, x->size);
-#endif
+            glx_draw_quads(x->size, type, NULL, color, normal);
         }
 
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
         if (x->has_normal)
             glDisableClientState(GL_NORMAL_ARRAY);
         if (x->has_color)
@@ -220,6 +344,343 @@ void glx_displaylist_draw(GLXDisplayList * x, int type) {
 #endif
 }
 
+void glx_arena_create(GLXArena * a, size_t capacity, int program) {
+    *a = (GLXArena) {0};
+
+#ifndef OPENGL_ES
+    // compaction reads buffers back, which OpenGL ES can not do
+    a->enabled = glx_version && !settings.force_displaylist;
+#endif
+
+    if (!a->enabled)
+        return;
+
+#ifndef OPENGL_ES
+    a->program = program;
+
+    if (program) {
+        a->attrib_xz = glGetAttribLocation(program, "xz");
+        a->attrib_yrgb = glGetAttribLocation(program, "yrgb");
+        a->vertex_size = sizeof(TesselatorPackedVertex);
+        a->color_size = 0;
+    } else {
+        a->vertex_size = sizeof(GLshort) * 3;
+        a->color_size = sizeof(GLubyte) * 4;
+    }
+
+    glGenBuffers(1, &a->vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, a->vertices);
+    glBufferData(GL_ARRAY_BUFFER, capacity * a->vertex_size, NULL, GL_STATIC_DRAW);
+
+    if (a->color_size) {
+        glGenBuffers(1, &a->colors);
+        glBindBuffer(GL_ARRAY_BUFFER, a->colors);
+        glBufferData(GL_ARRAY_BUFFER, capacity * a->color_size, NULL, GL_STATIC_DRAW);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Updates are written to a ring buffer and copied on the GPU, so that uploading never waits for draws
+    // still reading from the arena. The ring is orphaned whenever it wraps around.
+    if (GLEW_ARB_copy_buffer && GLEW_ARB_map_buffer_range) {
+        a->staging_size = GLX_ARENA_STAGING_SIZE;
+        glGenBuffers(1, &a->staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, a->staging);
+        glBufferData(GL_COPY_READ_BUFFER, a->staging_size, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+#endif
+
+    a->capacity = capacity;
+    a->free_capacity = 64;
+    a->free = malloc(a->free_capacity * sizeof(GLXArenaRange));
+    CHECK_ALLOCATION_ERROR(a->free)
+    a->free[0] = (GLXArenaRange) {.start = 0, .size = capacity};
+    a->free_count = 1;
+}
+
+void glx_displaylist_create_arena(GLXDisplayList * x, GLXArena * a) {
+    if (!a->enabled) {
+        glx_displaylist_create(x, true, false);
+        return;
+    }
+
+    x->has_color = true;
+    x->has_normal = false;
+    x->arena = a;
+    x->size = 0;
+    x->buffer_size = 0;
+
+    if (a->lists_count == a->lists_capacity) {
+        a->lists_capacity = max(a->lists_capacity * 2, 64);
+        a->lists = realloc(a->lists, a->lists_capacity * sizeof(GLXDisplayList *));
+        CHECK_ALLOCATION_ERROR(a->lists)
+    }
+
+    a->lists[a->lists_count++] = x;
+}
+
+// first fit, the free list is sorted by start
+static bool glx_arena_alloc(GLXArena * a, size_t size, size_t * start) {
+    for (size_t k = 0; k < a->free_count; k++) {
+        if (a->free[k].size >= size) {
+            *start = a->free[k].start;
+            a->free[k].start += size;
+            a->free[k].size -= size;
+
+            if (!a->free[k].size)
+                memmove(a->free + k, a->free + k + 1, (--a->free_count - k) * sizeof(GLXArenaRange));
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void glx_arena_release(GLXArena * a, size_t start, size_t size) {
+    size_t k = 0;
+    while (k < a->free_count && a->free[k].start < start)
+        k++;
+
+    bool merge_prev = k > 0 && a->free[k - 1].start + a->free[k - 1].size == start;
+    bool merge_next = k < a->free_count && start + size == a->free[k].start;
+
+    if (merge_prev && merge_next) {
+        a->free[k - 1].size += size + a->free[k].size;
+        memmove(a->free + k, a->free + k + 1, (--a->free_count - k) * sizeof(GLXArenaRange));
+    } else if (merge_prev) {
+        a->free[k - 1].size += size;
+    } else if (merge_next) {
+        a->free[k].start = start;
+        a->free[k].size += size;
+    } else {
+        if (a->free_count == a->free_capacity) {
+            a->free_capacity *= 2;
+            a->free = realloc(a->free, a->free_capacity * sizeof(GLXArenaRange));
+            CHECK_ALLOCATION_ERROR(a->free)
+        }
+
+        memmove(a->free + k + 1, a->free + k, (a->free_count++ - k) * sizeof(GLXArenaRange));
+        a->free[k] = (GLXArenaRange) {.start = start, .size = size};
+    }
+}
+
+static int glx_arena_sort(const void * a, const void * b) {
+    size_t aa = (*(GLXDisplayList **) a)->arena_start;
+    size_t bb = (*(GLXDisplayList **) b)->arena_start;
+    return (aa > bb) - (aa < bb);
+}
+
+// Moves all lists to the start of the buffers, which also grow if less than a quarter of them would be left free.
+// They grow by at least half at once, so that filling a new map only compacts a few times.
+static void glx_arena_compact(GLXArena * a, size_t needed) {
+#ifndef OPENGL_ES
+    // the list being resized has no space yet, its new size is in needed
+    size_t used = 0;
+    for (size_t k = 0; k < a->lists_count; k++)
+        if (a->lists[k]->buffer_size > 0)
+            used += a->lists[k]->size;
+
+    size_t capacity = a->capacity;
+    if ((used + needed) * 4 > capacity * 3)
+        capacity = max((used + needed) * 4 / 3, capacity + capacity / 2);
+
+    uint8_t * vertices = malloc(a->capacity * a->vertex_size);
+    CHECK_ALLOCATION_ERROR(vertices)
+    uint8_t * colors = malloc(max(a->capacity * a->color_size, 1));
+    CHECK_ALLOCATION_ERROR(colors)
+
+    glBindBuffer(GL_ARRAY_BUFFER, a->vertices);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, a->capacity * a->vertex_size, vertices);
+
+    if (a->color_size) {
+        glBindBuffer(GL_ARRAY_BUFFER, a->colors);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, a->capacity * a->color_size, colors);
+    }
+
+    // lists are packed in place in buffer order, a list never moves towards the end this way
+    qsort(a->lists, a->lists_count, sizeof(GLXDisplayList *), glx_arena_sort);
+
+    size_t offset = 0;
+    for (size_t k = 0; k < a->lists_count; k++) {
+        GLXDisplayList * x = a->lists[k];
+
+        if (x->buffer_size > 0) {
+            memmove(vertices + offset * a->vertex_size, vertices + x->arena_start * a->vertex_size,
+                    x->size * a->vertex_size);
+            memmove(colors + offset * a->color_size, colors + x->arena_start * a->color_size,
+                    x->size * a->color_size);
+            x->arena_start = offset;
+            x->buffer_size = x->size;
+            offset += x->size;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, a->vertices);
+    glBufferData(GL_ARRAY_BUFFER, capacity * a->vertex_size, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, offset * a->vertex_size, vertices);
+
+    if (a->color_size) {
+        glBindBuffer(GL_ARRAY_BUFFER, a->colors);
+        glBufferData(GL_ARRAY_BUFFER, capacity * a->color_size, NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, offset * a->color_size, colors);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    free(vertices);
+    free(colors);
+
+    if (capacity > a->capacity)
+        log_info("Vertex arena grew to %zu vertices (%zu KiB)", capacity,
+                 capacity * (a->vertex_size + a->color_size) / 1024);
+
+    a->capacity = capacity;
+    a->free[0] = (GLXArenaRange) {.start = offset, .size = capacity - offset};
+    a->free_count = 1;
+#endif
+}
+
+static void glx_arena_upload(GLXArena * a, uint32_t buffer, size_t offset, size_t size, const void * data) {
+#ifndef OPENGL_ES
+    if (a->staging && size <= a->staging_size) {
+        glBindBuffer(GL_COPY_READ_BUFFER, a->staging);
+
+        if (a->staging_offset + size > a->staging_size) {
+            glBufferData(GL_COPY_READ_BUFFER, a->staging_size, NULL, GL_STREAM_DRAW);
+            a->staging_offset = 0;
+        }
+
+        void * staged = glMapBufferRange(GL_COPY_READ_BUFFER, a->staging_offset, size,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+        if (staged) {
+            memcpy(staged, data, size);
+
+            if (glUnmapBuffer(GL_COPY_READ_BUFFER)) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a->staging_offset, offset, size);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+                a->staging_offset += (size + 63) & ~63;
+                return;
+            }
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+#endif
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void glx_arena_update(GLXDisplayList * x, size_t size, void * color, void * vertex) {
+    GLXArena * a = x->arena;
+    x->size = size;
+
+    if (size > x->buffer_size || size * 4 < x->buffer_size) {
+        if (x->buffer_size > 0)
+            glx_arena_release(a, x->arena_start, x->buffer_size);
+        x->buffer_size = 0;
+
+        if (size > 0) {
+            // some headroom, so that small changes to a mesh do not move it
+            size_t buffer_size = size + size / 4;
+
+            if (!glx_arena_alloc(a, buffer_size, &x->arena_start)) {
+                glx_arena_compact(a, buffer_size);
+                glx_arena_alloc(a, buffer_size, &x->arena_start);
+            }
+
+            x->buffer_size = buffer_size;
+        }
+    }
+
+    if (size > 0) {
+        glx_arena_upload(a, a->vertices, x->arena_start * a->vertex_size, size * a->vertex_size, vertex);
+
+        if (a->color_size)
+            glx_arena_upload(a, a->colors, x->arena_start * a->color_size, size * a->color_size, color);
+    }
+}
+
+void glx_arena_draw(GLXArena * a, GLXDisplayList ** lists, size_t count) {
+    if (count > a->draw_capacity) {
+        a->draw_capacity = count;
+        a->draw_first = realloc(a->draw_first, count * sizeof(int));
+        CHECK_ALLOCATION_ERROR(a->draw_first)
+        a->draw_count = realloc(a->draw_count, count * sizeof(int));
+        CHECK_ALLOCATION_ERROR(a->draw_count)
+        a->draw_indices = realloc(a->draw_indices, count * sizeof(void *));
+        CHECK_ALLOCATION_ERROR(a->draw_indices)
+    }
+
+#ifndef OPENGL_ES
+    // base vertex is part of every core profile, without it this falls back to quads
+    bool indexed = GLEW_ARB_draw_elements_base_vertex;
+
+    size_t draws = 0;
+    size_t quads = 0;
+    for (size_t k = 0; k < count; k++) {
+        if (lists[k]->size > 0) {
+            a->draw_first[draws] = lists[k]->arena_start;
+            a->draw_count[draws] = indexed ? lists[k]->size / 4 * 6 : lists[k]->size;
+            a->draw_indices[draws] = NULL;
+            quads = max(quads, lists[k]->size / 4);
+            draws++;
+        }
+    }
+
+    if (!draws)
+        return;
+
+    if (a->program) {
+        // the caller has the program bound and its uniforms set
+        glEnableVertexAttribArray(a->attrib_xz);
+        glEnableVertexAttribArray(a->attrib_yrgb);
+
+        glBindBuffer(GL_ARRAY_BUFFER, a->vertices);
+        glVertexAttribPointer(a->attrib_xz, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(TesselatorPackedVertex),
+                              (void *) offsetof(TesselatorPackedVertex, x));
+        glVertexAttribPointer(a->attrib_yrgb, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TesselatorPackedVertex),
+                              (void *) offsetof(TesselatorPackedVertex, y));
+    } else {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+
+        glBindBuffer(GL_ARRAY_BUFFER, a->vertices);
+        glVertexPointer(3, GL_SHORT, 0, NULL);
+        glBindBuffer(GL_ARRAY_BUFFER, a->colors);
+        glColorPointer(4, GL_UNSIGNED_BYTE, 0, NULL);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (indexed) {
+        glx_quad_indices_bind(quads);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, a->draw_count, GLX_QUAD_INDEX_TYPE,
+                                      (const void * const *) a->draw_indices, draws, a->draw_first);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    } else {
+        glMultiDrawArrays(GL_QUADS, a->draw_first, a->draw_count, draws);
+    }
+
+    glx_draw_calls++;
+
+    if (a->program) {
+        glDisableVertexAttribArray(a->attrib_yrgb);
+        glDisableVertexAttribArray(a->attrib_xz);
+    } else {
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+#endif
+}
+
 void glx_enable_sphericalfog() {
 #if !(HACKS_ENABLED && HACK_NOFOG)
 #ifndef OPENGL_ES
@@ -22,6 +22,7 @@
 #include <BetterSpades/window.h>
 #include <BetterSpades/particle.h>
 #include <BetterSpades/matrix.h>
+#include <BetterSpades/camera.h>
 #include <BetterSpades/model.h>
 #include <BetterSpades/sound.h>
 #include <BetterSpades/grenade.h>
@@ -128,6 +129,18 @@ static int grenade_inwater(Grenade * g) {
     return g->pos.y < 1.0F;
 }
 
+static CameraBoxes grenade_bounds;
+
+static void grenade_box(void * obj, float * bounds) {
+    Grenade * g = (Grenade *) obj;
+    bounds[0] = g->pos.x - 1.0F;
+    bounds[1] = g->pos.y - 1.0F;
+    bounds[2] = g->pos.z - 1.0F;
+    bounds[3] = g->pos.x + 1.0F;
+    bounds[4] = g->pos.y + 1.0F;
+    bounds[5] = g->pos.z + 1.0F;
+}
+
 bool grenade_render_single(void * obj, void * user) {
     static kv6 * const model_grenade = &model[MODEL_GRENADE];
 
@@ -149,7 +162,8 @@ bool grenade_render_single(void * obj, void * user) {
 }
 
 void grenade_render() {
-    entitysys_iterate(&grenades, NULL, grenade_render_single);
+    camera_boxes_collect(&grenade_bounds, &grenades, grenade_box);
+    camera_boxes_iterate(&grenade_bounds, &grenades, NULL, grenade_render_single);
 }
 
 TrueColor gray = {0x50, 0x50, 0x50, 0xFF};
@@ -898,6 +898,22 @@ static void hud_ingame_render(mu_Context * ctx, float scale) {
                 sprintf(buff, "%i ms, %i fps", network_ping(), (int) fps);
                 font_render(11.0F * scale, top, scale, buff, ASCII); top -= 16.0F * scale;
 
+                sprintf(buff, "%i sections, %ik triangles, %i draw calls, %.1f ms cpu", chunk_draw_count,
+                        chunk_draw_triangles / 1000, glx_draw_calls, frame_time * 1000.0F);
+                font_render(11.0F * scale, top, scale, buff, ASCII); top -= 16.0F * scale;
+
+                sprintf(buff, "chunk update %.2f ms, %.1f KiB, %i queued, %.1f wasted/s",
+                        chunk_update_time * 1000.0F, chunk_update_bytes / 1024.0F, chunk_jobs_queued,
+                        chunk_jobs_wasted);
+                font_render(11.0F * scale, top, scale, buff, ASCII); top -= 16.0F * scale;
+
+                sprintf(buff, "upload %.1f KiB/frame, %i waiting", chunk_upload_bytes / 1024.0F, chunk_upload_queued);
+                font_render(11.0F * scale, top, scale, buff, ASCII); top -= 16.0F * scale;
+
+                sprintf(buff, "%i occluded, %.2f ms, %i/%i checks visible", chunk_occluded,
+                        chunk_occlusion_time * 1000.0F, chunk_occlusion_visible, chunk_occlusion_checked);
+                font_render(11.0F * scale, top, scale, buff, ASCII); top -= 16.0F * scale;
+
                 Vector3f r = camera.mode == CAMERAMODE_FPS ? players[local_player.id].pos
                                                            : camera.pos;
 
@@ -2165,8 +2181,12 @@ static void hud_serverlist_init() {
 static void server_c(char * address, char * name, Version version) {
     if (file_exists(address)) {
         void * data = file_load(address);
-        map_vxl_load(data, file_size(address));
+        bool loaded = map_vxl_load(data, file_size(address));
         free(data);
+
+        if (!loaded)
+            return;
+
         chunk_rebuild_all();
         camera.mode = CAMERAMODE_FPS;
         players[local_player.id].pos.x = map_size_x / 2.0F;
@@ -0,0 +1,427 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdeflate.h>
+#include <log.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/inflate.h>
+
+// codes up to this length are decoded with a single table lookup
+#define INFLATE_FAST_BITS 10
+#define INFLATE_PROGRESS_STEP (64 * 1024)
+
+typedef struct {
+    uint16_t fast[1 << INFLATE_FAST_BITS]; // symbol | length << 9, indexed by the next input bits
+    uint16_t first_code[16];
+    uint32_t max_code[17];
+    uint16_t first_symbol[16];
+    uint8_t size[288];
+    uint16_t value[288];
+} InflateHuffman;
+
+typedef struct {
+    InflateInput input;
+    InflateProgress progress;
+    void * user;
+
+    uint8_t buffer[4096];
+    size_t buffer_pos, buffer_length;
+    size_t overrun; // zero bytes made up after the input ended
+
+    uint64_t bits;
+    int bit_count;
+
+    uint8_t * output;
+    size_t output_length, output_capacity, output_reported;
+} Inflate;
+
+static const uint16_t inflate_length_base[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t inflate_length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t inflate_distance_base[30]
+    = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+       193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t inflate_distance_extra[30]
+    = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t inflate_codelength_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static int inflate_reverse(int value, int bits) {
+    value = ((value & 0xAAAA) >> 1) | ((value & 0x5555) << 1);
+    value = ((value & 0xCCCC) >> 2) | ((value & 0x3333) << 2);
+    value = ((value & 0xF0F0) >> 4) | ((value & 0x0F0F) << 4);
+    value = ((value & 0xFF00) >> 8) | ((value & 0x00FF) << 8);
+    return value >> (16 - bits);
+}
+
+static void inflate_report(Inflate * z) {
+    if (z->progress && z->output_length > z->output_reported) {
+        z->progress(z->user, z->output, z->output_length);
+        z->output_reported = z->output_length;
+    }
+}
+
+static uint8_t inflate_byte(Inflate * z) {
+    if (z->buffer_pos == z->buffer_length) {
+        // hand out what we have before waiting for more input
+        inflate_report(z);
+
+        z->buffer_pos = 0;
+        z->buffer_length = z->overrun ? 0 : z->input(z->user, z->buffer, sizeof(z->buffer));
+
+        if (!z->buffer_length) {
+            z->overrun++;
+            return 0;
+        }
+    }
+
+    return z->buffer[z->buffer_pos++];
+}
+
+static uint32_t inflate_bits(Inflate * z, int count) {
+    while (z->bit_count < count) {
+        z->bits |= (uint64_t) inflate_byte(z) << z->bit_count;
+        z->bit_count += 8;
+    }
+
+    uint32_t value = z->bits & ((1ULL << count) - 1);
+    z->bits >>= count;
+    z->bit_count -= count;
+    return value;
+}
+
+// true once bits were consumed that were made up after the input ended
+static bool inflate_exhausted(Inflate * z) {
+    return z->overrun * 8 > (size_t) z->bit_count;
+}
+
+static void inflate_reserve(Inflate * z, size_t length) {
+    if (z->output_length + length > z->output_capacity) {
+        while (z->output_length + length > z->output_capacity)
+            z->output_capacity *= 2;
+
+        z->output = realloc(z->output, z->output_capacity);
+        CHECK_ALLOCATION_ERROR(z->output)
+    }
+}
+
+static bool inflate_huffman_build(InflateHuffman * h, const uint8_t * lengths, int count) {
+    int sizes[16] = {0};
+    int next_code[16];
+
+    for (int k = 0; k < count; k++)
+        sizes[lengths[k]]++;
+    sizes[0] = 0;
+
+    memset(h->fast, 0, sizeof(h->fast));
+
+    int code = 0, symbols = 0;
+    for (int k = 1; k < 16; k++) {
+        next_code[k] = code;
+        h->first_code[k] = code;
+        h->first_symbol[k] = symbols;
+        code += sizes[k];
+
+        if (sizes[k] && code - 1 >= (1 << k)) // over-subscribed
+            return false;
+
+        h->max_code[k] = code << (16 - k);
+        code <<= 1;
+        symbols += sizes[k];
+    }
+    h->max_code[16] = 0x10000;
+
+    for (int k = 0; k < count; k++) {
+        int size = lengths[k];
+
+        if (size) {
+            int index = next_code[size] - h->first_code[size] + h->first_symbol[size];
+            h->size[index] = size;
+            h->value[index] = k;
+
+            if (size <= INFLATE_FAST_BITS) {
+                for (int j = inflate_reverse(next_code[size], size); j < (1 << INFLATE_FAST_BITS); j += 1 << size)
+                    h->fast[j] = (size << 9) | k;
+            }
+
+            next_code[size]++;
+        }
+    }
+
+    return true;
+}
+
+static int inflate_decode(Inflate * z, InflateHuffman * h) {
+    if (z->bit_count < 16) {
+        while (z->bit_count <= 56) {
+            z->bits |= (uint64_t) inflate_byte(z) << z->bit_count;
+            z->bit_count += 8;
+        }
+    }
+
+    uint16_t entry = h->fast[z->bits & ((1 << INFLATE_FAST_BITS) - 1)];
+
+    if (entry) {
+        z->bits >>= entry >> 9;
+        z->bit_count -= entry >> 9;
+        return entry & 511;
+    }
+
+    int code = inflate_reverse(z->bits & 0xFFFF, 16);
+    int size = INFLATE_FAST_BITS + 1;
+
+    while ((uint32_t) code >= h->max_code[size])
+        size++;
+
+    if (size >= 16)
+        return -1;
+
+    int index = (code >> (16 - size)) - h->first_code[size] + h->first_symbol[size];
+
+    if (index >= 288 || h->size[index] != size)
+        return -1;
+
+    z->bits >>= size;
+    z->bit_count -= size;
+    return h->value[index];
+}
+
+static InflateResult inflate_codes(Inflate * z, InflateHuffman * lengths, InflateHuffman * distances) {
+    while (1) {
+        int symbol = inflate_decode(z, lengths);
+
+        if (inflate_exhausted(z))
+            return INFLATE_SHORT_INPUT;
+
+        if (symbol < 0)
+            return INFLATE_BAD_DATA;
+
+        if (symbol < 256) {
+            inflate_reserve(z, 1);
+            z->output[z->output_length++] = symbol;
+        } else if (symbol == 256) {
+            return INFLATE_SUCCESS;
+        } else {
+            symbol -= 257;
+
+            if (symbol >= 29)
+                return INFLATE_BAD_DATA;
+
+            size_t length = inflate_length_base[symbol] + inflate_bits(z, inflate_length_extra[symbol]);
+            int code = inflate_decode(z, distances);
+
+            if (code < 0 || code >= 30)
+                return INFLATE_BAD_DATA;
+
+            size_t distance = inflate_distance_base[code] + inflate_bits(z, inflate_distance_extra[code]);
+
+            if (inflate_exhausted(z))
+                return INFLATE_SHORT_INPUT;
+
+            if (distance > z->output_length)
+                return INFLATE_BAD_DATA;
+
+            inflate_reserve(z, length);
+
+            uint8_t * dst = z->output + z->output_length;
+            const uint8_t * src = dst - distance;
+
+            if (distance >= length) {
+                memcpy(dst, src, length);
+            } else {
+                for (size_t k = 0; k < length; k++)
+                    dst[k] = src[k];
+            }
+
+            z->output_length += length;
+        }
+
+        if (z->output_length - z->output_reported >= INFLATE_PROGRESS_STEP)
+            inflate_report(z);
+    }
+}
+
+static InflateResult inflate_stored(Inflate * z) {
+    inflate_bits(z, z->bit_count % 8);
+
+    uint32_t length = inflate_bits(z, 16);
+    uint32_t length_inv = inflate_bits(z, 16);
+
+    if (inflate_exhausted(z))
+        return INFLATE_SHORT_INPUT;
+
+    if (length != (~length_inv & 0xFFFF))
+        return INFLATE_BAD_DATA;
+
+    inflate_reserve(z, length);
+
+    for (; length > 0 && z->bit_count > 0; length--)
+        z->output[z->output_length++] = inflate_bits(z, 8);
+
+    for (; length > 0; length--)
+        z->output[z->output_length++] = inflate_byte(z);
+
+    return inflate_exhausted(z) ? INFLATE_SHORT_INPUT : INFLATE_SUCCESS;
+}
+
+static InflateResult inflate_fixed(Inflate * z) {
+    InflateHuffman lengths, distances;
+    uint8_t sizes[288];
+
+    memset(sizes, 8, 144);
+    memset(sizes + 144, 9, 112);
+    memset(sizes + 256, 7, 24);
+    memset(sizes + 280, 8, 8);
+    inflate_huffman_build(&lengths, sizes, 288);
+
+    memset(sizes, 5, 30);
+    inflate_huffman_build(&distances, sizes, 30);
+
+    return inflate_codes(z, &lengths, &distances);
+}
+
+static InflateResult inflate_dynamic(Inflate * z) {
+    InflateHuffman lengths, distances;
+    uint8_t sizes[288 + 32];
+
+    int length_count = inflate_bits(z, 5) + 257;
+    int distance_count = inflate_bits(z, 5) + 1;
+    int codelength_count = inflate_bits(z, 4) + 4;
+
+    memset(sizes, 0, 19);
+    for (int k = 0; k < codelength_count; k++)
+        sizes[inflate_codelength_order[k]] = inflate_bits(z, 3);
+
+    if (inflate_exhausted(z))
+        return INFLATE_SHORT_INPUT;
+
+    if (!inflate_huffman_build(&lengths, sizes, 19))
+        return INFLATE_BAD_DATA;
+
+    int count = 0;
+    while (count < length_count + distance_count) {
+        int symbol = inflate_decode(z, &lengths);
+
+        if (inflate_exhausted(z))
+            return INFLATE_SHORT_INPUT;
+
+        if (symbol < 0 || symbol >= 19)
+            return INFLATE_BAD_DATA;
+
+        if (symbol < 16) {
+            sizes[count++] = symbol;
+        } else {
+            uint8_t fill = 0;
+            int repeat;
+
+            if (symbol == 16) {
+                if (count == 0)
+                    return INFLATE_BAD_DATA;
+                fill = sizes[count - 1];
+                repeat = 3 + inflate_bits(z, 2);
+            } else if (symbol == 17) {
+                repeat = 3 + inflate_bits(z, 3);
+            } else {
+                repeat = 11 + inflate_bits(z, 7);
+            }
+
+            if (count + repeat > length_count + distance_count)
+                return INFLATE_BAD_DATA;
+
+            memset(sizes + count, fill, repeat);
+            count += repeat;
+        }
+    }
+
+    if (sizes[256] == 0)
+        return INFLATE_BAD_DATA;
+
+    if (!inflate_huffman_build(&lengths, sizes, length_count)
+       || !inflate_huffman_build(&distances, sizes + length_count, distance_count))
+        return INFLATE_BAD_DATA;
+
+    return inflate_codes(z, &lengths, &distances);
+}
+
+InflateResult inflate_zlib(InflateInput input, InflateProgress progress, void * user, uint8_t ** output,
+                           size_t * output_length) {
+    Inflate * z = malloc(sizeof(Inflate));
+    CHECK_ALLOCATION_ERROR(z)
+
+    *z = (Inflate) {
+        .input           = input,
+        .progress        = progress,
+        .user            = user,
+        .output_capacity = 1024 * 1024,
+    };
+
+    z->output = malloc(z->output_capacity);
+    CHECK_ALLOCATION_ERROR(z->output)
+
+    InflateResult result = INFLATE_SUCCESS;
+
+    uint32_t cmf = inflate_bits(z, 8);
+    uint32_t flg = inflate_bits(z, 8);
+
+    if (inflate_exhausted(z)) {
+        result = INFLATE_SHORT_INPUT;
+    } else if ((cmf * 256 + flg) % 31 || (cmf & 15) != 8 || (flg & 32)) {
+        result = INFLATE_BAD_DATA;
+    } else {
+        bool final;
+
+        do {
+            final = inflate_bits(z, 1);
+
+            switch (inflate_bits(z, 2)) {
+                case 0: result = inflate_stored(z); break;
+                case 1: result = inflate_fixed(z); break;
+                case 2: result = inflate_dynamic(z); break;
+                default: result = inflate_exhausted(z) ? INFLATE_SHORT_INPUT : INFLATE_BAD_DATA; break;
+            }
+        } while (result == INFLATE_SUCCESS && !final);
+    }
+
+    if (result == INFLATE_SUCCESS) {
+        inflate_bits(z, z->bit_count % 8);
+
+        uint32_t adler = 0;
+        for (int k = 0; k < 4; k++)
+            adler = (adler << 8) | inflate_bits(z, 8);
+
+        if (inflate_exhausted(z)) {
+            result = INFLATE_SHORT_INPUT;
+        } else if (adler != libdeflate_adler32(1, z->output, z->output_length)) {
+            result = INFLATE_BAD_DATA;
+        } else {
+            inflate_report(z);
+        }
+    }
+
+    *output = z->output;
+    *output_length = z->output_length;
+    free(z);
+
+    return result;
+}
@@ -52,6 +52,7 @@
 #include <BetterSpades/gui.h>
 
 int fps = 0;
+float frame_time = 0.0F;
 
 int ms_rand() {
     static int seed = 1;
@@ -205,6 +206,9 @@ void drawScene() {
 }
 
 void display() {
+    float start = window_time();
+    glx_draw_calls = 0;
+
     if (network_map_transfer) {
         glClearColor(0.0F, 0.0F, 0.0F, 1.0F);
     } else {
@@ -506,6 +510,8 @@ void display() {
 
     if (settings.multisamples > 0)
         glEnable(GL_MULTISAMPLE);
+
+    frame_time = window_time() - start;
 }
 
 void init() {
@@ -20,6 +20,7 @@
 #define _XOPEN_SOURCE 600
 
 #include <stdlib.h>
+#include <assert.h>
 #include <math.h>
 #include <string.h>
 #include <stdint.h>
@@ -44,6 +45,10 @@
 #include <BetterSpades/channel.h>
 #include <BetterSpades/entitysystem.h>
 #include <BetterSpades/opengl.h>
+#include <BetterSpades/inflate.h>
+#include <BetterSpades/file.h>
+
+#include <libdeflate.h>
 
 int map_size_x = 512;
 int map_size_y = 64;
@@ -52,6 +57,92 @@ int map_size_z = 512;
 static struct libvxl_map map;
 static pthread_rwlock_t map_lock;
 
+// Solid bits of every column, laid out like the libvxl geometry (bit z of word x + y * width).
+// Voxel tests read this copy with plain atomic loads instead of taking map_lock. Writers hold
+// the write lock and make map_columns_seq odd while they change it, so that readers who need
+// several voxels from the same map state can retry.
+static uint64_t map_columns[512 * 512];
+static unsigned map_columns_seq;
+
+static void map_columns_write_begin() {
+    __atomic_store_n(&map_columns_seq, map_columns_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void map_columns_write_end() {
+    __atomic_store_n(&map_columns_seq, map_columns_seq + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned map_columns_read_begin() {
+    unsigned seq;
+    while ((seq = __atomic_load_n(&map_columns_seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return seq;
+}
+
+static bool map_columns_read_retry(unsigned seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&map_columns_seq, __ATOMIC_RELAXED) != seq;
+}
+
+// Height above which all columns of a tile are air, so that rays can pass over it without looking at
+// every column.
+#define MAP_TILE_SIZE 8
+static uint8_t map_tiles[(512 / MAP_TILE_SIZE) * (512 / MAP_TILE_SIZE)];
+
+static void map_tiles_update(int tx, int tz) {
+    int height = 0;
+
+    for (int z = tz * MAP_TILE_SIZE; z < (tz + 1) * MAP_TILE_SIZE; z++) {
+        for (int x = tx * MAP_TILE_SIZE; x < (tx + 1) * MAP_TILE_SIZE; x++) {
+            uint64_t column = map_columns[x + z * map_size_x];
+            if (column)
+                height = max(height, map_size_y - __builtin_ctzll(column));
+        }
+    }
+
+    __atomic_store_n(map_tiles + tx + tz * (map_size_x / MAP_TILE_SIZE), height, __ATOMIC_RELAXED);
+}
+
+// must be called with map_lock held for writing
+static void map_columns_update(size_t start, size_t count) {
+    for (size_t k = start; k < start + count; k++) {
+        uint64_t column;
+        memcpy(&column, (uint8_t*) map.geometry + k * sizeof(uint64_t), sizeof(uint64_t));
+        __atomic_store_n(map_columns + k, column, __ATOMIC_RELAXED);
+    }
+
+    if (count == 1) {
+        map_tiles_update(start % map_size_x / MAP_TILE_SIZE, start / map_size_x / MAP_TILE_SIZE);
+    } else {
+        for (size_t tz = start / map_size_x / MAP_TILE_SIZE; tz <= (start + count - 1) / map_size_x / MAP_TILE_SIZE;
+             tz++)
+            for (int tx = 0; tx < map_size_x / MAP_TILE_SIZE; tx++)
+                map_tiles_update(tx, tz);
+    }
+}
+
+static inline uint64_t map_column(int x, int z) {
+    size_t offset = (size_t) x % (size_t) map_size_x + ((size_t) z % (size_t) map_size_z) * map_size_x;
+    return __atomic_load_n(map_columns + offset, __ATOMIC_RELAXED);
+}
+
+// Map data of a transfer in progress, it is decompressed and parsed on a worker thread while it arrives.
+// If there is no worker, the data is only collected and decompressed once all of it is there.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t signal;
+    bool active, threaded, input_done, success;
+    uint8_t * input;
+    size_t input_length, input_capacity, input_read;
+    size_t output_length, parsed;
+    struct libvxl_map map;
+    struct libvxl_loader loader;
+} MapStream;
+
+static MapStream map_stream;
+
 float fog_color[4] = {0.5F, 0.9098F, 1.0F, 1.0F};
 
 typedef struct {
@@ -162,12 +253,18 @@ void map_damaged_voxels_render() {
     }
 }
 
+// solid neighbours of the voxels removed by one edit, sorted and without duplicates
 typedef struct {
-    int x, y, z;
+    Vector3i * seeds;
+    size_t count;
 } MapWorkPacket;
 
 Channel map_work_queue, map_result_queue;
 
+#define MAP_PHYSICS_WORKERS_MAX 4
+
+static pthread_mutex_t map_physics_lock;
+
 typedef struct {
     HashTable voxels;
     Vector3f v, p, p2, o;
@@ -178,6 +275,8 @@ typedef struct {
 } MapCollapsing;
 
 EntitySystem map_collapsing_structures;
+// meshes are built on the falling blocks worker and released on the main thread
+static TesselatorPool map_collapsing_pool;
 
 static bool falling_blocks_meshing(void * key, void * value, void * user) {
     uint32_t pos = *(uint32_t *) key;
@@ -228,95 +327,261 @@ static bool falling_blocks_meshing(void * key, void * value, void * user) {
     return true;
 }
 
-static bool falling_blocks_pivot(void * key, void * value, void * user) {
-    float * pivot = (float*) user;
-    uint32_t pos = *(uint32_t *) key;
+// Solid voxels in a column word that are vertically connected to the given bit, in the map_columns layout.
+static uint64_t map_column_run(uint64_t column, int bit) {
+    uint64_t gaps_above = ~column & ((1ULL << bit) - 1);
+    uint64_t gaps_below = ~column & ~((2ULL << bit) - 1);
 
-    map_set(pos_keyx(pos), pos_keyy(pos), pos_keyz(pos), White);
-    pivot[0] += pos_keyx(pos);
-    pivot[1] += pos_keyy(pos);
-    pivot[2] += pos_keyz(pos);
+    uint64_t run = gaps_below ? (1ULL << __builtin_ctzll(gaps_below)) - 1 : ~0ULL;
+    if (gaps_above)
+        run &= ~((2ULL << (63 - __builtin_clzll(gaps_above))) - 1);
 
-    return true;
+    return run;
 }
 
-static const int DIRECTION_MASK[][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+// The two bottom layers can't be destroyed, anything standing on them is grounded.
+#define MAP_COLUMN_GROUND (3ULL << 62)
+
+// Per column state of the searches of one worker, fields are only valid while their generation matches.
+typedef struct {
+    uint64_t visited, grounded;
+    uint32_t visited_generation, grounded_generation;
+} MapPhysicsColumn;
+
+typedef struct {
+    uint32_t column;
+    uint64_t run;
+} MapPhysicsRun;
+
+// Search state owned by one physics worker and reused for all of its searches, so that nothing needs
+// to be allocated or cleared per search.
+typedef struct {
+    MapPhysicsColumn * columns;
+    uint32_t generation;
+    // first generation of the current work packet, grounded runs are shared by all its searches
+    uint32_t packet;
+    // runs waiting to be expanded, one bucket per height of their lowest voxel
+    struct {
+        MapPhysicsRun * runs;
+        size_t count, length;
+    } buckets[64];
+    int lowest;
+    // columns with visited runs in the current search
+    uint32_t * touched;
+    size_t touched_count, touched_length;
+    size_t voxel_count;
+} MapPhysicsSearch;
+
+static void map_physics_next_generation(MapPhysicsSearch * s) {
+    if (++s->generation == 0) { // wrapped around, old stamps could match again
+        memset(s->columns, 0, map_size_x * map_size_z * sizeof(MapPhysicsColumn));
+        s->generation = 1;
+        s->packet = 1;
+    }
+}
+
+// Returns false if the run is connected to the ground, otherwise queues it unless it was seen before.
+static bool map_physics_visit(MapPhysicsSearch * s, uint32_t column, uint64_t run, bool use_grounded) {
+    MapPhysicsColumn * c = s->columns + column;
+
+    if (c->visited_generation != s->generation) {
+        c->visited_generation = s->generation;
+        c->visited = 0;
+
+        if (s->touched_count >= s->touched_length) {
+            s->touched_length = max(s->touched_length * 2, 256);
+            s->touched = realloc(s->touched, s->touched_length * sizeof(uint32_t));
+            CHECK_ALLOCATION_ERROR(s->touched)
+        }
+
+        s->touched[s->touched_count++] = column;
+    }
 
-static bool map_update_physics_sub(MapCollapsing * collapsing, int x, int y, int z) {
-    if (y <= 1)
+    if (c->visited & run)
+        return true;
+
+    if ((run & MAP_COLUMN_GROUND) || (use_grounded && c->grounded_generation >= s->packet && (c->grounded & run)))
         return false;
 
+    c->visited |= run;
+    s->voxel_count += __builtin_popcountll(run);
+
+    int height = __builtin_clzll(run);
+    if (s->buckets[height].count >= s->buckets[height].length) {
+        s->buckets[height].length = max(s->buckets[height].length * 2, 64);
+        s->buckets[height].runs = realloc(s->buckets[height].runs, s->buckets[height].length * sizeof(MapPhysicsRun));
+        CHECK_ALLOCATION_ERROR(s->buckets[height].runs)
+    }
+
+    s->buckets[height].runs[s->buckets[height].count++] = (MapPhysicsRun) {column, run};
+    s->lowest = min(s->lowest, height);
+
+    return true;
+}
+
+// Ground connectivity is decided over vertical runs of solid voxels, whose extent map_columns already
+// keeps up to date on every map_set. A run touching the ground layers answers the common case directly,
+// otherwise runs in neighbouring columns that share at least one height are searched, lowest first.
+// Returns the voxels of the structure when it is detached. With use_grounded, the search stops at runs
+// earlier searches of the same packet found to be grounded and adds its own to them.
+static Vector3i * map_physics_search(MapPhysicsSearch * s, int x, int y, int z, bool use_grounded,
+                                     size_t * voxel_count) {
+    if (y <= 1 || y >= map_size_y)
+        return NULL;
+
     if (map_isair(x, y, z))
-        return false;
+        return NULL;
 
-    Minheap openlist;
-    minheap_create(&openlist);
+    map_physics_next_generation(s);
+    s->touched_count = 0;
+    s->voxel_count = 0;
+    s->lowest = 64;
 
-    HashTable closedlist;
-    ht_setup(&closedlist, sizeof(uint32_t), sizeof(TrueColor), 256);
-    closedlist.compare = int_cmp;
-    closedlist.hash = int_hash;
+    uint32_t start = x + z * map_size_x;
+    bool detached = map_physics_visit(s, start, map_column_run(map_column(x, z), map_size_y - 1 - y), use_grounded);
 
-    MinheapBlock start = (MinheapBlock) {
-        .pos = pos_key(x, y, z),
-    };
+    while (detached) { // find all connected runs
+        while (s->lowest < 64 && !s->buckets[s->lowest].count)
+            s->lowest++;
 
-    TrueColor start_color = map_get(x, y, z);
+        if (s->lowest == 64)
+            break;
 
-    minheap_put(&openlist, &start);
-    ht_insert(&closedlist, &start.pos, &start_color);
+        MapPhysicsRun current = s->buckets[s->lowest].runs[--s->buckets[s->lowest].count];
+        int cx = current.column % map_size_x;
+        int cz = current.column / map_size_x;
 
-    while (!minheap_isempty(&openlist)) { // find all connected blocks
-        MinheapBlock current = minheap_extract(&openlist);
+        for (size_t k = 0; k < 4 && detached; k++) {
+            int nx = cx + ((k == 0) ? 1 : (k == 1) ? -1 : 0);
+            int nz = cz + ((k == 2) ? 1 : (k == 3) ? -1 : 0);
 
-        if (pos_keyy(current.pos) <= 1) { // stop at indestructible ground layer
-            minheap_destroy(&openlist);
-            ht_destroy(&closedlist);
-            return false;
+            if (nx < 0 || nz < 0 || nx >= map_size_x || nz >= map_size_z)
+                continue;
+
+            uint64_t column = map_column(nx, nz);
+            uint64_t touching = column & current.run;
+
+            while (touching && detached) {
+                uint64_t next = map_column_run(column, __builtin_ctzll(touching));
+                touching &= ~next;
+                detached = map_physics_visit(s, nx + nz * map_size_x, next, use_grounded);
+            }
         }
+    }
 
-        for (size_t k = 0; k < sizeof(DIRECTION_MASK) / sizeof(*DIRECTION_MASK); k++) {
-            int dir_block[3] = {
-                pos_keyx(current.pos) + DIRECTION_MASK[k][0],
-                pos_keyy(current.pos) + DIRECTION_MASK[k][1],
-                pos_keyz(current.pos) + DIRECTION_MASK[k][2],
-            };
+    if (!detached) {
+        for (int k = 0; k < 64; k++)
+            s->buckets[k].count = 0;
 
-            MinheapBlock block = (MinheapBlock) {
-                .pos = pos_key(dir_block[0], dir_block[1], dir_block[2]),
-            };
+        // everything visited is connected to the ground found
+        if (use_grounded) {
+            for (size_t k = 0; k < s->touched_count; k++) {
+                MapPhysicsColumn * c = s->columns + s->touched[k];
+
+                if (c->grounded_generation < s->packet)
+                    c->grounded = 0;
 
-            if (dir_block[0] >= 0 && dir_block[1] >= 0 && dir_block[2] >= 0 && dir_block[0] < map_size_x
-               && dir_block[1] < map_size_y && dir_block[2] < map_size_z && !ht_contains(&closedlist, &block.pos)
-               && !map_isair(dir_block[0], dir_block[1], dir_block[2])) {
-                minheap_put(&openlist, &block);
-                TrueColor color = map_get(dir_block[0], dir_block[1], dir_block[2]);
-                ht_insert(&closedlist, &block.pos, &color);
+                c->grounded |= c->visited;
+                c->grounded_generation = s->generation;
             }
         }
+
+        return NULL;
     }
 
-    minheap_destroy(&openlist);
+    // detached, expand the runs into single voxels
+    Vector3i * voxels = malloc(s->voxel_count * sizeof(Vector3i));
+    CHECK_ALLOCATION_ERROR(voxels)
+
+    size_t count = 0;
+    for (size_t k = 0; k < s->touched_count; k++) {
+        uint32_t column = s->touched[k];
+
+        for (uint64_t run = s->columns[column].visited; run; run &= run - 1)
+            voxels[count++]
+                = (Vector3i) {column % map_size_x, map_size_y - 1 - __builtin_ctzll(run), column / map_size_x};
+    }
+
+    *voxel_count = count;
+    return voxels;
+}
+
+static void map_physics_collapsing(MapCollapsing * collapsing, Vector3i * voxels, TrueColor * colors, size_t count) {
+    ht_setup(&collapsing->voxels, sizeof(uint32_t), sizeof(TrueColor), count);
+    collapsing->voxels.compare = int_cmp;
+    collapsing->voxels.hash = int_hash;
 
     float pivot[3] = {0, 0, 0};
-    ht_iterate(&closedlist, pivot, falling_blocks_pivot);
+
+    for (size_t k = 0; k < count; k++) {
+        ht_insert(&collapsing->voxels, (uint32_t[]) {pos_key(voxels[k].x, voxels[k].y, voxels[k].z)}, colors + k);
+        pivot[0] += voxels[k].x;
+        pivot[1] += voxels[k].y;
+        pivot[2] += voxels[k].z;
+    }
 
     for (size_t k = 0; k < 3; k++)
-        pivot[k] = (pivot[k] / (float)closedlist.size) + 0.5F;
+        pivot[k] = (pivot[k] / (float)count) + 0.5F;
 
-    collapsing->voxels = closedlist;
     collapsing->v = (Vector3f) {0, 0, 0};
     collapsing->o = (Vector3f) {0, 0, 0};
     collapsing->p = (Vector3f) {pivot[0], pivot[1], pivot[2]};
     collapsing->p2 = collapsing->p;
     collapsing->rotation = rand() & 3;
-    collapsing->voxel_count = closedlist.size;
+    collapsing->voxel_count = count;
     collapsing->has_displaylist = 0;
 
-    tesselator_create(&collapsing->mesh_geometry, VERTEX_FLOAT, 0);
+    tesselator_pool_take(&map_collapsing_pool, &collapsing->mesh_geometry);
     ht_iterate(&collapsing->voxels, (void*[]) {collapsing, &collapsing->mesh_geometry}, falling_blocks_meshing);
+}
 
-    return true;
+// All seeds of a packet come from the same edit, so they often start inside the same structure. Only the
+// first search through it goes all the way, the others stop at runs it found to be grounded.
+static void map_physics_process(MapPhysicsSearch * search, MapWorkPacket * work) {
+    map_physics_next_generation(search);
+    search->packet = search->generation;
+
+    for (size_t k = 0; k < work->count; k++) {
+        Vector3i * seed = work->seeds + k;
+        unsigned seq = map_columns_read_begin();
+
+        size_t count;
+        Vector3i * voxels = map_physics_search(search, seed->x, seed->y, seed->z, true, &count);
+
+        if (!voxels)
+            continue;
+
+        // Structures are only removed by one worker at a time. If the map changed since the search
+        // started, another worker might have taken this structure already or the edit reconnected it.
+        pthread_mutex_lock(&map_physics_lock);
+
+        if (map_columns_read_retry(seq)) {
+            free(voxels);
+            voxels = map_physics_search(search, seed->x, seed->y, seed->z, false, &count);
+        }
+
+        if (!voxels) {
+            pthread_mutex_unlock(&map_physics_lock);
+            continue;
+        }
+
+        TrueColor * colors = malloc(count * sizeof(TrueColor));
+        CHECK_ALLOCATION_ERROR(colors)
+
+        map_get_many(voxels, colors, count);
+        map_set_many(voxels, NULL, count);
+
+        pthread_mutex_unlock(&map_physics_lock);
+
+        MapCollapsing collapsing;
+        map_physics_collapsing(&collapsing, voxels, colors, count);
+        channel_put(&map_result_queue, &collapsing);
+
+        free(voxels);
+        free(colors);
+    }
+
+    free(work->seeds);
 }
 
 /*int map_collapsing_cmp(const void * a, const void * b) {
@@ -343,7 +608,7 @@ static bool falling_blocks_render(void * obj, void * user) {
         collapsing->has_displaylist = 1;
         glx_displaylist_create(&collapsing->displaylist, true, false);
         tesselator_glx(&collapsing->mesh_geometry, &collapsing->displaylist);
-        tesselator_free(&collapsing->mesh_geometry);
+        tesselator_pool_release(&map_collapsing_pool, &collapsing->mesh_geometry);
     }
 
     glColorMask(0, 0, 0, 0);
@@ -427,7 +692,7 @@ static bool falling_blocks_update(void * obj, void * user) {
             if (collapsing->has_displaylist) {
                 glx_displaylist_destroy(&collapsing->displaylist);
             } else {
-                tesselator_free(&collapsing->mesh_geometry);
+                tesselator_pool_release(&map_collapsing_pool, &collapsing->mesh_geometry);
             }
 
             matrix_pop(matrix_model);
@@ -458,24 +723,61 @@ void map_collapsing_update(float dt) {
     entitysys_iterate(&map_collapsing_structures, &dt, falling_blocks_update);
 }
 
-void map_update_physics(int x, int y, int z) {
+// solid neighbours of a removed voxel that might have lost their connection to the ground
+static size_t map_physics_seeds(int x, int y, int z, Vector3i * seeds) {
+    size_t count = 0;
+
     if (x + 1 < map_size_x && !map_isair(x + 1, y, z))
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x + 1, .y = y, .z = z});
+        seeds[count++] = (Vector3i) {x + 1, y, z};
 
     if (x >= 1 && !map_isair(x - 1, y, z))
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x - 1, .y = y, .z = z});
+        seeds[count++] = (Vector3i) {x - 1, y, z};
 
     if (z + 1 < map_size_z && !map_isair(x, y, z + 1))
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x, .y = y, .z = z + 1});
+        seeds[count++] = (Vector3i) {x, y, z + 1};
 
     if (z >= 1 && !map_isair(x, y, z - 1))
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x, .y = y, .z = z - 1});
+        seeds[count++] = (Vector3i) {x, y, z - 1};
 
     if (y >= 3 && !map_isair(x, y - 1, z)) // don't check ground layers
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x, .y = y - 1, .z = z});
+        seeds[count++] = (Vector3i) {x, y - 1, z};
 
     if (y + 1 < map_size_y && !map_isair(x, y + 1, z))
-        channel_put(&map_work_queue, &(MapWorkPacket) {.x = x, .y = y + 1, .z = z});
+        seeds[count++] = (Vector3i) {x, y + 1, z};
+
+    return count;
+}
+
+static int map_physics_seed_cmp(const void * a, const void * b) {
+    const Vector3i * A = a;
+    const Vector3i * B = b;
+    uint32_t key_a = pos_key(A->x, A->y, A->z);
+    uint32_t key_b = pos_key(B->x, B->y, B->z);
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+static void map_physics_queue(Vector3i * seeds, size_t count) {
+    if (!count)
+        return;
+
+    qsort(seeds, count, sizeof(Vector3i), map_physics_seed_cmp);
+
+    MapWorkPacket work = (MapWorkPacket) {
+        .seeds = malloc(count * sizeof(Vector3i)),
+        .count = 0,
+    };
+    CHECK_ALLOCATION_ERROR(work.seeds)
+
+    for (size_t k = 0; k < count; k++)
+        if (!work.count || map_physics_seed_cmp(work.seeds + work.count - 1, seeds + k))
+            work.seeds[work.count++] = seeds[k];
+
+    channel_put(&map_work_queue, &work);
+}
+
+void map_update_physics(int x, int y, int z) {
+    Vector3i seeds[6];
+    map_physics_queue(seeds, map_physics_seeds(x, y, z, seeds));
 }
 
 // see this for details: https://github.com/infogulch/pyspades/blob/protocol075/pyspades/vxl_c.cpp#L380
@@ -492,107 +794,380 @@ float map_sunblock(int x, int y, int z) {
 }
 
 void * falling_blocks_worker(void * user) {
+    MapPhysicsSearch search = (MapPhysicsSearch) {
+        .columns = calloc(map_size_x * map_size_z, sizeof(MapPhysicsColumn)),
+    };
+    CHECK_ALLOCATION_ERROR(search.columns)
+
     while (1) {
         MapWorkPacket work;
         channel_await(&map_work_queue, &work);
-
-        MapCollapsing collapsing;
-        if (map_update_physics_sub(&collapsing, work.x, work.y, work.z))
-            channel_put(&map_result_queue, &collapsing);
+        map_physics_process(&search, &work);
     }
 
     return NULL;
 }
 
 void map_init() {
+    // chunks and the column bits are laid out for maps exactly one chunk high
+    assert(map_size_y == CHUNK_HEIGHT);
+
     libvxl_create(&map, 512, 512, 64, NULL, 0);
     tesselator_create(&map_damaged_tesselator, VERTEX_INT, 0);
     pthread_rwlock_init(&map_lock, NULL);
+    pthread_mutex_init(&map_stream.lock, NULL);
+    pthread_cond_init(&map_stream.signal, NULL);
+    map_columns_update(0, map_size_x * map_size_z);
 
     ht_setup(&map_damaged_voxels, sizeof(uint32_t), sizeof(DamagedVoxel), 16);
     map_damaged_voxels.compare = int_cmp;
     map_damaged_voxels.hash = int_hash;
 
     entitysys_create(&map_collapsing_structures, sizeof(MapCollapsing), 32);
+    tesselator_pool_create(&map_collapsing_pool, VERTEX_FLOAT, 0);
 
     channel_create(&map_work_queue, sizeof(MapWorkPacket), 16);
     channel_create(&map_result_queue, sizeof(MapCollapsing), 16);
 
-    pthread_t worker;
-    pthread_create(&worker, NULL, falling_blocks_worker, NULL);
+    pthread_mutex_init(&map_physics_lock, NULL);
+
+    int workers = clamp(1, MAP_PHYSICS_WORKERS_MAX, window_cpucores() / 2);
+
+    for (int k = 0; k < workers; k++) {
+        pthread_t worker;
+        pthread_create(&worker, NULL, falling_blocks_worker, NULL);
+    }
 }
 
 int map_height_at(int x, int z) {
-    uint32_t result[2];
-    pthread_rwlock_rdlock(&map_lock);
-    libvxl_map_gettop(&map, x, z, result);
-    pthread_rwlock_unlock(&map_lock);
-    return map_size_y - 1 - ((int) result[1]);
+    uint64_t column = map_column(x, z);
+    return column ? map_size_y - 1 - __builtin_ctzll(column) : 0;
 }
 
 bool map_isair(int x, int y, int z) {
-    pthread_rwlock_rdlock(&map_lock);
-    bool result = !libvxl_map_issolid(&map, x, z, map_size_y - 1 - y);
-    pthread_rwlock_unlock(&map_lock);
+    if (y < 0)
+        return false;
+    if (y >= map_size_y)
+        return true;
 
-    return result;
+    return !((map_column(x, z) >> (map_size_y - 1 - y)) & 1);
 }
 
-TrueColor map_get(int x, int y, int z) {
-    pthread_rwlock_rdlock(&map_lock);
-    uint32_t result = libvxl_map_get(&map, x, z, map_size_y - 1 - y);
-    pthread_rwlock_unlock(&map_lock);
+void map_isair_many(Vector3i * pos, bool * result, size_t count) {
+    unsigned seq;
 
-    return readBGR(&result);
+    do {
+        seq = map_columns_read_begin();
+        for (size_t k = 0; k < count; k++)
+            result[k] = map_isair(pos[k].x, pos[k].y, pos[k].z);
+    } while (map_columns_read_retry(seq));
 }
 
-void map_set(int x, int y, int z, TrueColor color) {
-    if (x < 0 || y < 0 || z < 0 || x >= map_size_x || y >= map_size_y || z >= map_size_z)
-        return;
+// Walks the columns the ray passes through and tests all voxels it touches in one of them with a single
+// mask of their solid bits. Tiles the ray passes above are skipped as a whole. Voxels are visited in the
+// same order as by a voxel by voxel walk, cells above the map count as air.
+static bool map_raycast_single(float x0, float y0, float z0, float dx, float dy, float dz, bool from_air,
+                               MapRayHit * hit) {
+    int cx = floorf(x0), cz = floorf(z0);
+    int y_in = floorf(y0), ey = floorf(y0 + dy);
+
+    int sx = (dx > 0.0F) - (dx < 0.0F);
+    int sy = (ey > y_in) - (ey < y_in);
+    int sz = (dz > 0.0F) - (dz < 0.0F);
+
+    // distances are measured in fractions of the whole ray
+    float t_delta_x = sx ? fabsf(1.0F / dx) : FLT_MAX;
+    float t_delta_z = sz ? fabsf(1.0F / dz) : FLT_MAX;
+    float t_max_x = sx ? ((sx > 0) ? cx + 1 - x0 : x0 - cx) * t_delta_x : FLT_MAX;
+    float t_max_z = sz ? ((sz > 0) ? cz + 1 - z0 : z0 - cz) * t_delta_z : FLT_MAX;
+
+    // like its own predecessor, the voxel the ray starts in never counts as entered from air
+    int prev_x = cx, prev_z = cz;
+    bool prev_solid = true;
+    int tile_checked = -1;
 
-    pthread_rwlock_wrlock(&map_lock);
+    while (1) {
+        if (cx < 0 || cz < 0 || cx >= map_size_x || cz >= map_size_z || y_in < 0)
+            return false;
 
-    uint32_t value; writeBGR(&value, color);
+        // a tile is only tested on entry, the ray rarely rises above the terrain inside of it
+        int tile_index = cx / MAP_TILE_SIZE + cz / MAP_TILE_SIZE * (map_size_x / MAP_TILE_SIZE);
+
+        if (tile_index != tile_checked) {
+            tile_checked = tile_index;
+            int tile = __atomic_load_n(map_tiles + tile_index, __ATOMIC_RELAXED);
+
+            int tx = cx / MAP_TILE_SIZE * MAP_TILE_SIZE;
+            int tz = cz / MAP_TILE_SIZE * MAP_TILE_SIZE;
+            float t_tile_x = sx ? ((sx > 0) ? tx + MAP_TILE_SIZE - x0 : x0 - tx) * t_delta_x : FLT_MAX;
+            float t_tile_z = sz ? ((sz > 0) ? tz + MAP_TILE_SIZE - z0 : z0 - tz) * t_delta_z : FLT_MAX;
+            float t_tile = min(t_tile_x, t_tile_z);
+
+            if (y_in >= tile && y0 + dy * min(t_tile, 1.0F) >= tile) {
+                if (t_tile >= 1.0F)
+                    return false;
+
+                // continue in the first column behind the tile
+                if (t_tile_x <= t_tile_z) {
+                    int z = floorf(z0 + dz * t_tile);
+                    cx = (sx > 0) ? tx + MAP_TILE_SIZE : tx - 1;
+                    cz = clamp(tz, tz + MAP_TILE_SIZE - 1, z);
+                    prev_x = cx - sx;
+                    prev_z = cz;
+                } else {
+                    int x = floorf(x0 + dx * t_tile);
+                    cx = clamp(tx, tx + MAP_TILE_SIZE - 1, x);
+                    cz = (sz > 0) ? tz + MAP_TILE_SIZE : tz - 1;
+                    prev_x = cx;
+                    prev_z = cz - sz;
+                }
+
+                t_max_x = sx ? ((sx > 0) ? cx + 1 - x0 : x0 - cx) * t_delta_x : FLT_MAX;
+                t_max_z = sz ? ((sz > 0) ? cz + 1 - z0 : z0 - cz) * t_delta_z : FLT_MAX;
+                y_in = floorf(y0 + dy * t_tile);
+                y_in = (sy > 0) ? min(y_in, ey) : max(y_in, ey);
+                prev_solid = false;
+                continue;
+            }
+        }
 
-    if (value == 0xFFFFFFFF)
-        libvxl_map_setair(&map, x, z, map_size_y - 1 - y);
-    else
-        libvxl_map_set(&map, x, z, map_size_y - 1 - y, value);
+        // the ray leaves the column where it crosses the first of its sides or ends
+        float t_out = min(min(t_max_x, t_max_z), 1.0F);
+        int y_out = floorf(y0 + dy * t_out);
+        y_out = (sy > 0) ? clamp(y_in, ey, y_out) : clamp(ey, y_in, y_out);
+
+        // voxels of this column in walking order are bits from 63 - y_in towards 63 - y_out
+        int a = max(min(y_in, y_out), 0);
+        int b = min(max(y_in, y_out), map_size_y - 1);
+        uint64_t column = __atomic_load_n(map_columns + cx + cz * map_size_x, __ATOMIC_RELAXED);
+        uint64_t solid = (a <= b) ? column & ((2ULL << (63 - a)) - 1) & ~((1ULL << (63 - b)) - 1) : 0;
+
+        if (from_air && solid) {
+            // only solid voxels right after an air voxel count
+            uint64_t entry = (prev_solid && y_in < map_size_y) ? 1ULL << (63 - y_in) : 0;
+            solid &= (sy < 0) ? ~((solid << 1) | entry) : ~((solid >> 1) | entry);
+        }
 
-    pthread_rwlock_unlock(&map_lock);
+        if (solid) {
+            int y = 63 - ((sy < 0) ? __builtin_ctzll(solid) : 63 - __builtin_clzll(solid));
+
+            *hit = (MapRayHit) {
+                .x  = cx,
+                .y  = y,
+                .z  = cz,
+                .xb = (y == y_in) ? prev_x : cx,
+                .yb = (y == y_in) ? y_in : y - sy,
+                .zb = (y == y_in) ? prev_z : cz,
+            };
+
+            return true;
+        }
+
+        if (t_out >= 1.0F || y_out < 0)
+            return false;
+
+        prev_solid = y_out < map_size_y && ((column >> (63 - y_out)) & 1);
+        prev_x = cx;
+        prev_z = cz;
+        y_in = y_out;
+
+        bool step_x = t_max_x < t_max_z;
+        cx += step_x ? sx : 0;
+        cz += step_x ? 0 : sz;
+        t_max_x += step_x ? t_delta_x : 0.0F;
+        t_max_z += step_x ? 0.0F : t_delta_z;
+    }
+}
+
+bool map_raycast(float x, float y, float z, float dx, float dy, float dz, float length, bool from_air,
+                 MapRayHit * hit) {
+    bool found;
+    map_raycast_many((Vector3f) {x, y, z}, &(Vector3f) {dx, dy, dz}, 1, length, from_air, hit, &found);
+    return found;
+}
+
+void map_raycast_many(Vector3f origin, Vector3f * directions, size_t count, float length, bool from_air,
+                      MapRayHit * hits, bool * found) {
+    unsigned seq;
+
+    do {
+        seq = map_columns_read_begin();
+        for (size_t k = 0; k < count; k++)
+            found[k] = map_raycast_single(origin.x, origin.y, origin.z, directions[k].x * length,
+                                          directions[k].y * length, directions[k].z * length, from_air, hits + k);
+    } while (map_columns_read_retry(seq));
+}
+
+TrueColor map_get(int x, int y, int z) {
+    TrueColor result;
+    map_get_many(&(Vector3i) {x, y, z}, &result, 1);
+    return result;
+}
+
+void map_get_many(Vector3i * pos, TrueColor * result, size_t count) {
+    bool locked = false;
+
+    for (size_t k = 0; k < count; k++) {
+        int x = pos[k].x, y = pos[k].y, z = pos[k].z;
+        uint32_t color = 0;
+
+        // air has no color, so only solid voxels need to look into libvxl
+        if (x >= 0 && z >= 0 && x < map_size_x && z < map_size_z && !map_isair(x, y, z)) {
+            if (!locked) {
+                pthread_rwlock_rdlock(&map_lock);
+                locked = true;
+            }
+
+            color = libvxl_map_get(&map, x, z, map_size_y - 1 - y);
+        }
+
+        result[k] = readBGR(&color);
+    }
+
+    if (locked)
+        pthread_rwlock_unlock(&map_lock);
+}
+
+// Blocks whose chunks must be remeshed after a change of the given voxel, at most MAP_CHUNK_UPDATES_MAX.
+#define MAP_CHUNK_UPDATES_MAX 6
 
-    chunk_block_update(x, y, z);
+static size_t map_chunk_updates(int x, int y, int z, Vector3i * updates) {
+    size_t count = 0;
+    updates[count++] = (Vector3i) {x, y, z};
 
     int x_off = x % CHUNK_SIZE, z_off = z % CHUNK_SIZE;
 
     if (x > 0 && x_off == 0)
-        chunk_block_update(x - 1, y, z);
+        updates[count++] = (Vector3i) {x - 1, y, z};
     if (z > 0 && z_off == 0)
-        chunk_block_update(x, y, z - 1);
+        updates[count++] = (Vector3i) {x, y, z - 1};
     if (x < map_size_x - 1 && x_off == CHUNK_SIZE - 1)
-        chunk_block_update(x + 1, y, z);
+        updates[count++] = (Vector3i) {x + 1, y, z};
     if (z < map_size_z - 1 && z_off == CHUNK_SIZE - 1)
-        chunk_block_update(x, y, z + 1);
+        updates[count++] = (Vector3i) {x, y, z + 1};
 
     if (settings.ambient_occlusion) {
         if (x > 0 && z > 0 && x_off == 0 && z_off == 0)
-            chunk_block_update(x - 1, y, z - 1);
+            updates[count++] = (Vector3i) {x - 1, y, z - 1};
         if (x < map_size_x - 1 && z < map_size_z - 1 && x_off == CHUNK_SIZE - 1 && z_off == CHUNK_SIZE - 1)
-            chunk_block_update(x + 1, y, z + 1);
+            updates[count++] = (Vector3i) {x + 1, y, z + 1};
         if (x > 0 && z < map_size_z - 1 && x_off == 0 && z_off == CHUNK_SIZE - 1)
-            chunk_block_update(x - 1, y, z + 1);
+            updates[count++] = (Vector3i) {x - 1, y, z + 1};
         if (x < map_size_x - 1 && z > 0 && x_off == CHUNK_SIZE - 1 && z_off == 0)
-            chunk_block_update(x + 1, y, z - 1);
+            updates[count++] = (Vector3i) {x + 1, y, z - 1};
     }
 
     if (x == 0)
-        chunk_block_update(map_size_x - 1, y, z);
+        updates[count++] = (Vector3i) {map_size_x - 1, y, z};
     if (x == map_size_x - 1)
-        chunk_block_update(0, y, z);
+        updates[count++] = (Vector3i) {0, y, z};
     if (z == 0)
-        chunk_block_update(x, y, map_size_z - 1);
+        updates[count++] = (Vector3i) {x, y, map_size_z - 1};
     if (z == map_size_z - 1)
-        chunk_block_update(x, y, 0);
+        updates[count++] = (Vector3i) {x, y, 0};
+
+    return count;
+}
+
+void map_set(int x, int y, int z, TrueColor color) {
+    map_set_many(&(Vector3i) {x, y, z}, &color, 1);
+}
+
+void map_set_many(Vector3i * pos, TrueColor * colors, size_t count) {
+    Vector3i updates_small[MAP_CHUNK_UPDATES_MAX * 4];
+    Vector3i * updates = updates_small;
+
+    if (count > 4) {
+        updates = malloc(count * MAP_CHUNK_UPDATES_MAX * sizeof(Vector3i));
+        CHECK_ALLOCATION_ERROR(updates)
+    }
+
+    size_t updates_count = 0;
+
+    pthread_rwlock_wrlock(&map_lock);
+
+    for (size_t k = 0; k < count; k++) {
+        int x = pos[k].x, y = pos[k].y, z = pos[k].z;
+
+        if (x < 0 || y < 0 || z < 0 || x >= map_size_x || y >= map_size_y || z >= map_size_z)
+            continue;
+
+        uint32_t value = 0xFFFFFFFF;
+        if (colors)
+            writeBGR(&value, colors[k]);
+
+        if (value == 0xFFFFFFFF)
+            libvxl_map_setair(&map, x, z, map_size_y - 1 - y);
+        else
+            libvxl_map_set(&map, x, z, map_size_y - 1 - y, value);
+
+        updates_count += map_chunk_updates(x, y, z, updates + updates_count);
+    }
+
+    // all columns change at once for readers who retry
+    map_columns_write_begin();
+    for (size_t k = 0; k < count; k++)
+        if (pos[k].x >= 0 && pos[k].z >= 0 && pos[k].x < map_size_x && pos[k].z < map_size_z)
+            map_columns_update(pos[k].x + pos[k].z * map_size_x, 1);
+    map_columns_write_end();
+
+    pthread_rwlock_unlock(&map_lock);
+
+    chunk_block_update_many(updates, updates_count);
+
+    if (updates != updates_small)
+        free(updates);
+}
+
+// Edit collected between map_edit_begin() and map_edit_commit(), only used by the main thread.
+static struct {
+    Vector3i * blocks;
+    TrueColor * colors;
+    size_t count, length;
+} map_edit;
+
+void map_edit_begin() {
+    map_edit.count = 0;
+}
+
+void map_edit_set(int x, int y, int z, TrueColor color) {
+    if (map_edit.count >= map_edit.length) {
+        map_edit.length = max(map_edit.length * 2, 64);
+        map_edit.blocks = realloc(map_edit.blocks, map_edit.length * sizeof(Vector3i));
+        CHECK_ALLOCATION_ERROR(map_edit.blocks)
+        map_edit.colors = realloc(map_edit.colors, map_edit.length * sizeof(TrueColor));
+        CHECK_ALLOCATION_ERROR(map_edit.colors)
+    }
+
+    map_edit.blocks[map_edit.count] = (Vector3i) {x, y, z};
+    map_edit.colors[map_edit.count] = color;
+    map_edit.count++;
+}
+
+void map_edit_commit() {
+    if (!map_edit.count)
+        return;
+
+    map_set_many(map_edit.blocks, map_edit.colors, map_edit.count);
+
+    Vector3i * seeds = malloc(map_edit.count * 6 * sizeof(Vector3i));
+    CHECK_ALLOCATION_ERROR(seeds)
+
+    size_t seeds_count = 0;
+
+    for (size_t k = 0; k < map_edit.count; k++) {
+        Vector3i * block = map_edit.blocks + k;
+        uint32_t value; writeBGR(&value, map_edit.colors[k]);
+
+        if (value == 0xFFFFFFFF && block->x >= 0 && block->z >= 0 && block->x < map_size_x
+           && block->z < map_size_z)
+            seeds_count += map_physics_seeds(block->x, block->y, block->z, seeds + seeds_count);
+    }
+
+    map_physics_queue(seeds, seeds_count);
+    free(seeds);
+
+    map_edit.count = 0;
 }
 
 // Copyright (c) Mathias Kaerlev 2011-2012 (but might be original code by Ben himself)
@@ -690,21 +1265,361 @@ int map_placedblock_color(int color) {
     return color ^ (gkrand & 0x70707);
 }
 
-void map_vxl_load(void * v, size_t size) {
+bool map_vxl_load(void * v, size_t size) {
+    float start = window_time();
+    int threads = max(window_cpucores(), 1);
+
+    // parse outside of the lock, readers keep using the old map meanwhile
+    struct libvxl_map loaded;
+    if (!libvxl_create_parallel(&loaded, 512, 512, 64, v, size, threads)) {
+        log_error("Map data is corrupt, keeping the current map");
+        libvxl_free(&loaded);
+        return false;
+    }
+
+    log_info("Map loaded: %zu bytes parsed on %i threads in %.0f ms", size, threads,
+             (window_time() - start) * 1000.0F);
+
     pthread_rwlock_wrlock(&map_lock);
     libvxl_free(&map);
-    libvxl_create(&map, 512, 512, 64, v, size);
+    map = loaded;
+
+    map_columns_write_begin();
+    map_columns_update(0, map_size_x * map_size_z);
+    map_columns_write_end();
+
     pthread_rwlock_unlock(&map_lock);
+
+    return true;
+}
+
+static size_t map_stream_input(void * user, uint8_t * buffer, size_t length) {
+    MapStream * stream = (MapStream *) user;
+
+    pthread_mutex_lock(&stream->lock);
+
+    while (stream->input_read == stream->input_length && !stream->input_done)
+        pthread_cond_wait(&stream->signal, &stream->lock);
+
+    size_t available = min(length, stream->input_length - stream->input_read);
+    memcpy(buffer, stream->input + stream->input_read, available);
+    stream->input_read += available;
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return available;
+}
+
+static void map_stream_progress(void * user, const uint8_t * output, size_t output_length) {
+    MapStream * stream = (MapStream *) user;
+    stream->parsed += libvxl_loader_feed(&stream->loader, output + stream->parsed, output_length - stream->parsed);
+}
+
+// names of files cached by earlier versions, least significant byte first
+static void map_cache_filename(char * filename, size_t length, uint32_t crc32) {
+    snprintf(filename, length, "cache/%02X%02X%02X%02X.vxl", BYTE0(crc32), BYTE1(crc32), BYTE2(crc32),
+             BYTE3(crc32));
+}
+
+typedef struct {
+    uint8_t * data;
+    size_t size;
+} MapCacheEntry;
+
+static void * map_cache_store(void * user) {
+    MapCacheEntry * entry = (MapCacheEntry *) user;
+
+    char filename[64], filename_tmp[72];
+    map_cache_filename(filename, sizeof(filename), libdeflate_crc32(0, entry->data, entry->size));
+
+    if (file_exists(filename)) {
+        file_touch(filename);
+    } else {
+        // written under another name first, so that an interrupted write is never picked up
+        snprintf(filename_tmp, sizeof(filename_tmp), "%s.tmp", filename);
+        FILE * f = fopen(filename_tmp, "wb");
+
+        if (f) {
+            bool written = fwrite(entry->data, 1, entry->size, f) == entry->size;
+            fclose(f);
+
+            if (written && !rename(filename_tmp, filename)) {
+                log_info("Saved map to %s", filename);
+            } else {
+                remove(filename_tmp);
+            }
+        }
+    }
+
+    file_dir_trim("cache", ".vxl", (size_t) settings.map_cache_size * 1024 * 1024);
+
+    free(entry->data);
+    free(entry);
+
+    return NULL;
+}
+
+bool map_cache_load(uint32_t crc32) {
+    char filename[64];
+    map_cache_filename(filename, sizeof(filename), crc32);
+
+    size_t size;
+    void * data = file_map(filename, &size);
+
+    if (!data)
+        return false;
+
+    if (libdeflate_crc32(0, data, size) != crc32) {
+        log_warn("Removed corrupt %s from cache", filename);
+        file_unmap(data, size);
+        remove(filename);
+        return false;
+    }
+
+    if (!map_vxl_load(data, size)) {
+        log_warn("Removed corrupt %s from cache", filename);
+        file_unmap(data, size);
+        remove(filename);
+        return false;
+    }
+
+    file_unmap(data, size);
+    file_touch(filename);
+
+    log_info("Loaded map from %s", filename);
+
+    return true;
+}
+
+static void * map_stream_worker(void * user) {
+    MapStream * stream = (MapStream *) user;
+
+    uint8_t * output;
+    size_t output_length;
+    InflateResult result = inflate_zlib(map_stream_input, map_stream_progress, stream, &output, &output_length);
+    stream->output_length = output_length;
+
+    if (result != INFLATE_SUCCESS)
+        log_error("map data is %s", result == INFLATE_BAD_DATA ? "corrupt" : "incomplete");
+
+    stream->success = result == INFLATE_SUCCESS && libvxl_loader_finish(&stream->loader);
+
+    if (stream->success && settings.map_cache_size > 0) {
+        MapCacheEntry * entry = malloc(sizeof(MapCacheEntry));
+        CHECK_ALLOCATION_ERROR(entry)
+        *entry = (MapCacheEntry) {.data = output, .size = output_length};
+
+        pthread_t writer;
+        if (!pthread_create(&writer, NULL, map_cache_store, entry)) {
+            pthread_detach(writer);
+            return NULL;
+        }
+
+        free(entry);
+    }
+
+    free(output);
+
+    return NULL;
+}
+
+// waits until the worker has consumed all input received so far, without a worker it is consumed right here
+static void map_stream_join() {
+    pthread_mutex_lock(&map_stream.lock);
+    map_stream.input_done = true;
+    pthread_cond_signal(&map_stream.signal);
+    pthread_mutex_unlock(&map_stream.lock);
+
+    if (map_stream.threaded)
+        pthread_join(map_stream.thread, NULL);
+    else
+        map_stream_worker(&map_stream);
+
+    free(map_stream.input);
+    map_stream.input = NULL;
+    map_stream.active = false;
 }
 
+void map_vxl_stream_begin() {
+    if (map_stream.active) {
+        map_stream_join();
+        libvxl_free(&map_stream.map);
+    }
+
+    map_stream.input_done = false;
+    map_stream.success = false;
+    map_stream.input_capacity = 1024 * 1024;
+    map_stream.input = malloc(map_stream.input_capacity);
+    CHECK_ALLOCATION_ERROR(map_stream.input)
+    map_stream.input_length = 0;
+    map_stream.input_read = 0;
+    map_stream.output_length = 0;
+    map_stream.parsed = 0;
+
+    libvxl_loader_begin(&map_stream.loader, &map_stream.map, 512, 512, 64);
+
+    map_stream.active = true;
+    map_stream.threaded = !pthread_create(&map_stream.thread, NULL, map_stream_worker, &map_stream);
+
+    if (!map_stream.threaded)
+        log_warn("Could not start map stream worker, the map is decompressed once it is complete");
+}
+
+void map_vxl_stream_feed(void * data, size_t size) {
+    if (!map_stream.active)
+        return;
+
+    pthread_mutex_lock(&map_stream.lock);
+
+    if (map_stream.input_length + size > map_stream.input_capacity) {
+        while (map_stream.input_length + size > map_stream.input_capacity)
+            map_stream.input_capacity *= 2;
+
+        map_stream.input = realloc(map_stream.input, map_stream.input_capacity);
+        CHECK_ALLOCATION_ERROR(map_stream.input)
+    }
+
+    memcpy(map_stream.input + map_stream.input_length, data, size);
+    map_stream.input_length += size;
+
+    pthread_cond_signal(&map_stream.signal);
+    pthread_mutex_unlock(&map_stream.lock);
+}
+
+bool map_vxl_stream_finish() {
+    if (!map_stream.active)
+        return false;
+
+    float start = window_time();
+    map_stream_join();
+
+    if (map_stream.success) {
+        pthread_rwlock_wrlock(&map_lock);
+        libvxl_free(&map);
+        map = map_stream.map;
+
+        map_columns_write_begin();
+        map_columns_update(0, map_size_x * map_size_z);
+        map_columns_write_end();
+
+        pthread_rwlock_unlock(&map_lock);
+    } else {
+        libvxl_free(&map_stream.map);
+    }
+
+    log_info("Map stream finished: %zu bytes decompressed, final join took %.0f ms", map_stream.output_length,
+             (window_time() - start) * 1000.0F);
+
+    return map_stream.success;
+}
+
+typedef struct {
+    uint8_t * data;
+    size_t size;
+} MapSaveBand;
+
+typedef struct {
+    struct libvxl_map map;
+    char filename[256];
+    bool compress;
+    MapSaveBand * bands;
+} MapSave;
+
+// runs on the thread that encoded the band, so compression happens in parallel as well
+static void map_save_band(void * user, size_t band, void * data, size_t size) {
+    MapSave * save = (MapSave *) user;
+
+    if (save->compress) {
+        // bands become separate gzip members, concatenated they form a valid .gz file
+        struct libdeflate_compressor * compressor = libdeflate_alloc_compressor(6);
+        CHECK_ALLOCATION_ERROR(compressor)
+
+        size_t bound = libdeflate_gzip_compress_bound(compressor, size);
+        uint8_t * compressed = malloc(bound);
+        CHECK_ALLOCATION_ERROR(compressed)
+
+        save->bands[band] = (MapSaveBand) {
+            .data = compressed,
+            .size = libdeflate_gzip_compress(compressor, data, size, compressed, bound),
+        };
+
+        libdeflate_free_compressor(compressor);
+        libvxl_mem_free(data);
+    } else {
+        save->bands[band] = (MapSaveBand) {.data = data, .size = size};
+    }
+}
+
+static void * map_save_worker(void * user) {
+    MapSave * save = (MapSave *) user;
+
+    float start = window_time();
+    size_t threads = max(window_cpucores(), 1);
+
+    save->bands = malloc(threads * sizeof(MapSaveBand));
+    CHECK_ALLOCATION_ERROR(save->bands)
+
+    size_t count = libvxl_write_parallel(&save->map, threads, map_save_band, save);
+    libvxl_free(&save->map);
+
+    char filename_tmp[264];
+    snprintf(filename_tmp, sizeof(filename_tmp), "%s.tmp", save->filename);
+    FILE * f = fopen(filename_tmp, "wb");
+
+    bool written = f;
+    size_t total = 0;
+
+    for (size_t k = 0; k < count; k++) {
+        if (written)
+            written = fwrite(save->bands[k].data, 1, save->bands[k].size, f) == save->bands[k].size;
+        total += save->bands[k].size;
+        free(save->bands[k].data);
+    }
+
+    if (f)
+        fclose(f);
+
+    if (written && !rename(filename_tmp, save->filename)) {
+        log_info("Saved map to %s: %zu bytes on %zu threads in %.0f ms", save->filename, total, count,
+                 (window_time() - start) * 1000.0F);
+    } else {
+        remove(filename_tmp);
+        log_error("Could not save map to %s", save->filename);
+    }
+
+    free(save->bands);
+    free(save);
+
+    return NULL;
+}
+
+// saves a copy of the current map in the background, gzip compressed if filename ends with .gz
 void map_save_file(char * filename) {
+    MapSave * save = malloc(sizeof(MapSave));
+    CHECK_ALLOCATION_ERROR(save)
+
+    snprintf(save->filename, sizeof(save->filename), "%s", filename);
+    size_t length = strlen(save->filename);
+    save->compress = length > 3 && !strcmp(save->filename + length - 3, ".gz");
+
+    // only the copy blocks edits, encoding and writing happen in the background
+    float start = window_time();
     pthread_rwlock_rdlock(&map_lock);
-    libvxl_writefile(&map, filename);
+    libvxl_snapshot(&map, &save->map);
     pthread_rwlock_unlock(&map_lock);
+
+    log_info("Map snapshot took %.1f ms", (window_time() - start) * 1000.0F);
+
+    pthread_t writer;
+    if (!pthread_create(&writer, NULL, map_save_worker, save)) {
+        pthread_detach(writer);
+    } else {
+        map_save_worker(save);
+    }
 }
 
-void map_copy_blocks(struct libvxl_chunk_copy * copy, size_t x, size_t y) {
+void map_copy_blocks(struct libvxl_chunk_copy * copy, size_t x, size_t y, size_t halo, size_t halo_behind) {
     pthread_rwlock_rdlock(&map_lock);
-    libvxl_copy_chunk(&map, copy, x, y);
+    libvxl_copy_chunk(&map, copy, x, y, halo, halo_behind);
     pthread_rwlock_unlock(&map_lock);
 }
@@ -264,7 +264,15 @@ static void greedy_mesh(kv6 * model, Voxel * voxel, uint8_t * marked, size_t * m
     }
 }
 
+float kv6_radius(kv6 * model) {
+    float x = max(model->xpiv, model->xsiz - model->xpiv);
+    float y = max(model->ypiv, model->ysiz - model->ypiv);
+    float z = max(model->zpiv, model->zsiz - model->zpiv);
+    return hypot3f(x, y, z) * model->scale;
+}
+
 static int kv6_program = -1;
+
 void kv6_render(kv6 * model, unsigned char team) {
     if (!model)
         return;
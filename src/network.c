@@ -21,7 +21,6 @@
 #include <ctype.h>
 #include <math.h>
 
-#include <libdeflate.h>
 #include <enet/enet.h>
 
 #include <BetterSpades/texture.h>
@@ -58,8 +57,6 @@ unsigned char network_keys_last    = 0;
 unsigned char network_buttons_last = 0;
 unsigned char network_tool_last    = 255;
 
-uint8_t * compressed_chunk_data;
-int compressed_chunk_data_size;
 int compressed_chunk_data_offset = 0;
 int compressed_chunk_data_estimate = 0;
 
@@ -238,38 +235,37 @@ void getPacketBlockAction(uint8_t * data, int len) {
         }
 
         case ACTION_GRENADE: {
+            map_edit_begin();
             for (int j = (63 - z) - 1; j <= (63 - z) + 1; j++) {
                 for (int k = y - 1; k <= y + 1; k++) {
                     for (int i = x - 1; i <= x + 1; i++) {
-                        if (j > 1) {
-                            map_set(i, j, k, White);
-                            map_update_physics(i, j, k);
-                        }
+                        if (j > 1)
+                            map_edit_set(i, j, k, White);
                     }
                 }
             }
+            map_edit_commit();
             break;
         }
 
         case ACTION_SPADE: {
-            if ((63 - z - 1) > 1) {
-                map_set(x, 63 - z - 1, y, White);
-                map_update_physics(x, 63 - z - 1, y);
-            }
+            map_edit_begin();
+
+            if ((63 - z - 1) > 1)
+                map_edit_set(x, 63 - z - 1, y, White);
 
             if ((63 - z + 0) > 1) {
                 TrueColor col = map_get(x, 63 - z, y);
 
-                map_set(x, 63 - z + 0, y, White);
-                map_update_physics(x, 63 - z + 0, y);
+                map_edit_set(x, 63 - z + 0, y, White);
 
                 particle_create(col, x + 0.5F, 63 - z + 0.5F, y + 0.5F, 2.5F, 1.0F, 8, 0.1F, 0.25F);
             }
 
-            if ((63 - z + 1) > 1) {
-                map_set(x, 63 - z + 1, y, White);
-                map_update_physics(x, 63 - z + 1, y);
-            }
+            if ((63 - z + 1) > 1)
+                map_edit_set(x, 63 - z + 1, y, White);
+
+            map_edit_commit();
             break;
         }
 
@@ -314,12 +310,14 @@ void getPacketBlockLine(uint8_t * data, int len) {
     } else {
         Vector3i blocks[64];
         int len = map_cube_line(sx, sy, sz, ex, ey, ez, blocks);
+        map_edit_begin();
         while (len > 0) {
             if (map_isair(blocks[len - 1].x, 63 - blocks[len - 1].z, blocks[len - 1].y)) {
-                map_set(blocks[len - 1].x, 63 - blocks[len - 1].z, blocks[len - 1].y, color);
+                map_edit_set(blocks[len - 1].x, 63 - blocks[len - 1].z, blocks[len - 1].y, color);
             }
             len--;
         }
+        map_edit_commit();
     }
 
     sound_create(
@@ -645,43 +643,8 @@ void getPacketStateData(uint8_t * data, int len) {
     chat_popup_duration  = 0;
 
     log_info("map data was %i bytes", compressed_chunk_data_offset);
-    if (!network_map_cached) {
-        int avail_size = 1024 * 1024;
-        void * decompressed = malloc(avail_size);
-        CHECK_ALLOCATION_ERROR(decompressed)
-        size_t decompressed_size;
-        struct libdeflate_decompressor * d = libdeflate_alloc_decompressor();
-
-        for (;;) {
-            int r = libdeflate_zlib_decompress(d, compressed_chunk_data, compressed_chunk_data_offset, decompressed,
-                                               avail_size, &decompressed_size);
-            // switch not fancy enough here, breaking out of the loop is not aesthetic
-            if (r == LIBDEFLATE_INSUFFICIENT_SPACE) {
-                avail_size += 1024 * 1024;
-                decompressed = realloc(decompressed, avail_size);
-                CHECK_ALLOCATION_ERROR(decompressed)
-            }
-            if (r == LIBDEFLATE_SUCCESS) {
-                map_vxl_load(decompressed, decompressed_size);
-/*#ifndef USE_TOUCH
-                char filename[128];
-                sprintf(filename, "cache/%08X.vxl", libdeflate_crc32(0, decompressed, decompressed_size));
-                log_info("%s", filename);
-                FILE * f = fopen(filename, "wb");
-                fwrite(decompressed, 1, decompressed_size, f);
-                fclose(f);
-#endif*/
-                chunk_rebuild_all();
-                break;
-            }
-            if (r == LIBDEFLATE_BAD_DATA || r == LIBDEFLATE_SHORT_OUTPUT)
-                break;
-        }
-
-        free(decompressed);
-        free(compressed_chunk_data);
-        libdeflate_free_decompressor(d);
-    }
+    if (!network_map_cached && map_vxl_stream_finish())
+        chunk_rebuild_all();
 }
 
 void player_reset_toggleable_input() {
@@ -761,10 +724,6 @@ void getPacketKillAction(uint8_t * data, int len) {
 }
 
 void getPacketMapStart(uint8_t * data, int len) {
-    // ffs someone fix the wrong map size of 1.5mb
-    compressed_chunk_data_size = 1024 * 1024;
-    compressed_chunk_data      = malloc(compressed_chunk_data_size);
-    CHECK_ALLOCATION_ERROR(compressed_chunk_data)
     compressed_chunk_data_offset = 0;
     network_logged_in            = 0;
     network_map_transfer         = 1;
@@ -781,21 +740,8 @@ void getPacketMapStart(uint8_t * data, int len) {
         log_info("map name: %s", p.map_name);
         log_info("map crc32: 0x%08X", p.crc32);
 
-        char filename[128];
-        sprintf(filename, "cache/%02X%02X%02X%02X.vxl",
-            BYTE0(p.crc32),
-            BYTE1(p.crc32),
-            BYTE2(p.crc32),
-            BYTE3(p.crc32)
-        );
-
-        log_info("%s", filename);
-
-        if (file_exists(filename)) {
+        if (settings.map_cache_size > 0 && map_cache_load(p.crc32)) {
             network_map_cached = 1;
-            void * mapd = file_load(filename);
-            map_vxl_load(mapd, file_size(filename));
-            free(mapd);
             chunk_rebuild_all();
         }
 
@@ -803,21 +749,17 @@ void getPacketMapStart(uint8_t * data, int len) {
         sendPacketMapCached(&reply, 0);
     }
 
+    if (!network_map_cached)
+        map_vxl_stream_begin();
+
     trajectories_reset();
 
     player_init(); camera.mode = CAMERAMODE_SELECTION;
 }
 
 void getPacketMapChunk(uint8_t * data, int len) {
-    // increase allocated memory if it is not enough to store the next chunk
-    if (compressed_chunk_data_offset + len > compressed_chunk_data_size) {
-        compressed_chunk_data_size += 1024 * 1024;
-        compressed_chunk_data = realloc(compressed_chunk_data, compressed_chunk_data_size);
-        CHECK_ALLOCATION_ERROR(compressed_chunk_data)
-    }
-
     // accept any chunk length for “superior” performance, as pointed out by github/NotAFile
-    memcpy(compressed_chunk_data + compressed_chunk_data_offset, data, len);
+    map_vxl_stream_feed(data, len);
     compressed_chunk_data_offset += len;
 }
 
@@ -0,0 +1,249 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/occlusion.h>
+
+// anything closer to the camera is neither drawn nor tested, depth is the distance along the view direction
+#define OCCLUSION_NEAR 0.1F
+
+typedef struct {
+    float x, y, w;
+} OcclusionVertex;
+
+typedef struct {
+    float x, y, dx, dy;
+    bool positive;
+} OcclusionEdge;
+
+static struct {
+    mat4 matrix;
+    float depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT];
+    float tmp[OCCLUSION_WIDTH * OCCLUSION_HEIGHT];
+} occlusion;
+
+static void occlusion_project(float x, float y, float z, OcclusionVertex * out) {
+    float cx = occlusion.matrix[0][0] * x + occlusion.matrix[1][0] * y + occlusion.matrix[2][0] * z
+        + occlusion.matrix[3][0];
+    float cy = occlusion.matrix[0][1] * x + occlusion.matrix[1][1] * y + occlusion.matrix[2][1] * z
+        + occlusion.matrix[3][1];
+    out->w = occlusion.matrix[0][3] * x + occlusion.matrix[1][3] * y + occlusion.matrix[2][3] * z
+        + occlusion.matrix[3][3];
+
+    if (out->w >= OCCLUSION_NEAR) {
+        out->x = (cx / out->w * 0.5F + 0.5F) * OCCLUSION_WIDTH;
+        out->y = (cy / out->w * 0.5F + 0.5F) * OCCLUSION_HEIGHT;
+    }
+}
+
+void occlusion_begin(mat4 view_projection) {
+    memcpy(occlusion.matrix, view_projection, sizeof(mat4));
+
+    for (int k = 0; k < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; k++)
+        occlusion.depth[k] = FLT_MAX;
+}
+
+// Fills all pixels whose centre is inside the convex quad with its farthest depth. Edges shared by two quads
+// are always evaluated from the same end, so that no pixel falls through the gap between them.
+static void occlusion_draw_quad(OcclusionVertex * v) {
+    float depth = 0.0F;
+    float min_x = FLT_MAX, min_y = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX;
+    float area = 0.0F;
+
+    for (int k = 0; k < 4; k++) {
+        if (v[k].w < OCCLUSION_NEAR)
+            return;
+
+        depth = max(depth, v[k].w);
+        min_x = min(min_x, v[k].x);
+        min_y = min(min_y, v[k].y);
+        max_x = max(max_x, v[k].x);
+        max_y = max(max_y, v[k].y);
+        area += v[k].x * v[(k + 1) % 4].y - v[(k + 1) % 4].x * v[k].y;
+    }
+
+    float fx0 = max(ceilf(min_x - 0.5F), 0.0F);
+    float fy0 = max(ceilf(min_y - 0.5F), 0.0F);
+    float fx1 = min(floorf(max_x - 0.5F), OCCLUSION_WIDTH - 1);
+    float fy1 = min(floorf(max_y - 0.5F), OCCLUSION_HEIGHT - 1);
+
+    if (area == 0.0F || fx0 > fx1 || fy0 > fy1)
+        return;
+
+    OcclusionEdge edges[4];
+
+    for (int k = 0; k < 4; k++) {
+        OcclusionVertex * a = v + k;
+        OcclusionVertex * b = v + (k + 1) % 4;
+        bool swap = a->x > b->x || (a->x == b->x && a->y > b->y);
+
+        if (swap) {
+            OcclusionVertex * t = a;
+            a = b;
+            b = t;
+        }
+
+        // the inside is to the left of each edge for counter-clockwise quads
+        edges[k] = (OcclusionEdge) {
+            .x = a->x,
+            .y = a->y,
+            .dx = b->x - a->x,
+            .dy = b->y - a->y,
+            .positive = (area < 0.0F) != swap,
+        };
+    }
+
+    int x0 = ((int) fx0) & ~3;
+    int x1 = fx1;
+
+    for (int y = fy0; y <= fy1; y++) {
+        float py = y + 0.5F;
+        float * row = occlusion.depth + y * OCCLUSION_WIDTH;
+        float t[4];
+
+        for (int k = 0; k < 4; k++)
+            t[k] = (py - edges[k].y) * edges[k].dx;
+
+#if defined(__SSE2__)
+        __m128 zero = _mm_setzero_ps();
+        __m128 d = _mm_set1_ps(depth);
+
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0.5F, 1.5F, 2.5F, 3.5F));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+            for (int k = 0; k < 4; k++) {
+                __m128 e = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(edges[k].x)), _mm_set1_ps(edges[k].dy)),
+                                      _mm_set1_ps(t[k]));
+                inside = _mm_and_ps(inside, edges[k].positive ? _mm_cmpge_ps(e, zero) : _mm_cmple_ps(e, zero));
+            }
+
+            __m128 current = _mm_loadu_ps(row + x);
+            _mm_storeu_ps(row + x,
+                          _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(current, d)), _mm_andnot_ps(inside, current)));
+        }
+#else
+        for (int x = x0; x <= x1; x++) {
+            float px = x + 0.5F;
+            bool inside = true;
+
+            for (int k = 0; k < 4; k++) {
+                float e = (px - edges[k].x) * edges[k].dy - t[k];
+                inside &= edges[k].positive ? e >= 0.0F : e <= 0.0F;
+            }
+
+            if (inside)
+                row[x] = min(row[x], depth);
+        }
+#endif
+    }
+}
+
+void occlusion_add_quad(float vertices[4][3]) {
+    OcclusionVertex quad[4];
+
+    for (int k = 0; k < 4; k++)
+        occlusion_project(vertices[k][0], vertices[k][1], vertices[k][2], quad + k);
+
+    occlusion_draw_quad(quad);
+}
+
+// A pixel counts as covered when its centre is, so occluders reach up to half a pixel too far. Taking the
+// farthest depth of all neighbours drops every pixel an edge passes through.
+void occlusion_end() {
+    for (int y = 0; y < OCCLUSION_HEIGHT; y++) {
+        float * in = occlusion.depth + y * OCCLUSION_WIDTH;
+        float * out = occlusion.tmp + y * OCCLUSION_WIDTH;
+
+        out[0] = max(in[0], in[1]);
+        for (int x = 1; x < OCCLUSION_WIDTH - 1; x++)
+            out[x] = max(max(in[x - 1], in[x]), in[x + 1]);
+        out[OCCLUSION_WIDTH - 1] = max(in[OCCLUSION_WIDTH - 2], in[OCCLUSION_WIDTH - 1]);
+    }
+
+    for (int y = 0; y < OCCLUSION_HEIGHT; y++) {
+        float * above = occlusion.tmp + max(y - 1, 0) * OCCLUSION_WIDTH;
+        float * in = occlusion.tmp + y * OCCLUSION_WIDTH;
+        float * below = occlusion.tmp + min(y + 1, OCCLUSION_HEIGHT - 1) * OCCLUSION_WIDTH;
+        float * out = occlusion.depth + y * OCCLUSION_WIDTH;
+
+        for (int x = 0; x < OCCLUSION_WIDTH; x++)
+            out[x] = max(max(above[x], in[x]), below[x]);
+    }
+}
+
+bool occlusion_test_box(float x0, float y0, float z0, float x1, float y1, float z1) {
+    OcclusionVertex corners[8];
+    for (int k = 0; k < 8; k++)
+        occlusion_project((k & 1) ? x1 : x0, (k & 2) ? y1 : y0, (k & 4) ? z1 : z0, corners + k);
+
+    float nearest = FLT_MAX;
+    float min_x = FLT_MAX, min_y = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX;
+
+    for (int k = 0; k < 8; k++) {
+        if (corners[k].w < OCCLUSION_NEAR)
+            return false;
+
+        nearest = min(nearest, corners[k].w);
+        min_x = min(min_x, corners[k].x);
+        min_y = min(min_y, corners[k].y);
+        max_x = max(max_x, corners[k].x);
+        max_y = max(max_y, corners[k].y);
+    }
+
+    // every pixel the box touches, not only those whose centre it covers
+    float fx0 = max(floorf(min_x), 0.0F);
+    float fy0 = max(floorf(min_y), 0.0F);
+    float fx1 = min(floorf(max_x), OCCLUSION_WIDTH - 1);
+    float fy1 = min(floorf(max_y), OCCLUSION_HEIGHT - 1);
+
+    if (fx0 > fx1 || fy0 > fy1)
+        return false;
+
+    int tx0 = fx0;
+    int tx1 = fx1;
+
+    for (int y = fy0; y <= fy1; y++) {
+        float * row = occlusion.depth + y * OCCLUSION_WIDTH;
+        int x = tx0;
+
+#if defined(__SSE2__)
+        __m128 n = _mm_set1_ps(nearest);
+        for (; x + 3 <= tx1; x += 4)
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), n)))
+                return false;
+#endif
+
+        for (; x <= tx1; x++)
+            if (row[x] >= nearest)
+                return false;
+    }
+
+    return true;
+}
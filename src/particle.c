@@ -174,6 +174,21 @@ void particle_update(float dt) {
     entitysys_iterate(&particles, &dt, particle_update_single);
 }
 
+static CameraBoxes particle_bounds;
+
+static void particle_box(void * obj, float * bounds) {
+    Particle * p = (Particle *) obj;
+
+    // casings are drawn as models of about a block in size
+    float size = (p->type == 255) ? p->size / 2.0F : 0.5F;
+    bounds[0] = p->x - size;
+    bounds[1] = p->y - size;
+    bounds[2] = p->z - size;
+    bounds[3] = p->x + size;
+    bounds[4] = p->y + size;
+    bounds[5] = p->z + size;
+}
+
 static bool particle_render_single(void * obj, void * user) {
     Particle * p = (Particle *) obj;
     Tesselator * tess = (Tesselator *) user;
@@ -213,7 +228,8 @@ static bool particle_render_single(void * obj, void * user) {
 void particle_render() {
     tesselator_clear(&particle_tesselator);
 
-    entitysys_iterate(&particles, &particle_tesselator, particle_render_single);
+    camera_boxes_collect(&particle_bounds, &particles, particle_box);
+    camera_boxes_iterate(&particle_bounds, &particles, &particle_tesselator, particle_render_single);
 
     matrix_upload();
     tesselator_draw(&particle_tesselator, 1);
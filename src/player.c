@@ -37,6 +37,10 @@
 #include <BetterSpades/particle.h>
 #include <BetterSpades/opengl.h>
 
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 GameState gamestate;
 
 MouseButtons button_map;
@@ -244,41 +248,7 @@ float player_section_height(int section) {
     }
 }
 
-bool player_intersection_exists(Hit * s) {
-    return s->head || s->torso || s->arms || s->leg_left || s->leg_right;
-}
-
-int player_intersection_choose(Hit * s, float * dist) {
-    int type;
-    *dist = FLT_MAX;
-
-    if (s->arms && s->distance.arms < *dist) {
-        type = HITTYPE_ARMS;
-        *dist = s->distance.arms;
-    }
-
-    if (s->leg_left && s->distance.leg_left < *dist) {
-        type = HITTYPE_LEGS;
-        *dist = s->distance.leg_left;
-    }
-
-    if (s->leg_right && s->distance.leg_right < *dist) {
-        type = HITTYPE_LEGS;
-        *dist = s->distance.leg_right;
-    }
-
-    if (s->torso && s->distance.torso < *dist) {
-        type = HITTYPE_TORSO;
-        *dist = s->distance.torso;
-    }
-
-    if (s->head && s->distance.head < *dist) {
-        type = HITTYPE_HEAD;
-        *dist = s->distance.head;
-    }
-
-    return type;
-}
+static void hitboxes_update(void);
 
 void player_update(float dt, int locked) {
     for (int k = 0; k < PLAYERS_MAX; k++) {
@@ -298,6 +268,8 @@ void player_update(float dt, int locked) {
             }
         }
     }
+
+    hitboxes_update();
 }
 
 void player_render_all() {
@@ -313,6 +285,19 @@ void player_render_all() {
     ray.direction[Y] = cos(camera.rot.y);
     ray.direction[Z] = cos(camera.rot.x) * sin(camera.rot.y);
 
+    // all players are tested against the frustum at once
+    static CameraBoxes bounds;
+    camera_boxes_clear(&bounds);
+
+    for (int k = 0; k < PLAYERS_MAX; k++)
+        camera_boxes_add(&bounds, players[k].pos.x - 1.0F, players[k].pos.y - 1.0F, players[k].pos.z - 1.0F,
+                         players[k].pos.x + 1.0F, players[k].pos.y + 2.0F, players[k].pos.z + 1.0F);
+
+    camera_boxes_cull(&bounds);
+
+    // the crosshair is tested against all rendered players at once
+    bool candidates[PLAYERS_MAX] = {false};
+
     for (int k = 0; k < PLAYERS_MAX; k++) {
         if (!players[k].connected || players[k].team == TEAM_SPECTATOR)
             continue;
@@ -419,21 +404,11 @@ void player_render_all() {
         }
 
         if (k != local_player.id) {
-            if (camera_CubeInFrustum(players[k].pos.x, players[k].pos.y, players[k].pos.z, 1.0F, 2.0F)
+            if (camera_boxes_visible(&bounds, k)
                && norm2f(players[k].pos.x, players[k].pos.z, camera.pos.x, camera.pos.z) <=
                   sqrf(settings.render_distance + 2.0F)) {
-                Hit intersects = {0};
                 player_render(players + k, k);
-                player_collision(players + k, &ray, &intersects);
-                if (player_intersection_exists(&intersects)) {
-                    float d;
-                    int type = player_intersection_choose(&intersects, &d);
-                    if (d < player_intersection_dist) {
-                        player_intersection_dist = d;
-                        player_intersection_player = k;
-                        player_intersection_type = type;
-                    }
-                }
+                candidates[k] = true;
             }
 
             if (players[k].alive && players[k].held_item == TOOL_GUN && HASBIT(players[k].input.buttons, BUTTON_PRIMARY)) {
@@ -483,6 +458,15 @@ void player_render_all() {
             }
         }
     }
+
+    PlayerRayHit hit = {.distance = FLT_MAX};
+    player_collision_many(&ray, 1, candidates, &hit);
+
+    if (hit.player >= 0) {
+        player_intersection_dist   = hit.distance;
+        player_intersection_player = hit.player;
+        player_intersection_type   = hit.type;
+    }
 }
 
 static float foot_function(const Player * p) {
@@ -540,32 +524,45 @@ static const Hitbox box_legc = {
     .scale = 0.1F,
 };
 
-static bool hitbox_intersection(mat4 model, const Hitbox * box, Ray * r, float * distance) {
+enum {
+    HITBOX_HEAD,
+    HITBOX_TORSO,
+    HITBOX_LEG_LEFT,
+    HITBOX_LEG_RIGHT,
+    HITBOX_ARM_LEFT,
+    HITBOX_ARM_RIGHT,
+};
+
+// lanes reserved for each player, its six hitboxes are padded to whole vectors and the last two are ignored
+#define HITBOX_LANES 8
+
+// Hitboxes of all players in their own frame and the inverse of their model transform, stored as one lane per
+// hitbox, so that rays are tested against them without the matrix stack.
+static struct {
+    float inv[12][PLAYERS_MAX * HITBOX_LANES]; // first three rows of the inverse
+    float min[3][PLAYERS_MAX * HITBOX_LANES];
+    float max[3][PLAYERS_MAX * HITBOX_LANES];
+    int players[PLAYERS_MAX];
+    int count;
+} hitboxes;
+
+static void hitbox_set(int lane, mat4 model, const Hitbox * box) {
     mat4 inv_model;
     glm_mat4_inv(model, inv_model);
 
-    vec3 origin, dir;
-    glm_mat4_mulv3(inv_model, r->origin, 1.0F, origin);
-    glm_mat4_mulv3(inv_model, r->direction, 0.0F, dir);
-
-    return aabb_intersection_ray(
-        &(AABB) {
-            .min = {-box->pivot[0] * box->scale, -box->pivot[2] * box->scale, -box->pivot[1] * box->scale},
-            .max = {(box->size[0] - box->pivot[0]) * box->scale, (box->size[2] - box->pivot[2]) * box->scale,
-                    (box->size[1] - box->pivot[1]) * box->scale},
-        },
-        &(Ray) {
-            .origin = {origin[0], origin[1], origin[2]},
-            .direction = {dir[0], dir[1], dir[2]},
-        },
-        distance
-    );
-}
+    for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 4; col++)
+            hitboxes.inv[row * 4 + col][lane] = inv_model[col][row];
 
-void player_collision(const Player * p, Ray * ray, Hit * intersects) {
-    if (!p->alive || p->team == TEAM_SPECTATOR)
-        return;
+    hitboxes.min[X][lane] = -box->pivot[0] * box->scale;
+    hitboxes.min[Y][lane] = -box->pivot[2] * box->scale;
+    hitboxes.min[Z][lane] = -box->pivot[1] * box->scale;
+    hitboxes.max[X][lane] = (box->size[0] - box->pivot[0]) * box->scale;
+    hitboxes.max[Y][lane] = (box->size[2] - box->pivot[2]) * box->scale;
+    hitboxes.max[Z][lane] = (box->size[1] - box->pivot[1]) * box->scale;
+}
 
+static void hitboxes_player(const Player * p, int lane) {
     float l  = hypot3f(p->orientation_smooth.x, p->orientation_smooth.y, p->orientation_smooth.z);
     float ox = p->orientation_smooth.x / l;
     float oy = p->orientation_smooth.y / l;
@@ -585,83 +582,171 @@ void player_collision(const Player * p, Ray * ray, Hit * intersects) {
     a /= 0.25F;
     b /= 0.25F;
 
-    float dist; // distance
+    mat4 model, leg_model;
 
-    matrix_push(matrix_model);
-
-    matrix_identity(matrix_model);
-    matrix_translate(matrix_model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
+    matrix_identity(model);
+    matrix_translate(model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
     float head_scale = hypot3f(p->orientation.x, p->orientation.y, p->orientation.z);
-    matrix_translate(matrix_model, 0.0F, box_head.pivot[2] * (head_scale * box_head.scale - box_head.scale), 0.0F);
-    matrix_scale3(matrix_model, head_scale);
-    matrix_pointAt(matrix_model, ox, oy, oz);
-    matrix_rotate(matrix_model, 90.0F, 0.0F, 1.0F, 0.0F);
+    matrix_translate(model, 0.0F, box_head.pivot[2] * (head_scale * box_head.scale - box_head.scale), 0.0F);
+    matrix_scale3(model, head_scale);
+    matrix_pointAt(model, ox, oy, oz);
+    matrix_rotate(model, 90.0F, 0.0F, 1.0F, 0.0F);
+    hitbox_set(lane + HITBOX_HEAD, model, &box_head);
+
+    matrix_identity(model);
+    matrix_translate(model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
+    matrix_pointAt(model, ox, 0.0F, oz);
+    matrix_rotate(model, 90.0F, 0.0F, 1.0F, 0.0F);
+    hitbox_set(lane + HITBOX_TORSO, model, torso);
+
+    matrix_load(leg_model, model);
+    matrix_translate(leg_model, torso->size[0] * 0.1F * 0.5F - leg->size[0] * 0.1F * 0.5F,
+                     -torso->size[2] * 0.1F * (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.6F : 1.0F),
+                     HASBIT(p->input.keys, INPUT_CROUCH) ? (-torso->size[2] * 0.1F * 0.75F) : 0.0F);
+    matrix_rotate(leg_model, 45.0F * foot_function(p) * a, 1.0F, 0.0F, 0.0F);
+    matrix_rotate(leg_model, 45.0F * foot_function(p) * b, 0.0F, 0.0F, 1.0F);
+    hitbox_set(lane + HITBOX_LEG_LEFT, leg_model, leg);
 
-    if (hitbox_intersection(matrix_model, &box_head, ray, &dist)) {
-        intersects->head          = 1;
-        intersects->distance.head = dist;
-    }
+    matrix_translate(model, -torso->size[0] * 0.1F * 0.5F + leg->size[0] * 0.1F * 0.5F,
+                     -torso->size[2] * 0.1F * (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.6F : 1.0F),
+                     HASBIT(p->input.keys, INPUT_CROUCH) ? (-torso->size[2] * 0.1F * 0.75F) : 0.0F);
+    matrix_rotate(model, -45.0F * foot_function(p) * a, 1.0F, 0.0F, 0.0F);
+    matrix_rotate(model, -45.0F * foot_function(p) * b, 0.0F, 0.0F, 1.0F);
+    hitbox_set(lane + HITBOX_LEG_RIGHT, model, leg);
 
-    matrix_identity(matrix_model);
-    matrix_translate(matrix_model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
-    matrix_pointAt(matrix_model, ox, 0.0F, oz);
-    matrix_rotate(matrix_model, 90.0F, 0.0F, 1.0F, 0.0F);
+    matrix_identity(model);
+    matrix_translate(model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
+    matrix_translate(model, 0.0F, (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.1F : 0.0F) - 0.1F * 2, 0.0F);
+    matrix_pointAt(model, ox, oy, oz);
+    matrix_rotate(model, 90.0F, 0.0F, 1.0F, 0.0F);
 
-    if (hitbox_intersection(matrix_model, torso, ray, &dist)) {
-        intersects->torso          = 1;
-        intersects->distance.torso = dist;
-    }
+    if (HASBIT(p->input.keys, INPUT_SPRINT) && !HASBIT(p->input.keys, INPUT_CROUCH))
+        matrix_rotate(model, 45.0F, 1.0F, 0.0F, 0.0F);
 
-    matrix_push(matrix_model);
-    matrix_translate(matrix_model, torso->size[0] * 0.1F * 0.5F - leg->size[0] * 0.1F * 0.5F,
-                     -torso->size[2] * 0.1F * (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.6F : 1.0F),
-                     HASBIT(p->input.keys, INPUT_CROUCH) ? (-torso->size[2] * 0.1F * 0.75F) : 0.0F);
-    matrix_rotate(matrix_model, 45.0F * foot_function(p) * a, 1.0F, 0.0F, 0.0F);
-    matrix_rotate(matrix_model, 45.0F * foot_function(p) * b, 0.0F, 0.0F, 1.0F);
+    float * angles = player_tool_func(p);
+    matrix_rotate(model, angles[0], 1.0F, 0.0F, 0.0F);
+    matrix_rotate(model, angles[1], 0.0F, 1.0F, 0.0F);
+    hitbox_set(lane + HITBOX_ARM_LEFT, model, &box_arm_left);
 
-    if (hitbox_intersection(matrix_model, leg, ray, &dist)) {
-        intersects->leg_left          = 1;
-        intersects->distance.leg_left = dist;
-    }
+    matrix_rotate(model, -45.0F, 0.0F, 1.0F, 0.0F);
+    hitbox_set(lane + HITBOX_ARM_RIGHT, model, &box_arm_right);
+}
 
-    matrix_pop(matrix_model);
-    matrix_translate(matrix_model, -torso->size[0] * 0.1F * 0.5F + leg->size[0] * 0.1F * 0.5F,
-                     -torso->size[2] * 0.1F * (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.6F : 1.0F),
-                     HASBIT(p->input.keys, INPUT_CROUCH) ? (-torso->size[2] * 0.1F * 0.75F) : 0.0F);
-    matrix_rotate(matrix_model, -45.0F * foot_function(p) * a, 1.0F, 0.0F, 0.0F);
-    matrix_rotate(matrix_model, -45.0F * foot_function(p) * b, 0.0F, 0.0F, 1.0F);
+static void hitboxes_update() {
+    hitboxes.count = 0;
 
-    if (hitbox_intersection(matrix_model, leg, ray, &dist)) {
-        intersects->leg_right          = 1;
-        intersects->distance.leg_right = dist;
+    for (int k = 0; k < PLAYERS_MAX; k++) {
+        if (players[k].connected && players[k].alive && players[k].team != TEAM_SPECTATOR) {
+            hitboxes_player(players + k, k * HITBOX_LANES);
+            hitboxes.players[hitboxes.count++] = k;
+        }
     }
+}
 
-    matrix_identity(matrix_model);
-    matrix_translate(matrix_model, p->physics.eye.x, p->physics.eye.y + height, p->physics.eye.z);
-    matrix_translate(matrix_model, 0.0F, (HASBIT(p->input.keys, INPUT_CROUCH) ? 0.1F : 0.0F) - 0.1F * 2, 0.0F);
-    matrix_pointAt(matrix_model, ox, oy, oz);
-    matrix_rotate(matrix_model, 90.0F, 0.0F, 1.0F, 0.0F);
+// Slab test of one ray against all lanes of a player, distance is set to FLT_MAX for each hitbox that is missed.
+static void hitboxes_test(int lane, Ray * r, float * distance) {
+#if defined(__SSE2__)
+    for (int k = 0; k < HITBOX_LANES; k += 4) {
+        __m128 o[3], d[3];
+
+        for (int i = 0; i < 3; i++) {
+            __m128 m0 = _mm_loadu_ps(hitboxes.inv[i * 4 + 0] + lane + k);
+            __m128 m1 = _mm_loadu_ps(hitboxes.inv[i * 4 + 1] + lane + k);
+            __m128 m2 = _mm_loadu_ps(hitboxes.inv[i * 4 + 2] + lane + k);
+            __m128 m3 = _mm_loadu_ps(hitboxes.inv[i * 4 + 3] + lane + k);
+
+            d[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(r->direction[X])),
+                                         _mm_mul_ps(m1, _mm_set1_ps(r->direction[Y]))),
+                              _mm_mul_ps(m2, _mm_set1_ps(r->direction[Z])));
+            o[i] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(r->origin[X])),
+                                                    _mm_mul_ps(m1, _mm_set1_ps(r->origin[Y]))),
+                                         _mm_mul_ps(m2, _mm_set1_ps(r->origin[Z]))),
+                              m3);
+        }
 
-    if (HASBIT(p->input.keys, INPUT_SPRINT) && !HASBIT(p->input.keys, INPUT_CROUCH))
-        matrix_rotate(matrix_model, 45.0F, 1.0F, 0.0F, 0.0F);
+        __m128 t_min = _mm_set1_ps(-FLT_MAX);
+        __m128 t_max = _mm_set1_ps(FLT_MAX);
 
-    float * angles = player_tool_func(p);
-    matrix_rotate(matrix_model, angles[0], 1.0F, 0.0F, 0.0F);
-    matrix_rotate(matrix_model, angles[1], 0.0F, 1.0F, 0.0F);
+        for (int i = 0; i < 3; i++) {
+            __m128 inv = _mm_div_ps(_mm_set1_ps(1.0F), d[i]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(hitboxes.min[i] + lane + k), o[i]), inv);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(hitboxes.max[i] + lane + k), o[i]), inv);
 
-    if (hitbox_intersection(matrix_model, &box_arm_left, ray, &dist)) {
-        intersects->arms          = 1;
-        intersects->distance.arms = dist;
+            t_min = _mm_max_ps(t_min, _mm_min_ps(_mm_min_ps(t1, t2), t_max));
+            t_max = _mm_min_ps(t_max, _mm_max_ps(_mm_max_ps(t1, t2), t_min));
+        }
+
+        // the distance is measured in the frame of the hitbox, like the original single box test did
+        __m128 t = _mm_max_ps(t_min, _mm_setzero_ps());
+        __m128 length = _mm_sqrt_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[X], d[X]), _mm_mul_ps(d[Y], d[Y])), _mm_mul_ps(d[Z], d[Z])));
+        __m128 hit = _mm_cmpgt_ps(t_max, t);
+
+        _mm_storeu_ps(distance + k, _mm_or_ps(_mm_and_ps(hit, _mm_mul_ps(t, length)),
+                                              _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX))));
     }
+#else
+    for (int k = lane; k < lane + HITBOX_LANES; k++) {
+        float o[3], d[3];
+
+        for (int i = 0; i < 3; i++) {
+            d[i] = hitboxes.inv[i * 4 + 0][k] * r->direction[X] + hitboxes.inv[i * 4 + 1][k] * r->direction[Y]
+                + hitboxes.inv[i * 4 + 2][k] * r->direction[Z];
+            o[i] = hitboxes.inv[i * 4 + 0][k] * r->origin[X] + hitboxes.inv[i * 4 + 1][k] * r->origin[Y]
+                + hitboxes.inv[i * 4 + 2][k] * r->origin[Z] + hitboxes.inv[i * 4 + 3][k];
+        }
 
-    matrix_rotate(matrix_model, -45.0F, 0.0F, 1.0F, 0.0F);
+        float t_min = -FLT_MAX;
+        float t_max = FLT_MAX;
 
-    if (hitbox_intersection(matrix_model, &box_arm_right, ray, &dist)) {
-        intersects->arms          = 1;
-        intersects->distance.arms = dist;
+        for (int i = 0; i < 3; i++) {
+            float t1 = (hitboxes.min[i][k] - o[i]) / d[i];
+            float t2 = (hitboxes.max[i][k] - o[i]) / d[i];
+
+            t_min = max(t_min, min(min(t1, t2), t_max));
+            t_max = min(t_max, max(max(t1, t2), t_min));
+        }
+
+        float t = max(t_min, 0.0F);
+        distance[k - lane] = (t_max > t) ? t * hypot3f(d[X], d[Y], d[Z]) : FLT_MAX;
     }
+#endif
+}
 
-    matrix_pop(matrix_model);
+void player_collision_many(Ray * rays, size_t count, bool * candidates, PlayerRayHit * hits) {
+    for (size_t k = 0; k < count; k++) {
+        hits[k].player = -1;
+
+        for (int i = 0; i < hitboxes.count; i++) {
+            int id = hitboxes.players[i];
+            if (!candidates[id] || !players[id].alive || players[id].team == TEAM_SPECTATOR)
+                continue;
+
+            float distance[HITBOX_LANES];
+            hitboxes_test(id * HITBOX_LANES, rays + k, distance);
+
+            // a hit on the right arm replaces one on the left arm, on ties the section listed first wins
+            struct {
+                int type;
+                float distance;
+            } sections[] = {
+                {HITTYPE_ARMS,
+                 (distance[HITBOX_ARM_RIGHT] < FLT_MAX) ? distance[HITBOX_ARM_RIGHT] : distance[HITBOX_ARM_LEFT]},
+                {HITTYPE_LEGS, distance[HITBOX_LEG_LEFT]},
+                {HITTYPE_LEGS, distance[HITBOX_LEG_RIGHT]},
+                {HITTYPE_TORSO, distance[HITBOX_TORSO]},
+                {HITTYPE_HEAD, distance[HITBOX_HEAD]},
+            };
+
+            for (size_t j = 0; j < sizeof(sections) / sizeof(*sections); j++) {
+                if (sections[j].distance < hits[k].distance) {
+                    hits[k].player   = id;
+                    hits[k].type     = sections[j].type;
+                    hits[k].distance = sections[j].distance;
+                }
+            }
+        }
+    }
 }
 
 void player_render(Player * p, int id) {
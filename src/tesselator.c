@@ -27,8 +27,9 @@
 
 static size_t vertex_type_size(TesselatorVertexType type) {
     switch (type) {
-        case VERTEX_INT: return sizeof(int16_t);
-        case VERTEX_FLOAT: return sizeof(float);
+        case VERTEX_INT: return sizeof(int16_t) * 3;
+        case VERTEX_FLOAT: return sizeof(float) * 3;
+        case VERTEX_PACKED: return sizeof(TesselatorPackedVertex);
         default: return 0;
     }
 }
@@ -41,33 +42,20 @@ void tesselator_create(Tesselator * t, TesselatorVertexType type, int has_normal
     t->vertex_type = type;
     t->has_normal = has_normal;
 
-#ifdef TESSELATE_QUADS
-    t->vertices = malloc(t->quad_space * vertex_type_size(t->vertex_type) * 3 * 4);
+    t->vertices = malloc(t->quad_space * vertex_type_size(t->vertex_type) * 4);
     CHECK_ALLOCATION_ERROR(t->vertices)
-    t->colors = malloc(t->quad_space * sizeof(uint32_t) * 4);
-    CHECK_ALLOCATION_ERROR(t->colors)
 
-    if (t->has_normal) {
-        t->normals = malloc(t->quad_space * sizeof(int8_t) * 3 * 4);
-        CHECK_ALLOCATION_ERROR(t->normals)
-    } else {
-        t->normals = NULL;
+    if (t->vertex_type != VERTEX_PACKED) {
+        t->colors = malloc(t->quad_space * sizeof(uint32_t) * 4);
+        CHECK_ALLOCATION_ERROR(t->colors)
     }
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-    t->vertices = malloc(t->quad_space * vertex_type_size(t->vertex_type) * 3 * 6);
-    CHECK_ALLOCATION_ERROR(t->vertices)
-    t->colors = malloc(t->quad_space * sizeof(uint32_t) * 6);
-    CHECK_ALLOCATION_ERROR(t->colors)
 
     if (t->has_normal) {
-        t->normals = malloc(t->quad_space * sizeof(int8_t) * 3 * 6);
+        t->normals = malloc(t->quad_space * sizeof(int8_t) * 3 * 4);
         CHECK_ALLOCATION_ERROR(t->normals)
     } else {
         t->normals = NULL;
     }
-#endif
 }
 
 void tesselator_clear(Tesselator * t) {
@@ -91,45 +79,80 @@ void tesselator_free(Tesselator * t) {
     }
 }
 
-void tesselator_draw(Tesselator * t, int with_color) {
-    glEnableClientState(GL_VERTEX_ARRAY);
+// more released tesselators than this are freed, so that a burst of work does not pin memory forever
+#define TESSELATOR_POOL_MAX 256
+
+void tesselator_pool_create(TesselatorPool * p, TesselatorVertexType type, int has_normal) {
+    p->vertex_type = type;
+    p->has_normal = has_normal;
+    p->free_count = 0;
+    p->free_capacity = 16;
+    p->free = malloc(p->free_capacity * sizeof(Tesselator));
+    CHECK_ALLOCATION_ERROR(p->free)
+    pthread_mutex_init(&p->lock, NULL);
+}
 
-    if (t->has_normal) {
-        glEnableClientState(GL_NORMAL_ARRAY);
-        glNormalPointer(GL_BYTE, 0, t->normals);
-    }
+void tesselator_pool_take(TesselatorPool * p, Tesselator * t) {
+    pthread_mutex_lock(&p->lock);
 
-    switch (t->vertex_type) {
-        case VERTEX_INT: glVertexPointer(3, GL_SHORT, 0, t->vertices); break;
-        case VERTEX_FLOAT: glVertexPointer(3, GL_FLOAT, 0, t->vertices); break;
+    if (p->free_count > 0) {
+        *t = p->free[--p->free_count];
+        pthread_mutex_unlock(&p->lock);
+        tesselator_clear(t);
+        return;
     }
 
-    if (with_color) {
-        glEnableClientState(GL_COLOR_ARRAY);
-        glColorPointer(4, GL_UNSIGNED_BYTE, 0, t->colors);
-    }
+    pthread_mutex_unlock(&p->lock);
+    tesselator_create(t, p->vertex_type, p->has_normal);
+}
 
-#ifdef TESSELATE_QUADS
-    glDrawArrays(GL_QUADS, 0, t->quad_count * 4);
-#endif
+void tesselator_pool_release(TesselatorPool * p, Tesselator * t) {
+    assert(t->vertex_type == p->vertex_type && t->has_normal == p->has_normal);
 
-#ifdef TESSELATE_TRIANGLES
-    glDrawArrays(GL_TRIANGLES, 0, t->quad_count * 6);
-#endif
+    pthread_mutex_lock(&p->lock);
 
-    if (with_color) {
-        glDisableClientState(GL_COLOR_ARRAY);
+    if (p->free_count < TESSELATOR_POOL_MAX) {
+        if (p->free_count == p->free_capacity) {
+            p->free_capacity *= 2;
+            p->free = realloc(p->free, p->free_capacity * sizeof(Tesselator));
+            CHECK_ALLOCATION_ERROR(p->free)
+        }
+
+        p->free[p->free_count++] = *t;
+        t->vertices = NULL;
+        t->colors = NULL;
+        t->normals = NULL;
     }
 
-    glDisableClientState(GL_VERTEX_ARRAY);
+    pthread_mutex_unlock(&p->lock);
 
-    if (t->has_normal) {
+    tesselator_free(t);
+}
+
+void tesselator_draw(Tesselator * t, int with_color) {
+    assert(t->vertex_type != VERTEX_PACKED);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    if (t->has_normal)
+        glEnableClientState(GL_NORMAL_ARRAY);
+
+    if (with_color)
+        glEnableClientState(GL_COLOR_ARRAY);
+
+    glx_draw_quads(t->quad_count * 4, (t->vertex_type == VERTEX_INT) ? GLX_DISPLAYLIST_NORMAL : GLX_DISPLAYLIST_ENHANCED,
+                   t->vertices, with_color ? t->colors : NULL, t->has_normal ? t->normals : NULL);
+
+    if (with_color)
+        glDisableClientState(GL_COLOR_ARRAY);
+
+    if (t->has_normal)
         glDisableClientState(GL_NORMAL_ARRAY);
-    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 void tesselator_glx(Tesselator * t, GLXDisplayList * x) {
-#ifdef TESSELATE_QUADS
     switch (t->vertex_type) {
         case VERTEX_INT:
             glx_displaylist_update(x, t->quad_count * 4, GLX_DISPLAYLIST_NORMAL, t->colors, t->vertices, t->normals);
@@ -137,19 +160,10 @@ void tesselator_glx(Tesselator * t, GLXDisplayList * x) {
         case VERTEX_FLOAT:
             glx_displaylist_update(x, t->quad_count * 4, GLX_DISPLAYLIST_ENHANCED, t->colors, t->vertices, t->normals);
             break;
-    }
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-    switch (t->vertex_type) {
-        case VERTEX_INT:
-            glx_displaylist_update(x, t->quad_count * 6, GLX_DISPLAYLIST_NORMAL, t->colors, t->vertices, t->normals);
-            break;
-        case VERTEX_FLOAT:
-            glx_displaylist_update(x, t->quad_count * 6, GLX_DISPLAYLIST_ENHANCED, t->colors, t->vertices, t->normals);
+        case VERTEX_PACKED:
+            glx_displaylist_update(x, t->quad_count * 4, GLX_DISPLAYLIST_PACKED, NULL, t->vertices, NULL);
             break;
     }
-#endif
 }
 
 void tesselator_set_color(Tesselator * t, TrueColor color) {
@@ -166,79 +180,67 @@ static void tesselator_check_space(Tesselator * t) {
     if (t->quad_count >= t->quad_space) {
         t->quad_space *= 2;
 
-#ifdef TESSELATE_QUADS
-        t->vertices = realloc(t->vertices, t->quad_space * vertex_type_size(t->vertex_type) * 3 * 4);
+        t->vertices = realloc(t->vertices, t->quad_space * vertex_type_size(t->vertex_type) * 4);
         CHECK_ALLOCATION_ERROR(t->vertices)
-        t->colors = realloc(t->colors, t->quad_space * sizeof(uint32_t) * 4);
-        CHECK_ALLOCATION_ERROR(t->colors)
 
-        if (t->has_normal) {
-            t->normals = realloc(t->normals, t->quad_space * sizeof(int8_t) * 3 * 4);
-            CHECK_ALLOCATION_ERROR(t->normals)
+        if (t->vertex_type != VERTEX_PACKED) {
+            t->colors = realloc(t->colors, t->quad_space * sizeof(uint32_t) * 4);
+            CHECK_ALLOCATION_ERROR(t->colors)
         }
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-        t->vertices = realloc(t->vertices, t->quad_space * vertex_type_size(t->vertex_type) * 3 * 6);
-        CHECK_ALLOCATION_ERROR(t->vertices)
-        t->colors = realloc(t->colors, t->quad_space * sizeof(uint32_t) * 6);
-        CHECK_ALLOCATION_ERROR(t->colors)
 
         if (t->has_normal) {
-            t->normals = realloc(t->normals, t->quad_space * sizeof(int8_t) * 3 * 6);
+            t->normals = realloc(t->normals, t->quad_space * sizeof(int8_t) * 3 * 4);
             CHECK_ALLOCATION_ERROR(t->normals)
         }
-#endif
     }
 }
 
 static void tesselator_emit_color(Tesselator * t, TrueColor * colors) {
-#ifdef TESSELATE_QUADS
     uint32_t * dest = t->colors + t->quad_count * 4;
 
     writeRGBA(dest + 0, colors[0]);
     writeRGBA(dest + 1, colors[1]);
     writeRGBA(dest + 2, colors[2]);
     writeRGBA(dest + 3, colors[3]);
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-    memcpy(t->colors + t->quad_count * 6, colors, sizeof(uint32_t) * 3);
-    t->colors[t->quad_count * 6 + 3] = colors[0];
-    memcpy(t->colors + t->quad_count * 6 + 4, colors + 2, sizeof(uint32_t) * 2);
-#endif
 }
 
 static void tesselator_emit_normals(Tesselator * t, int8_t * normals) {
     if (t->has_normal) {
-#ifdef TESSELATE_QUADS
         memcpy(t->normals + t->quad_count * 3 * 4, normals, sizeof(int8_t) * 3 * 4);
-#endif
+    }
+}
 
-#ifdef TESSELATE_TRIANGLES
-        memcpy(t->normals + t->quad_count * 3 * 6 + 3 * 0, normals, sizeof(int8_t) * 3 * 3);
-        memcpy(t->normals + t->quad_count * 3 * 6 + 3 * 3, normals + 3 * 0, sizeof(int8_t) * 3);
-        memcpy(t->normals + t->quad_count * 3 * 6 + 3 * 4, normals + 3 * 2, sizeof(int8_t) * 3 * 2);
-#endif
+static void tesselator_emit_packed(Tesselator * t, int16_t * coords, TrueColor * colors) {
+    TesselatorPackedVertex * dest = ((TesselatorPackedVertex*)t->vertices) + t->quad_count * 4;
+
+    for (int k = 0; k < 4; k++) {
+        dest[k] = (TesselatorPackedVertex) {
+            .x = coords[k * 3 + 0],
+            .y = coords[k * 3 + 1],
+            .z = coords[k * 3 + 2],
+            .r = colors[k].r,
+            .g = colors[k].g,
+            .b = colors[k].b,
+        };
     }
+
+    t->quad_count++;
 }
 
 void tesselator_addi(Tesselator * t, int16_t * coords, TrueColor * colors, int8_t * normals) {
-    assert(t->vertex_type == VERTEX_INT);
+    assert(t->vertex_type == VERTEX_INT || t->vertex_type == VERTEX_PACKED);
 
     tesselator_check_space(t);
+
+    if (t->vertex_type == VERTEX_PACKED) {
+        tesselator_emit_packed(t, coords, colors);
+        return;
+    }
+
     tesselator_emit_color(t, colors);
     tesselator_emit_normals(t, normals);
 
-#ifdef TESSELATE_QUADS
     memcpy(((int16_t*)t->vertices) + t->quad_count * 3 * 4, coords, sizeof(int16_t) * 3 * 4);
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-    memcpy(((int16_t*)t->vertices) + t->quad_count * 3 * 6 + 3 * 0, coords, sizeof(int16_t) * 3 * 3);
-    memcpy(((int16_t*)t->vertices) + t->quad_count * 3 * 6 + 3 * 3, coords + 3 * 0, sizeof(int16_t) * 3);
-    memcpy(((int16_t*)t->vertices) + t->quad_count * 3 * 6 + 3 * 4, coords + 3 * 2, sizeof(int16_t) * 3 * 2);
-#endif
 
     t->quad_count++;
 }
@@ -250,15 +252,7 @@ void tesselator_addf(Tesselator * t, float * coords, TrueColor * colors, int8_t
     tesselator_emit_color(t, colors);
     tesselator_emit_normals(t, normals);
 
-#ifdef TESSELATE_QUADS
     memcpy(((float*)t->vertices) + t->quad_count * 3 * 4, coords, sizeof(float) * 3 * 4);
-#endif
-
-#ifdef TESSELATE_TRIANGLES
-    memcpy(((float*)t->vertices) + t->quad_count * 3 * 6 + 3 * 0, coords, sizeof(float) * 3 * 3);
-    memcpy(((float*)t->vertices) + t->quad_count * 3 * 6 + 3 * 3, coords + 3 * 0, sizeof(float) * 3);
-    memcpy(((float*)t->vertices) + t->quad_count * 3 * 6 + 3 * 4, coords + 3 * 2, sizeof(float) * 3 * 2);
-#endif
 
     t->quad_count++;
 }
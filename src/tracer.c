@@ -98,14 +98,29 @@ void tracer_add(int type, float x, float y, float z, float dx, float dy, float d
     entitysys_add(&tracers, &t);
 }
 
-static bool tracer_render_single(void * obj, void * user) {
+static enum kv6 model_tracer[] = {
+    [WEAPON_RIFLE]   = MODEL_SEMI_TRACER,
+    [WEAPON_SMG]     = MODEL_SMG_TRACER,
+    [WEAPON_SHOTGUN] = MODEL_SHOTGUN_TRACER
+};
+
+static CameraBoxes tracer_bounds;
+
+static void tracer_box(void * obj, float * bounds) {
     Tracer * t = (Tracer *) obj;
 
-    static enum kv6 model_tracer[] = {
-        [WEAPON_RIFLE]   = MODEL_SEMI_TRACER,
-        [WEAPON_SMG]     = MODEL_SMG_TRACER,
-        [WEAPON_SHOTGUN] = MODEL_SHOTGUN_TRACER
-    };
+    // the model is rotated around its pivot at the origin
+    float radius = kv6_radius(&model[model_tracer[t->type]]);
+    bounds[0] = t->r.origin[X] - radius;
+    bounds[1] = t->r.origin[Y] - radius;
+    bounds[2] = t->r.origin[Z] - radius;
+    bounds[3] = t->r.origin[X] + radius;
+    bounds[4] = t->r.origin[Y] + radius;
+    bounds[5] = t->r.origin[Z] + radius;
+}
+
+static bool tracer_render_single(void * obj, void * user) {
+    Tracer * t = (Tracer *) obj;
 
     matrix_push(matrix_model);
     matrix_translate(matrix_model, t->r.origin[X], t->r.origin[Y], t->r.origin[Z]);
@@ -119,7 +134,8 @@ static bool tracer_render_single(void * obj, void * user) {
 }
 
 void tracer_render() {
-    entitysys_iterate(&tracers, NULL, tracer_render_single);
+    camera_boxes_collect(&tracer_bounds, &tracers, tracer_box);
+    camera_boxes_iterate(&tracer_bounds, &tracers, NULL, tracer_render_single);
 }
 
 static bool tracer_update_single(void * obj, void * user) {
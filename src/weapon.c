@@ -255,7 +255,11 @@ void weapon_shoot() {
     // https://pastebin.com/raw/TMjKSTXG
     // http://paste.quacknet.org/view/a3ea2743
 
-    for (int i = 0; i < WEAPON_ROUNDS(players[local_player.id].weapon); i++) {
+    int rounds = WEAPON_ROUNDS(players[local_player.id].weapon);
+    Vector3f pellets[WEAPON_ROUNDS(WEAPON_SHOTGUN)];
+    CameraHit hits[WEAPON_ROUNDS(WEAPON_SHOTGUN)];
+
+    for (int i = 0; i < rounds; i++) {
         float o[3] = {
             players[local_player.id].orientation.x,
             players[local_player.id].orientation.y,
@@ -263,14 +267,20 @@ void weapon_shoot() {
         };
 
         weapon_spread(&players[local_player.id], o);
+        pellets[i] = (Vector3f) {o[X], o[Y], o[Z]};
+    }
 
-        CameraHit hit;
-        camera_hit(&hit, local_player.id,
-            players[local_player.id].physics.eye.x,
-            players[local_player.id].physics.eye.y + player_height(&players[local_player.id]),
-            players[local_player.id].physics.eye.z,
-            o[X], o[Y], o[Z], 128.0F
-        );
+    // all pellets are traced through the map together
+    camera_hit_many(hits, rounds, local_player.id,
+        players[local_player.id].physics.eye.x,
+        players[local_player.id].physics.eye.y + player_height(&players[local_player.id]),
+        players[local_player.id].physics.eye.z,
+        pellets, 128.0F
+    );
+
+    for (int i = 0; i < rounds; i++) {
+        float o[3] = {pellets[i].x, pellets[i].y, pellets[i].z};
+        CameraHit hit = hits[i];
 
         #if !(HACKS_ENABLED && HACK_NORELOAD)
         if (players[local_player.id].input.buttons != network_buttons_last) {
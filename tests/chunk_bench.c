@@ -0,0 +1,184 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Reports how many chunks per second each mesher builds, including the expansion of a chunk copy into the dense
+// voxel cache they all read from. For several render distances it also counts the triangles in range of a
+// camera in the middle of the map, with and without coarse meshes for distant chunks. Pass a .vxl file to
+// measure a real map, a generated one is used otherwise.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/config.h>
+#include <BetterSpades/tesselator.h>
+#include <BetterSpades/chunk.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define BENCH_PASSES 3
+
+enum bench_mesher {
+    BENCH_EXPAND,
+    BENCH_NAIVE,
+    BENCH_NAIVE_AO,
+    BENCH_GREEDY,
+    BENCH_BITMASK,
+    BENCH_LOD_2,
+    BENCH_LOD_4,
+};
+
+// chunk_quads receives the quads of each chunk if not NULL
+static void bench_run(struct libvxl_map * map, enum bench_mesher mesher, const char * name, size_t * chunk_quads) {
+    struct libvxl_chunk_copy copy = {0};
+    ChunkVoxels * voxels = malloc(sizeof(ChunkVoxels));
+    CHECK_ALLOCATION_ERROR(voxels)
+
+    double elapsed = 0.0;
+    size_t chunks = 0, quads = 0;
+
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+        for (size_t z = 0; z < map->height; z += CHUNK_SIZE) {
+            for (size_t x = 0; x < map->width; x += CHUNK_SIZE) {
+                Tesselator tess[CHUNK_SECTIONS];
+                int max_height = 0;
+
+                for (int s = 0; s < CHUNK_SECTIONS; s++)
+                    tesselator_create(tess + s, VERTEX_INT, 0);
+
+                // the copy is taken under the map lock in the game, so it is not part of the measurement
+                libvxl_copy_chunk(map, &copy, x, z, CHUNK_HALO, CHUNK_HALO_SUNBLOCK);
+
+                double start = test_time();
+                chunk_voxels_expand(voxels, &copy, x, z);
+
+                switch (mesher) {
+                    case BENCH_EXPAND: break;
+                    case BENCH_NAIVE:
+                    case BENCH_NAIVE_AO:
+                        chunk_generate_naive(voxels, tess, CHUNK_SECTIONS_ALL, &max_height, mesher == BENCH_NAIVE_AO);
+                        break;
+                    case BENCH_GREEDY:
+                        chunk_generate_greedy(voxels, x, z, tess, CHUNK_SECTIONS_ALL, &max_height);
+                        break;
+                    case BENCH_BITMASK:
+                        chunk_generate_bitmask(voxels, x, z, tess, CHUNK_SECTIONS_ALL, &max_height);
+                        break;
+                    case BENCH_LOD_2:
+                    case BENCH_LOD_4: chunk_generate_lod(voxels, tess, mesher == BENCH_LOD_2 ? 2 : 4); break;
+                }
+
+                elapsed += test_time() - start;
+                chunks++;
+
+                size_t count = 0;
+                for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                    count += tess[s].quad_count;
+                    tesselator_free(tess + s);
+                }
+
+                quads += count;
+                if (chunk_quads)
+                    chunk_quads[x / CHUNK_SIZE + z / CHUNK_SIZE * (map->width / CHUNK_SIZE)] = count;
+            }
+        }
+    }
+
+    printf("%-12s %10.0f chunks/s %8.1f us/chunk %10zu quads\n", name, chunks / elapsed, elapsed / chunks * 1e6,
+           quads / BENCH_PASSES);
+
+    libvxl_copy_chunk_destroy(&copy);
+    free(voxels);
+}
+
+// triangles of all chunk copies in range, like they are chosen for drawing but without any culling
+static void bench_lod(struct libvxl_map * map, size_t * quads[CHUNK_LODS + 1], int render_distance) {
+    int chunks_x = map->width / CHUNK_SIZE, chunks_z = map->height / CHUNK_SIZE;
+    float camera_x = map->width / 2.0F, camera_z = map->height / 2.0F;
+    int overshoot = (render_distance + CHUNK_SIZE - 1) / CHUNK_SIZE + 1;
+    size_t triangles[2] = {0, 0};
+
+    settings.render_distance = render_distance;
+
+    for (int z = -overshoot; z < chunks_z + overshoot; z++) {
+        for (int x = -overshoot; x < chunks_x + overshoot; x++) {
+            float distance = hypotf((x + 0.5F) * CHUNK_SIZE - camera_x, (z + 0.5F) * CHUNK_SIZE - camera_z);
+
+            if (distance <= render_distance + 1.414F * CHUNK_SIZE) {
+                int chunk = (x + chunks_x) % chunks_x + (z + chunks_z) % chunks_z * chunks_x;
+
+                for (int lod = 0; lod <= 1; lod++) {
+                    settings.chunk_lod = lod;
+                    triangles[lod] += quads[chunk_lod_level(distance, 0)][chunk] * 2;
+                }
+            }
+        }
+    }
+
+    printf("distance %3i %10zu triangles %10zu with lod (%.0f%%)\n", render_distance, triangles[0], triangles[1],
+           100.0F * triangles[1] / max(triangles[0], 1));
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map map;
+
+    if (!test_map_create(&map, argc > 1 ? argv[1] : NULL)) {
+        fprintf(stderr, "could not load map %s\n", argv[1]);
+        return 1;
+    }
+
+    printf("map %s\n", argc > 1 ? argv[1] : "generated");
+
+    for (int shadows = 0; shadows <= 1; shadows++) {
+        settings.enable_shadows = shadows;
+        printf("shadows %s\n", shadows ? "on" : "off");
+
+        bench_run(&map, BENCH_EXPAND, "expand", NULL);
+        bench_run(&map, BENCH_NAIVE, "naive", NULL);
+        bench_run(&map, BENCH_NAIVE_AO, "naive+ao", NULL);
+        bench_run(&map, BENCH_GREEDY, "greedy", NULL);
+        bench_run(&map, BENCH_BITMASK, "bitmask", NULL);
+    }
+
+    size_t count = (map.width / CHUNK_SIZE) * (map.height / CHUNK_SIZE);
+    size_t * quads[CHUNK_LODS + 1];
+    for (int l = 0; l <= CHUNK_LODS; l++) {
+        quads[l] = malloc(count * sizeof(size_t));
+        CHECK_ALLOCATION_ERROR(quads[l])
+    }
+
+    printf("coarse meshes\n");
+    settings.enable_shadows = 0;
+    bench_run(&map, BENCH_BITMASK, "bitmask", quads[0]);
+    bench_run(&map, BENCH_LOD_2, "lod 2x", quads[1]);
+    bench_run(&map, BENCH_LOD_4, "lod 4x", quads[2]);
+
+    for (int distance = 64; distance <= 256; distance += 64)
+        bench_lod(&map, quads, distance);
+
+    for (int l = 0; l <= CHUNK_LODS; l++)
+        free(quads[l]);
+
+    libvxl_free(&map);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Meshes every chunk of a generated map with both the greedy and the bitmask mesher and checks that they produce
+// the same set of quads, section by section. Meshing only some of the sections must give the same quads as
+// meshing all of them at once. Lower detail meshes must cover their chunk borders wherever the neighbouring
+// terrain is not solid, so that there are no cracks between chunks.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/config.h>
+#include <BetterSpades/tesselator.h>
+#include <BetterSpades/chunk.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define MAP_SIZE 128
+
+typedef struct {
+    int16_t vertices[12];
+    uint32_t colors[4];
+} Quad;
+
+typedef void (*Mesher)(ChunkVoxels *, size_t, size_t, Tesselator *, uint8_t, int *);
+
+static int quad_compare(const void * a, const void * b) {
+    return memcmp(a, b, sizeof(Quad));
+}
+
+static Quad * quads_sorted(Tesselator * tess) {
+    Quad * quads = malloc(max(tess->quad_count, 1) * sizeof(Quad));
+    CHECK_ALLOCATION_ERROR(quads)
+
+    for (size_t k = 0; k < tess->quad_count; k++) {
+        memcpy(quads[k].vertices, (int16_t *)tess->vertices + k * 12, sizeof(quads[k].vertices));
+        memcpy(quads[k].colors, tess->colors + k * 4, sizeof(quads[k].colors));
+    }
+
+    qsort(quads, tess->quad_count, sizeof(Quad), quad_compare);
+    return quads;
+}
+
+static bool quads_equal(Tesselator * a, Tesselator * b) {
+    if (a->quad_count != b->quad_count)
+        return false;
+
+    Quad * qa = quads_sorted(a);
+    Quad * qb = quads_sorted(b);
+    bool equal = !memcmp(qa, qb, a->quad_count * sizeof(Quad));
+    free(qa);
+    free(qb);
+    return equal;
+}
+
+static void mesh(Mesher mesher, ChunkVoxels * voxels, size_t x, size_t z, uint8_t sections, Tesselator * tess,
+                 int * max_height) {
+    for (int s = 0; s < CHUNK_SECTIONS; s++)
+        tesselator_create(tess + s, VERTEX_INT, 0);
+
+    *max_height = 0;
+    mesher(voxels, x, z, tess, sections, max_height);
+}
+
+static void mesh_free(Tesselator * tess) {
+    for (int s = 0; s < CHUNK_SECTIONS; s++)
+        tesselator_free(tess + s);
+}
+
+static bool voxel_solid(ChunkVoxels * voxels, int x, int y, int z) {
+    return voxels->solid[CHUNK_VOXELS_Y * ((x + CHUNK_HALO) + CHUNK_VOXELS_X * (z + CHUNK_HALO + CHUNK_HALO_SUNBLOCK))
+                         + y + 1];
+}
+
+// any block of the cell solid, or all of them if the cell is part of the halo
+static bool lod_cell_solid(ChunkVoxels * voxels, int x, int y, int z, int scale, bool halo) {
+    for (int k = 0; k < scale * scale * scale; k++) {
+        int bx = halo && x < 0 ? -1 : (halo && x >= CHUNK_SIZE ? CHUNK_SIZE : x + k % scale);
+        int bz = halo && z < 0 ? -1 : (halo && z >= CHUNK_SIZE ? CHUNK_SIZE : z + k / scale / scale);
+
+        if (voxel_solid(voxels, bx, y + k / scale % scale, bz) != halo)
+            return !halo;
+    }
+
+    return halo;
+}
+
+// compares the faces of a lower detail mesh on the four chunk borders with those expected from the voxels
+static int lod_check_borders(ChunkVoxels * voxels, Tesselator * tess, int scale) {
+    int size = CHUNK_SIZE / scale;
+    int height = CHUNK_HEIGHT / scale;
+    // -x, +x, -z, +z
+    bool covered[4][height][size];
+    memset(covered, 0, sizeof(covered));
+
+    for (size_t k = 0; k < tess->quad_count; k++) {
+        int16_t * v = (int16_t *)tess->vertices + k * 12;
+        int low[3], high[3];
+
+        for (int a = 0; a < 3; a++) {
+            low[a] = min(min(v[a], v[a + 3]), min(v[a + 6], v[a + 9]));
+            high[a] = max(max(v[a], v[a + 3]), max(v[a + 6], v[a + 9]));
+        }
+
+        int side = -1, along = 0;
+        if (low[0] == high[0] && (low[0] == voxels->x || low[0] == voxels->x + CHUNK_SIZE)) {
+            side = low[0] != voxels->x;
+            along = 2;
+        } else if (low[2] == high[2] && (low[2] == voxels->z || low[2] == voxels->z + CHUNK_SIZE)) {
+            side = 2 + (low[2] != voxels->z);
+            along = 0;
+        }
+
+        if (side < 0)
+            continue;
+
+        int start = along ? voxels->z : voxels->x;
+        for (int y = low[1]; y < high[1]; y += scale)
+            for (int b = low[along]; b < high[along]; b += scale)
+                covered[side][y / scale][(b - start) / scale] = true;
+    }
+
+    int failures = 0;
+
+    for (int side = 0; side < 4; side++) {
+        for (int y = 0; y < height; y++) {
+            for (int b = 0; b < size; b++) {
+                int x = side < 2 ? (side == 0 ? 0 : CHUNK_SIZE - scale) : b * scale;
+                int z = side < 2 ? b * scale : (side == 2 ? 0 : CHUNK_SIZE - scale);
+                int nx = side < 2 ? (side == 0 ? -1 : CHUNK_SIZE) : x;
+                int nz = side < 2 ? z : (side == 2 ? -1 : CHUNK_SIZE);
+
+                bool expected = lod_cell_solid(voxels, x, y * scale, z, scale, false)
+                    && !lod_cell_solid(voxels, nx, y * scale, nz, scale, true);
+
+                if (covered[side][y][b] != expected) {
+                    printf("chunk %i,%i lod %i side %i cell %i,%i: face %s\n", voxels->x, voxels->z, scale, side, b,
+                           y, expected ? "missing" : "not expected");
+                    failures++;
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map map;
+    test_map_generate(&map, MAP_SIZE);
+
+    struct libvxl_chunk_copy copy = {0};
+    ChunkVoxels * voxels = malloc(sizeof(ChunkVoxels));
+    CHECK_ALLOCATION_ERROR(voxels)
+
+    int failures = 0;
+    size_t quads = 0;
+
+    for (int shadows = 0; shadows <= 1; shadows++) {
+        settings.enable_shadows = shadows;
+
+        for (size_t z = 0; z < MAP_SIZE; z += CHUNK_SIZE) {
+            for (size_t x = 0; x < MAP_SIZE; x += CHUNK_SIZE) {
+                libvxl_copy_chunk(&map, &copy, x, z, CHUNK_HALO, CHUNK_HALO_SUNBLOCK);
+                chunk_voxels_expand(voxels, &copy, x, z);
+
+                Tesselator greedy[CHUNK_SECTIONS], bitmask[CHUNK_SECTIONS];
+                int greedy_height, bitmask_height;
+                mesh(chunk_generate_greedy, voxels, x, z, CHUNK_SECTIONS_ALL, greedy, &greedy_height);
+                mesh(chunk_generate_bitmask, voxels, x, z, CHUNK_SECTIONS_ALL, bitmask, &bitmask_height);
+
+                if (greedy_height != bitmask_height) {
+                    printf("chunk %zu,%zu shadows=%i: max height %i (greedy) != %i (bitmask)\n", x, z, shadows,
+                           greedy_height, bitmask_height);
+                    failures++;
+                }
+
+                for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                    quads += greedy[s].quad_count;
+
+                    if (!quads_equal(greedy + s, bitmask + s)) {
+                        printf("chunk %zu,%zu section %i shadows=%i: %u quads (greedy) != %u quads (bitmask)\n", x,
+                               z, s, shadows, greedy[s].quad_count, bitmask[s].quad_count);
+                        failures++;
+                    }
+                }
+
+                // a single section and every pair of neighbouring ones, which share merge breaks
+                for (uint8_t sections = 1; sections < CHUNK_SECTIONS_ALL; sections++) {
+                    if (__builtin_popcount(sections) > 2)
+                        continue;
+
+                    Tesselator single[CHUNK_SECTIONS];
+                    int height;
+
+                    mesh(chunk_generate_bitmask, voxels, x, z, sections, single, &height);
+                    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                        if ((sections & (1 << s)) && !quads_equal(single + s, bitmask + s)) {
+                            printf("chunk %zu,%zu section %i of mask %i shadows=%i: bitmask differs from all "
+                                   "sections\n",
+                                   x, z, s, sections, shadows);
+                            failures++;
+                        }
+                    }
+                    mesh_free(single);
+
+                    mesh(chunk_generate_greedy, voxels, x, z, sections, single, &height);
+                    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+                        if ((sections & (1 << s)) && !quads_equal(single + s, greedy + s)) {
+                            printf("chunk %zu,%zu section %i of mask %i shadows=%i: greedy differs from all "
+                                   "sections\n",
+                                   x, z, s, sections, shadows);
+                            failures++;
+                        }
+                    }
+                    mesh_free(single);
+                }
+
+                mesh_free(greedy);
+                mesh_free(bitmask);
+
+                if (!shadows) {
+                    for (int l = 0; l < CHUNK_LODS; l++) {
+                        Tesselator lod;
+                        tesselator_create(&lod, VERTEX_INT, 0);
+                        chunk_generate_lod(voxels, &lod, 2 << l);
+                        failures += lod_check_borders(voxels, &lod, 2 << l);
+                        tesselator_free(&lod);
+                    }
+                }
+            }
+        }
+    }
+
+    libvxl_copy_chunk_destroy(&copy);
+    libvxl_free(&map);
+    free(voxels);
+
+    printf("chunk_mesh: %zu quads compared, %i mismatches\n", quads, failures);
+    return failures > 0;
+}
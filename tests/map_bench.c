@@ -0,0 +1,221 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Reports how many voxel queries per second threads get through, alone and while another thread keeps
+// changing the map with map_set(), and how long random rays over the map take. Pass a .vxl file to measure a
+// real map, a generated one is used otherwise.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/map.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define BENCH_DURATION 0.5
+#define BENCH_BATCH 64
+#define BENCH_READERS_MAX 16
+#define BENCH_RAYS 200000
+#define BENCH_RAY_LENGTH 128.0F
+// pellets of a shotgun shot
+#define BENCH_RAY_BATCH 8
+
+typedef struct {
+    pthread_t thread;
+    bool batched;
+    uint32_t random;
+    size_t queries;
+    size_t air;
+} BenchReader;
+
+static bool bench_running;
+
+static Vector3i bench_position(uint32_t * random) {
+    return (Vector3i) {
+        .x = test_random(random) % map_size_x,
+        .y = test_random(random) % map_size_y,
+        .z = test_random(random) % map_size_z,
+    };
+}
+
+static void * bench_reader(void * user) {
+    BenchReader * reader = (BenchReader *) user;
+    Vector3i pos[BENCH_BATCH];
+    bool air[BENCH_BATCH];
+
+    while (__atomic_load_n(&bench_running, __ATOMIC_RELAXED)) {
+        for (int k = 0; k < BENCH_BATCH; k++)
+            pos[k] = bench_position(&reader->random);
+
+        if (reader->batched) {
+            map_isair_many(pos, air, BENCH_BATCH);
+        } else {
+            for (int k = 0; k < BENCH_BATCH; k++)
+                air[k] = map_isair(pos[k].x, pos[k].y, pos[k].z);
+        }
+
+        for (int k = 0; k < BENCH_BATCH; k++)
+            reader->air += air[k];
+
+        reader->queries += BENCH_BATCH;
+    }
+
+    return NULL;
+}
+
+// places and removes blocks at random, on top of the terrain where they do not detach anything
+static void * bench_writer(void * user) {
+    size_t * edits = (size_t *) user;
+    uint32_t random = 0x9E3779B9;
+
+    while (__atomic_load_n(&bench_running, __ATOMIC_RELAXED)) {
+        Vector3i pos = bench_position(&random);
+        pos.y = min(map_height_at(pos.x, pos.z) + 1, map_size_y - 1);
+
+        map_set(pos.x, pos.y, pos.z, (TrueColor) {0x80, 0x60, 0x40, 255});
+        map_set(pos.x, pos.y, pos.z, White);
+        *edits += 2;
+    }
+
+    return NULL;
+}
+
+static void bench_run(int readers, bool batched, bool writing) {
+    BenchReader reader[BENCH_READERS_MAX];
+    pthread_t writer;
+    size_t edits = 0;
+
+    __atomic_store_n(&bench_running, true, __ATOMIC_RELAXED);
+
+    for (int k = 0; k < readers; k++) {
+        reader[k] = (BenchReader) {.batched = batched, .random = 0x2545F491 + k};
+        pthread_create(&reader[k].thread, NULL, bench_reader, reader + k);
+    }
+
+    if (writing)
+        pthread_create(&writer, NULL, bench_writer, &edits);
+
+    double start = test_time();
+    usleep(BENCH_DURATION * 1e6);
+    __atomic_store_n(&bench_running, false, __ATOMIC_RELAXED);
+
+    size_t queries = 0;
+    for (int k = 0; k < readers; k++) {
+        pthread_join(reader[k].thread, NULL);
+        queries += reader[k].queries;
+    }
+
+    if (writing)
+        pthread_join(writer, NULL);
+
+    double elapsed = test_time() - start;
+
+    printf("%2i readers %-8s %8.1f M queries/s", readers, batched ? "batched" : "single", queries / elapsed * 1e-6);
+    if (writing)
+        printf(" %8.0f edits/s", edits / elapsed);
+    printf("\n");
+}
+
+static Vector3f bench_direction(uint32_t * random) {
+    float y = (test_random(random) % 2001) / 1000.0F - 1.0F;
+    float angle = (test_random(random) % 6284) / 1000.0F;
+    float r = sqrtf(1.0F - y * y);
+    return (Vector3f) {r * cosf(angle), y, r * sinf(angle)};
+}
+
+// rays start at eye height above the terrain or anywhere, also inside of it
+static void bench_raycast(bool eye_height, bool batched) {
+    uint32_t random = 0x2545F491;
+    Vector3f directions[BENCH_RAY_BATCH];
+    MapRayHit hits[BENCH_RAY_BATCH];
+    bool found[BENCH_RAY_BATCH];
+    size_t hit_count = 0;
+    double elapsed = 0;
+
+    for (int k = 0; k < BENCH_RAYS; k += BENCH_RAY_BATCH) {
+        Vector3i pos = bench_position(&random);
+        Vector3f origin = {pos.x + 0.5F, pos.y + 0.5F, pos.z + 0.5F};
+
+        if (eye_height)
+            origin.y = min(map_height_at(pos.x, pos.z) + 2.5F, map_size_y - 0.5F);
+
+        for (int i = 0; i < BENCH_RAY_BATCH; i++)
+            directions[i] = bench_direction(&random);
+
+        double start = test_time();
+        if (batched) {
+            map_raycast_many(origin, directions, BENCH_RAY_BATCH, BENCH_RAY_LENGTH, false, hits, found);
+        } else {
+            for (int i = 0; i < BENCH_RAY_BATCH; i++)
+                found[i] = map_raycast(origin.x, origin.y, origin.z, directions[i].x, directions[i].y,
+                                       directions[i].z, BENCH_RAY_LENGTH, false, hits + i);
+        }
+        elapsed += test_time() - start;
+
+        for (int i = 0; i < BENCH_RAY_BATCH; i++)
+            hit_count += found[i];
+    }
+
+    printf("rays %-10s %-8s %8.0f ns/ray %5.1f%% hit\n", eye_height ? "eye height" : "anywhere",
+           batched ? "batched" : "single", elapsed / BENCH_RAYS * 1e9, hit_count * 100.0 / BENCH_RAYS);
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map source;
+
+    if (!test_map_create(&source, argc > 1 ? argv[1] : NULL)) {
+        fprintf(stderr, "could not load map %s\n", argv[1]);
+        return 1;
+    }
+
+    map_init();
+
+    size_t size;
+    uint8_t * data = test_map_encode(&source, &size);
+    map_vxl_load(data, size);
+    free(data);
+    libvxl_free(&source);
+
+    printf("map %s\n", argc > 1 ? argv[1] : "generated");
+
+    int cores = clamp(1, BENCH_READERS_MAX, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int writing = 0; writing <= 1; writing++) {
+        printf("%s\n", writing ? "while writing" : "read only");
+
+        for (int readers = 1; readers <= cores; readers *= 2) {
+            bench_run(readers, false, writing);
+            bench_run(readers, true, writing);
+        }
+    }
+
+    for (int eye_height = 1; eye_height >= 0; eye_height--) {
+        bench_raycast(eye_height, false);
+        bench_raycast(eye_height, true);
+    }
+
+    return 0;
+}
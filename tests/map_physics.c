@@ -0,0 +1,313 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Replays a session of digging, grenades, bridges and buildings that later get undermined. After every edit it checks
+// that the falling blocks workers detach exactly the structures a voxel by voxel flood fill finds, the search that was
+// used before ground connectivity was decided over runs of solid voxels. Reports the time both took.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/map.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define REPLAY_EVENTS 4000
+#define REPLAY_PILLARS 256
+#define REPLAY_MARGIN 16
+
+typedef struct {
+    Vector3i * voxels;
+    size_t count, length;
+} VoxelList;
+
+static struct libvxl_map reference;
+static uint8_t * reference_visited;
+static VoxelList reference_buckets[64], reference_fill_list;
+
+static void voxel_list_add(VoxelList * list, Vector3i v) {
+    if (list->count >= list->length) {
+        list->length = max(list->length * 2, 64);
+        list->voxels = realloc(list->voxels, list->length * sizeof(Vector3i));
+        CHECK_ALLOCATION_ERROR(list->voxels)
+    }
+
+    list->voxels[list->count++] = v;
+}
+
+static bool reference_solid(int x, int y, int z) {
+    return libvxl_map_issolid(&reference, x, z, map_size_y - 1 - y);
+}
+
+static size_t reference_index(Vector3i v) {
+    return (size_t)v.y + (v.x + (size_t)v.z * map_size_x) * map_size_y;
+}
+
+static bool reference_visit(Vector3i v) {
+    size_t index = reference_index(v);
+
+    if (reference_visited[index / 8] & (1 << (index % 8)))
+        return false;
+
+    reference_visited[index / 8] |= 1 << (index % 8);
+    voxel_list_add(&reference_fill_list, v);
+    voxel_list_add(reference_buckets + v.y, v);
+    return true;
+}
+
+// Flood fill from the lowest voxel found so far until the ground layers are reached, removes the voxels from the
+// reference map if they are not. Returns the number of voxels removed.
+static size_t reference_fill(Vector3i seed) {
+    if (seed.y <= 1 || !reference_solid(seed.x, seed.y, seed.z))
+        return 0;
+
+    reference_fill_list.count = 0;
+    reference_visit(seed);
+
+    int lowest = seed.y;
+    bool grounded = false;
+
+    while (!grounded) {
+        while (lowest < 64 && !reference_buckets[lowest].count)
+            lowest++;
+
+        if (lowest == 64)
+            break;
+
+        Vector3i current = reference_buckets[lowest].voxels[--reference_buckets[lowest].count];
+        Vector3i neighbours[6] = {
+            {current.x + 1, current.y, current.z}, {current.x - 1, current.y, current.z},
+            {current.x, current.y + 1, current.z}, {current.x, current.y - 1, current.z},
+            {current.x, current.y, current.z + 1}, {current.x, current.y, current.z - 1},
+        };
+
+        for (int k = 0; k < 6 && !grounded; k++) {
+            Vector3i * n = neighbours + k;
+
+            if (n->x < 0 || n->z < 0 || n->x >= map_size_x || n->z >= map_size_z || n->y >= map_size_y
+               || !reference_solid(n->x, n->y, n->z))
+                continue;
+
+            if (n->y <= 1) {
+                grounded = true;
+            } else if (reference_visit(*n)) {
+                lowest = min(lowest, n->y);
+            }
+        }
+    }
+
+    for (int k = 0; k < 64; k++)
+        reference_buckets[k].count = 0;
+
+    for (size_t k = 0; k < reference_fill_list.count; k++) {
+        size_t index = reference_index(reference_fill_list.voxels[k]);
+        reference_visited[index / 8] &= ~(1 << (index % 8));
+
+        if (!grounded) {
+            Vector3i * v = reference_fill_list.voxels + k;
+            libvxl_map_setair(&reference, v->x, v->z, map_size_y - 1 - v->y);
+        }
+    }
+
+    return grounded ? 0 : reference_fill_list.count;
+}
+
+// No solid voxel next to the block or below it, where a lone block can be put and detached again.
+static bool replay_clear(Vector3i pos) {
+    for (int y = pos.y - 2; y <= pos.y + 1; y++)
+        for (int x = pos.x - 1; x <= pos.x + 1; x++)
+            for (int z = pos.z - 1; z <= pos.z + 1; z++)
+                if (!map_isair(x, y, z))
+                    return false;
+
+    return true;
+}
+
+// The tests only start one falling blocks worker, which takes work packets in order. A lone block queued last is
+// gone once all edits before it are done.
+static void replay_wait(uint32_t * random) {
+    Vector3i pos;
+
+    do {
+        pos = (Vector3i) {
+            .x = 1 + test_random(random) % (map_size_x - 2),
+            .y = map_size_y - 2,
+            .z = 1 + test_random(random) % (map_size_z - 2),
+        };
+    } while (!replay_clear(pos));
+
+    map_set(pos.x, pos.y, pos.z, (TrueColor) {0x80, 0x60, 0x40, 255});
+    map_update_physics(pos.x, pos.y - 1, pos.z);
+
+    while (!map_isair(pos.x, pos.y, pos.z))
+        sched_yield();
+}
+
+// collects the blocks of one event, they are applied to both maps at once
+static void replay_event(uint32_t * random, Vector3i * pillars, size_t * pillar_count, VoxelList * placed,
+                         VoxelList * removed) {
+    int x = REPLAY_MARGIN + test_random(random) % (map_size_x - 2 * REPLAY_MARGIN);
+    int z = REPLAY_MARGIN + test_random(random) % (map_size_z - 2 * REPLAY_MARGIN);
+    int top = map_height_at(x, z);
+    int type = test_random(random) % 100;
+
+    if (type >= 80 && !*pillar_count)
+        type = 0;
+
+    if (type < 35) { // digging under the surface
+        voxel_list_add(removed, (Vector3i) {x, top - test_random(random) % 6, z});
+    } else if (type < 50) { // grenade
+        for (int k = 0; k < 27; k++)
+            voxel_list_add(removed, (Vector3i) {x + k % 3 - 1, top + k / 3 % 3 - 1, z + k / 9 - 1});
+    } else if (type < 65) { // bridge
+        int length = 3 + test_random(random) % 10;
+        bool along_x = test_random(random) & 1;
+
+        for (int k = 0; k < length && top + 1 < map_size_y - 4; k++)
+            voxel_list_add(placed, (Vector3i) {x + (along_x ? k : 0), top + 1, z + (along_x ? 0 : k)});
+    } else if (type < 80) { // floor on four pillars
+        int size = 3 + test_random(random) % 5;
+        int height = 3 + test_random(random) % 3;
+
+        if (top + 1 + height >= map_size_y - 4)
+            return;
+
+        for (int k = 0; k < 4; k++) {
+            Vector3i base = {x + (k & 1) * size, top + 1, z + (k >> 1) * size};
+            pillars[(*pillar_count)++ % REPLAY_PILLARS] = base;
+
+            for (int y = 0; y < height; y++)
+                voxel_list_add(placed, (Vector3i) {base.x, base.y + y, base.z});
+        }
+
+        for (int k = 0; k < (size + 1) * (size + 1); k++)
+            voxel_list_add(placed, (Vector3i) {x + k % (size + 1), top + 1 + height, z + k / (size + 1)});
+    } else { // undermining one pillar
+        voxel_list_add(removed, pillars[test_random(random) % min(*pillar_count, REPLAY_PILLARS)]);
+    }
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map generated;
+    test_map_generate(&generated, 512);
+
+    size_t size;
+    uint8_t * data = test_map_encode(&generated, &size);
+    libvxl_free(&generated);
+
+    map_init();
+    map_vxl_load(data, size);
+    libvxl_create(&reference, 512, 512, map_size_y, data, size);
+    free(data);
+
+    reference_visited = calloc(map_size_x * map_size_y * map_size_z / 8, 1);
+    CHECK_ALLOCATION_ERROR(reference_visited)
+
+    uint32_t random = 0x2545F491;
+    Vector3i pillars[REPLAY_PILLARS];
+    size_t pillar_count = 0;
+    VoxelList placed = {0}, removed = {0}, seeds = {0};
+
+    size_t structures = 0, checks = 0;
+    double runs = 0, flood_fill = 0;
+    int failures = 0;
+
+    for (int event = 0; event < REPLAY_EVENTS; event++) {
+        placed.count = removed.count = seeds.count = 0;
+        replay_event(&random, pillars, &pillar_count, &placed, &removed);
+
+        map_edit_begin();
+        for (size_t k = 0; k < placed.count; k++) {
+            Vector3i * v = placed.voxels + k;
+            map_edit_set(v->x, v->y, v->z, (TrueColor) {0x80, 0x60, 0x40, 255});
+            libvxl_map_set(&reference, v->x, v->z, map_size_y - 1 - v->y, 0x806040);
+        }
+
+        for (size_t k = 0; k < removed.count; k++) {
+            Vector3i * v = removed.voxels + k;
+
+            if (v->y <= 1) // the ground layers can't be destroyed
+                continue;
+
+            map_edit_set(v->x, v->y, v->z, White);
+            libvxl_map_setair(&reference, v->x, v->z, map_size_y - 1 - v->y);
+
+            voxel_list_add(&seeds, (Vector3i) {v->x + 1, v->y, v->z});
+            voxel_list_add(&seeds, (Vector3i) {v->x - 1, v->y, v->z});
+            voxel_list_add(&seeds, (Vector3i) {v->x, v->y + 1, v->z});
+            voxel_list_add(&seeds, (Vector3i) {v->x, v->y - 1, v->z});
+            voxel_list_add(&seeds, (Vector3i) {v->x, v->y, v->z + 1});
+            voxel_list_add(&seeds, (Vector3i) {v->x, v->y, v->z - 1});
+        }
+
+        double start = test_time();
+        map_edit_commit();
+        replay_wait(&random);
+        runs += test_time() - start;
+
+        start = test_time();
+        for (size_t k = 0; k < seeds.count; k++) {
+            if (reference_fill(seeds.voxels[k]))
+                structures++;
+        }
+        flood_fill += test_time() - start;
+
+        // every detached structure contains one of the seeds
+        bool equal = true;
+        for (size_t k = 0; k < seeds.count; k++) {
+            Vector3i * v = seeds.voxels + k;
+            equal &= map_isair(v->x, v->y, v->z) != reference_solid(v->x, v->y, v->z);
+        }
+
+        if (!equal) {
+            printf("event %i detached different structures\n", event);
+            failures++;
+        }
+
+        checks += seeds.count;
+    }
+
+    for (int x = 0; x < map_size_x; x++) {
+        for (int z = 0; z < map_size_z; z++) {
+            bool equal = true;
+            for (int y = 0; y < map_size_y; y++)
+                equal &= map_isair(x, y, z) != reference_solid(x, y, z);
+
+            if (!equal) {
+                printf("column %i,%i differs\n", x, z);
+                failures++;
+            }
+        }
+    }
+
+    printf("map_physics: %i events, %zu structures detached, runs %.1f us, flood fill %.1f us per check, %i "
+           "mismatches\n",
+           REPLAY_EVENTS, structures, runs / checks * 1e6, flood_fill / checks * 1e6, failures);
+
+    free(reference_visited);
+    libvxl_free(&reference);
+
+    return failures > 0;
+}
@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Casts random rays over a map and compares map_raycast() with a plain voxel by voxel walk in double precision. The
+// two may only disagree on rays that pass exactly through an edge or corner between cells, or end on a cell
+// boundary, where either order of the cells is right.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/map.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define RAYCAST_RAYS 100000
+#define RAYCAST_LENGTH 128.0F
+// crossings closer together than this, in cells along the ray, count as a tie
+#define RAYCAST_TIE 1e-3
+
+// Amanatides and Woo, which cell is entered next only depends on which side of the current one is crossed first.
+// Sets tie if that was close to undecided before the walk ended.
+static bool raycast_walk(Vector3f origin, Vector3f dir, float length, bool from_air, MapRayHit * hit, bool * tie) {
+    double p[3] = {origin.x, origin.y, origin.z};
+    double d[3] = {dir.x * length, dir.y * length, dir.z * length};
+    int cell[3], step[3];
+    double t_max[3], t_delta[3];
+
+    for (int k = 0; k < 3; k++) {
+        cell[k] = floor(p[k]);
+        step[k] = (d[k] > 0) - (d[k] < 0);
+        t_delta[k] = step[k] ? fabs(1.0 / d[k]) : INFINITY;
+        t_max[k] = step[k] ? ((step[k] > 0) ? cell[k] + 1 - p[k] : p[k] - cell[k]) * t_delta[k] : INFINITY;
+    }
+
+    int prev[3] = {cell[0], cell[1], cell[2]};
+    bool prev_solid = true;
+    double tolerance = RAYCAST_TIE / length;
+    *tie = false;
+
+    while (1) {
+        if (cell[0] < 0 || cell[2] < 0 || cell[0] >= map_size_x || cell[2] >= map_size_z || cell[1] < 0)
+            return false;
+
+        bool solid = !map_isair(cell[0], cell[1], cell[2]);
+
+        if (solid && (!from_air || !prev_solid)) {
+            *hit = (MapRayHit) {cell[0], cell[1], cell[2], prev[0], prev[1], prev[2]};
+            return true;
+        }
+
+        int axis = (t_max[0] < t_max[1]) ? ((t_max[0] < t_max[2]) ? 0 : 2) : ((t_max[1] < t_max[2]) ? 1 : 2);
+
+        for (int k = 0; k < 3; k++)
+            *tie |= k != axis && fabs(t_max[k] - t_max[axis]) < tolerance;
+
+        *tie |= fabs(t_max[axis] - 1.0) < tolerance;
+
+        if (t_max[axis] > 1.0)
+            return false;
+
+        for (int k = 0; k < 3; k++)
+            prev[k] = cell[k];
+
+        prev_solid = solid;
+        cell[axis] += step[axis];
+        t_max[axis] += t_delta[axis];
+    }
+}
+
+static float raycast_random(uint32_t * random) {
+    return (test_random(random) & 0xFFFFFF) / (float)0x1000000;
+}
+
+static Vector3f raycast_direction(uint32_t * random) {
+    float y = raycast_random(random) * 2.0F - 1.0F;
+    float angle = raycast_random(random) * 2.0F * 3.14159265F;
+    float r = sqrtf(1.0F - y * y);
+    return (Vector3f) {r * cosf(angle), y, r * sinf(angle)};
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map generated;
+    test_map_generate(&generated, 512);
+
+    size_t size;
+    uint8_t * data = test_map_encode(&generated, &size);
+    libvxl_free(&generated);
+
+    map_init();
+    map_vxl_load(data, size);
+    free(data);
+
+    uint32_t random = 0x2545F491;
+    int failures = 0, ties = 0;
+    double cast = 0, walk = 0;
+
+    for (int k = 0; k < RAYCAST_RAYS; k++) {
+        // at eye height for half of the rays, anywhere for the others, also inside of terrain
+        Vector3f origin = {
+            .x = raycast_random(&random) * map_size_x,
+            .y = raycast_random(&random) * map_size_y,
+            .z = raycast_random(&random) * map_size_z,
+        };
+
+        if (k & 1)
+            origin.y = min(map_height_at(origin.x, origin.z) + 2.5F, map_size_y - 0.5F);
+
+        Vector3f dir = raycast_direction(&random);
+        bool from_air = k & 2;
+
+        MapRayHit expected, hit;
+        bool tie;
+
+        double start = test_time();
+        bool found = map_raycast(origin.x, origin.y, origin.z, dir.x, dir.y, dir.z, RAYCAST_LENGTH, from_air, &hit);
+        cast += test_time() - start;
+
+        start = test_time();
+        bool expected_found = raycast_walk(origin, dir, RAYCAST_LENGTH, from_air, &expected, &tie);
+        walk += test_time() - start;
+
+        bool equal = found == expected_found
+            && (!found
+                || (hit.x == expected.x && hit.y == expected.y && hit.z == expected.z && hit.xb == expected.xb
+                    && hit.yb == expected.yb && hit.zb == expected.zb));
+
+        if (equal)
+            continue;
+
+        if (tie) {
+            ties++;
+        } else {
+            printf("ray from %f,%f,%f along %f,%f,%f differs\n", origin.x, origin.y, origin.z, dir.x, dir.y, dir.z);
+            failures++;
+        }
+    }
+
+    printf("map_raycast: %i rays, %.0f ns per ray, voxel walk %.0f ns, %i ties, %i mismatches\n", RAYCAST_RAYS,
+           cast / RAYCAST_RAYS * 1e9, walk / RAYCAST_RAYS * 1e9, ties, failures);
+
+    return failures > 0;
+}
@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Replays a compressed map the way it arrives from a server, in packets of random size, and checks that the
+// map decompressed and parsed on the fly is the same as the one loaded from the whole data at once. A stream
+// cut short must leave the current map as it was.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/chunk.h>
+#include <BetterSpades/map.h>
+
+#include <libvxl.h>
+#include <libdeflate.h>
+
+#include "testutil.h"
+
+#define STREAM_PACKET_MAX 8192
+
+// compares solid voxels and surface colors of the map in map.c with reference, returns the chunks that differ
+static int map_compare(struct libvxl_map * reference) {
+    struct libvxl_chunk_copy loaded = {0}, expected = {0};
+    int failures = 0;
+
+    for (int z = 0; z < map_size_z; z += CHUNK_SIZE) {
+        for (int x = 0; x < map_size_x; x += CHUNK_SIZE) {
+            map_copy_blocks(&loaded, x, z, 0, 0);
+            libvxl_copy_chunk(reference, &expected, x, z, 0, 0);
+
+            bool equal = loaded.blocks_sorted_count == expected.blocks_sorted_count
+                && !memcmp(loaded.blocks_sorted, expected.blocks_sorted,
+                           expected.blocks_sorted_count * sizeof(struct libvxl_block));
+
+            for (int k = 0; k < CHUNK_SIZE * CHUNK_SIZE * map_size_y && equal; k++) {
+                int bx = x + k % CHUNK_SIZE, bz = z + k / CHUNK_SIZE % CHUNK_SIZE, by = k / CHUNK_SIZE / CHUNK_SIZE;
+                equal = map_isair(bx, by, bz) != libvxl_map_issolid(reference, bx, bz, map_size_y - 1 - by);
+            }
+
+            if (!equal) {
+                printf("chunk %i,%i differs\n", x, z);
+                failures++;
+            }
+        }
+    }
+
+    libvxl_copy_chunk_destroy(&loaded);
+    libvxl_copy_chunk_destroy(&expected);
+    return failures;
+}
+
+// feeds the first length bytes of data in packets of random size
+static bool map_stream_replay(uint8_t * data, size_t length, uint32_t * random) {
+    map_vxl_stream_begin();
+
+    for (size_t offset = 0; offset < length;) {
+        size_t packet = min(1 + test_random(random) % STREAM_PACKET_MAX, length - offset);
+        map_vxl_stream_feed(data + offset, packet);
+        offset += packet;
+    }
+
+    return map_vxl_stream_finish();
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map generated, reference;
+    test_map_generate(&generated, 512);
+
+    size_t size;
+    uint8_t * data = test_map_encode(&generated, &size);
+    libvxl_create(&reference, 512, 512, map_size_y, data, size);
+    libvxl_free(&generated);
+
+    struct libdeflate_compressor * compressor = libdeflate_alloc_compressor(6);
+    size_t bound = libdeflate_zlib_compress_bound(compressor, size);
+    uint8_t * compressed = malloc(bound);
+    CHECK_ALLOCATION_ERROR(compressed)
+    size_t compressed_size = libdeflate_zlib_compress(compressor, data, size, compressed, bound);
+    libdeflate_free_compressor(compressor);
+    free(data);
+
+    map_init();
+
+    int failures = 0;
+    uint32_t random = 0x2545F491;
+
+    double start = test_time();
+    if (!map_stream_replay(compressed, compressed_size, &random)) {
+        printf("complete stream failed to load\n");
+        failures++;
+    }
+    double elapsed = test_time() - start;
+
+    failures += map_compare(&reference);
+
+    if (map_stream_replay(compressed, compressed_size / 2, &random)) {
+        printf("truncated stream loaded\n");
+        failures++;
+    }
+
+    failures += map_compare(&reference);
+
+    printf("map_stream: %zu compressed bytes replayed in %.0f ms, %i mismatches\n", compressed_size, elapsed * 1e3,
+           failures);
+
+    free(compressed);
+    libvxl_free(&reference);
+
+    return failures > 0;
+}
@@ -0,0 +1,119 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The tests only link the modules they exercise. Everything else those reference from the rest of the game is
+// replaced here by a definition that does nothing.
+
+#include <stddef.h>
+
+#include <BetterSpades/opengl.h>
+#include <BetterSpades/common.h>
+#include <BetterSpades/config.h>
+#include <BetterSpades/camera.h>
+#include <BetterSpades/matrix.h>
+#include <BetterSpades/texture.h>
+#include <BetterSpades/glx.h>
+#include <BetterSpades/particle.h>
+#include <BetterSpades/sound.h>
+#include <BetterSpades/window.h>
+
+Options settings;
+Camera camera;
+int glx_version;
+int glx_fog;
+mat4 matrix_view;
+mat4 matrix_model;
+mat4 matrix_projection;
+Texture * const texture_minimap = NULL;
+
+PFNGLBEGINQUERYPROC __glewBeginQuery;
+PFNGLENDQUERYPROC __glewEndQuery;
+PFNGLGENQUERIESPROC __glewGenQueries;
+PFNGLGETQUERYOBJECTUIVPROC __glewGetQueryObjectuiv;
+PFNGLDELETEPROGRAMPROC __glewDeleteProgram;
+PFNGLGETPROGRAMIVPROC __glewGetProgramiv;
+PFNGLGETUNIFORMLOCATIONPROC __glewGetUniformLocation;
+PFNGLUNIFORM1FPROC __glewUniform1f;
+PFNGLUNIFORM2FPROC __glewUniform2f;
+PFNGLUNIFORM3FPROC __glewUniform3f;
+PFNGLUSEPROGRAMPROC __glewUseProgram;
+
+void glEnable(GLenum cap) { }
+void glDisable(GLenum cap) { }
+void glEnableClientState(GLenum array) { }
+void glDisableClientState(GLenum array) { }
+void glColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) { }
+void glDepthMask(GLboolean flag) { }
+void glDepthFunc(GLenum func) { }
+void glBlendFunc(GLenum sfactor, GLenum dfactor) { }
+void glPolygonOffset(GLfloat factor, GLfloat units) { }
+
+int glx_shader(const char * vertex, const char * fragment) {
+    return 0;
+}
+
+void glx_draw_quads(size_t vertices, int type, const void * vertex, const void * color, const void * normal) { }
+void glx_displaylist_create(GLXDisplayList * x, bool has_color, bool has_normal) { }
+void glx_displaylist_destroy(GLXDisplayList * x) { }
+void glx_displaylist_update(GLXDisplayList * x, size_t size, int type, void * color, void * vertex, void * normal) { }
+void glx_displaylist_draw(GLXDisplayList * x, int type) { }
+void glx_arena_create(GLXArena * a, size_t capacity, int program) { }
+void glx_displaylist_create_arena(GLXDisplayList * x, GLXArena * a) { }
+void glx_arena_draw(GLXArena * a, GLXDisplayList ** lists, size_t count) { }
+
+int camera_CubeInFrustum(float x, float y, float z, float size, float size_y) {
+    return 1;
+}
+
+void camera_boxes_clear(CameraBoxes * boxes) { }
+void camera_boxes_add(CameraBoxes * boxes, float x0, float y0, float z0, float x1, float y1, float z1) { }
+void camera_boxes_cull(CameraBoxes * boxes) { }
+
+bool camera_boxes_visible(CameraBoxes * boxes, size_t index) {
+    return true;
+}
+
+void matrix_multiply(mat4 m, mat4 n) { }
+void matrix_load(mat4 m, mat4 n) { }
+void matrix_translate(mat4 m, float x, float y, float z) { }
+void matrix_push(mat4 m) { }
+void matrix_pop(mat4 m) { }
+void matrix_upload() { }
+void matrix_identity(mat4 m) { }
+void matrix_rotate(mat4 m, float angle, float x, float y, float z) { }
+void matrix_vector(mat4 m, vec4 v) { }
+
+void texture_subimage(Texture * t, int xoffset, int yoffset, size_t width, size_t height, const void * data) { }
+
+void particle_create(TrueColor color, float x, float y, float z, float velocity, float velocity_y, int amount,
+                     float min_size, float max_size) { }
+
+WAV * sound(enum WAV wav) {
+    return NULL;
+}
+
+void sound_create(SoundSpace space, WAV * wav, float x, float y, float z) { }
+
+float window_time() {
+    return 0.0F;
+}
+
+int window_cpucores() {
+    return 1;
+}
@@ -0,0 +1,33 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// The map for tests of modules that read from it without linking map.c.
+
+#include <stddef.h>
+
+#include <BetterSpades/map.h>
+
+int map_size_x = 512;
+int map_size_y = 64;
+int map_size_z = 512;
+
+float fog_color[4];
+
+void map_copy_blocks(struct libvxl_chunk_copy * copy, size_t x, size_t y, size_t halo, size_t halo_behind) { }
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include <BetterSpades/common.h>
+#include <BetterSpades/chunk.h>
+
+#include "testutil.h"
+
+static uint32_t random_state;
+
+uint32_t test_random(uint32_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint32_t random_next() {
+    return test_random(&random_state);
+}
+
+static int random_range(int from, int to) {
+    return from + random_next() % (to - from + 1);
+}
+
+static uint32_t terrain_color(int y) {
+    static const uint32_t palette[] = {0x6A5A3C, 0x6E5E40, 0x4C7A34, 0x507E38, 0x808080};
+    // mostly the same color per layer, so that quads merge but not across every layer
+    return palette[(y / 3 + (random_next() % 8 == 0)) % (sizeof(palette) / sizeof(*palette))];
+}
+
+// hills, caves, overhangs and floating blocks, in libvxl coordinates (z = 0 is the top of the map)
+void test_map_generate(struct libvxl_map * map, int size) {
+    random_state = 0x2545F491;
+    libvxl_create(map, size, size, CHUNK_HEIGHT, NULL, 0);
+
+    for (int x = 0; x < size; x++) {
+        for (int z = 0; z < size; z++) {
+            int height = 24 + 14 * sinf(x * 0.11F) * cosf(z * 0.07F) + random_range(0, 2);
+            for (int y = 0; y < height; y++)
+                libvxl_map_set(map, x, z, CHUNK_HEIGHT - 1 - y, terrain_color(y));
+        }
+    }
+
+    for (int k = 0; k < size * size / 400; k++) {
+        int cx = random_range(0, size - 1), cy = random_range(4, 40), cz = random_range(0, size - 1);
+        int r = random_range(2, 6);
+        for (int x = cx - r; x <= cx + r; x++)
+            for (int y = max(cy - r, 1); y <= cy + r && y < CHUNK_HEIGHT; y++)
+                for (int z = cz - r; z <= cz + r; z++)
+                    if ((x - cx) * (x - cx) + (y - cy) * (y - cy) + (z - cz) * (z - cz) <= r * r)
+                        libvxl_map_setair(map, (x + size) % size, (z + size) % size, CHUNK_HEIGHT - 1 - y);
+    }
+
+    for (int k = 0; k < size * size / 270; k++) {
+        int cx = random_range(0, size - 1), cy = random_range(20, CHUNK_HEIGHT - 2), cz = random_range(0, size - 1);
+        int sx = random_range(1, 8), sy = random_range(1, 3), sz = random_range(1, 8);
+        uint32_t color = terrain_color(cy);
+        for (int x = cx; x < cx + sx; x++)
+            for (int y = cy; y < cy + sy && y < CHUNK_HEIGHT; y++)
+                for (int z = cz; z < cz + sz; z++)
+                    libvxl_map_set(map, x % size, z % size, CHUNK_HEIGHT - 1 - y, color);
+    }
+}
+
+bool test_map_create(struct libvxl_map * map, const char * filename) {
+    if (!filename) {
+        test_map_generate(map, 512);
+        return true;
+    }
+
+    FILE * f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    void * data = malloc(size);
+    CHECK_ALLOCATION_ERROR(data)
+    bool loaded = fread(data, 1, size, f) == (size_t)size && libvxl_create(map, 512, 512, CHUNK_HEIGHT, data, size);
+
+    fclose(f);
+    free(data);
+    return loaded;
+}
+
+uint8_t * test_map_encode(struct libvxl_map * map, size_t * size) {
+    // a column has at most one span header or color per voxel, plus the last header
+    uint8_t * data = malloc(map->width * map->height * (map->depth * 2 + 1) * 4);
+    CHECK_ALLOCATION_ERROR(data)
+
+    libvxl_write(map, data, size);
+    return data;
+}
+
+double test_time() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
@@ -0,0 +1,39 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libvxl.h>
+
+// Creates a square map of the given width with the same terrain on every run
+void test_map_generate(struct libvxl_map * map, int size);
+// Loads a 512x512 map from a .vxl file, or generates one if filename is NULL
+bool test_map_create(struct libvxl_map * map, const char * filename);
+// Returns the map in .vxl format, to be freed by the caller
+uint8_t * test_map_encode(struct libvxl_map * map, size_t * size);
+// Next number of a xorshift sequence, the state must not be 0
+uint32_t test_random(uint32_t * state);
+// Seconds on a monotonic clock, for measurements
+double test_time(void);
+
+#endif
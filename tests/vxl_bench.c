@@ -0,0 +1,239 @@
+/*
+    Copyright (c) 2017-2020 ByteBit
+
+    This file is part of BetterSpades.
+
+    BetterSpades is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    BetterSpades is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with BetterSpades.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Reports how fast libvxl parses and writes a .vxl map on one and on several threads, how fast the top block of
+// every column is found compared to testing voxel by voxel, and how many block edits it gets through. Pass a .vxl file
+// to measure a real map, a generated one is used otherwise.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <BetterSpades/common.h>
+
+#include <libvxl.h>
+
+#include "testutil.h"
+
+#define BENCH_RUNS 10
+#define BENCH_THREADS_MAX 16
+#define BENCH_EDITS 50000
+
+enum bench_edit {
+    BENCH_EDIT_SET,
+    BENCH_EDIT_SETAIR,
+    BENCH_EDIT_GRENADE,
+};
+
+// loads data BENCH_RUNS times, returns false if the map differs from the one loaded on a single thread
+static bool bench_load(uint8_t * data, size_t size, int threads) {
+    struct libvxl_map map;
+    double best = 1e9, total = 0;
+    bool success = true;
+
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        double start = test_time();
+        success &= libvxl_create_parallel(&map, 512, 512, 64, data, size, threads);
+        double elapsed = test_time() - start;
+
+        best = min(best, elapsed);
+        total += elapsed;
+
+        if (k < BENCH_RUNS - 1)
+            libvxl_free(&map);
+    }
+
+    size_t encoded_size;
+    uint8_t * encoded = test_map_encode(&map, &encoded_size);
+    success &= encoded_size == size && !memcmp(encoded, data, size);
+    free(encoded);
+    libvxl_free(&map);
+
+    printf("load %2i threads %8.2f ms best %8.2f ms avg %8.1f MB/s%s\n", threads, best * 1e3,
+           total / BENCH_RUNS * 1e3, size / best * 1e-6, success ? "" : " (differs)");
+
+    return success;
+}
+
+static void bench_save_band(void * user, size_t band, void * data, size_t size) {
+    __atomic_add_fetch((size_t *) user, size, __ATOMIC_RELAXED);
+    libvxl_mem_free(data);
+}
+
+// writes map BENCH_RUNS times, returns false if the output size is not the expected one
+static bool bench_save(struct libvxl_map * map, size_t expected, int threads) {
+    uint8_t * out = malloc(map->width * map->height * (map->depth * 2 + 1) * 4);
+    CHECK_ALLOCATION_ERROR(out)
+
+    double best = 1e9, total = 0;
+    bool success = true;
+
+    for (int k = 0; k < BENCH_RUNS; k++) {
+        size_t size = 0;
+
+        double start = test_time();
+        if (threads > 1) {
+            libvxl_write_parallel(map, threads, bench_save_band, &size);
+        } else {
+            libvxl_write(map, out, &size);
+        }
+        double elapsed = test_time() - start;
+
+        best = min(best, elapsed);
+        total += elapsed;
+        success &= size == expected;
+    }
+
+    free(out);
+
+    printf("save %2i threads %8.2f ms best %8.2f ms avg %8.1f MB/s%s\n", threads, best * 1e3,
+           total / BENCH_RUNS * 1e3, expected / best * 1e-6, success ? "" : " (differs)");
+
+    return success;
+}
+
+// the way the top block was found before the geometry was searched a word at a time
+static void bench_gettop_voxels(struct libvxl_map * map, int x, int y, uint32_t * result) {
+    for (int z = 0; z < (int) map->depth; z++) {
+        if (libvxl_map_issolid(map, x, y, z)) {
+            result[0] = libvxl_map_get(map, x, y, z);
+            result[1] = z;
+            return;
+        }
+    }
+}
+
+// finds the top block of every column both ways, returns false if they disagree
+static bool bench_gettop(struct libvxl_map * map) {
+    size_t columns = map->width * map->height;
+    uint32_t(*top)[2] = malloc(columns * sizeof(*top));
+    CHECK_ALLOCATION_ERROR(top)
+
+    double start = test_time();
+    for (size_t k = 0; k < columns; k++)
+        libvxl_map_gettop(map, k % map->width, k / map->width, top[k]);
+    double words = test_time() - start;
+
+    bool success = true;
+
+    start = test_time();
+    for (size_t k = 0; k < columns; k++) {
+        uint32_t result[2] = {0, 0};
+        bench_gettop_voxels(map, k % map->width, k / map->width, result);
+        success &= result[0] == top[k][0] && result[1] == top[k][1];
+    }
+    double voxels = test_time() - start;
+
+    free(top);
+
+    printf("gettop %zu columns %8.2f ms, voxel by voxel %8.2f ms%s\n", columns, words * 1e3, voxels * 1e3,
+           success ? "" : " (differs)");
+
+    return success;
+}
+
+// edits a fresh copy of the map at random columns on the surface, where blocks are placed and destroyed in game
+static void bench_edit(uint8_t * data, size_t size, enum bench_edit type) {
+    struct libvxl_map map;
+    libvxl_create(&map, 512, 512, 64, data, size);
+
+    uint32_t random = 0x2545F491;
+    size_t blocks = 0;
+
+    double start = test_time();
+
+    for (int k = 0; k < BENCH_EDITS; k++) {
+        int x = test_random(&random) % map.width;
+        int y = test_random(&random) % map.height;
+        uint32_t top[2];
+        libvxl_map_gettop(&map, x, y, top);
+
+        switch (type) {
+            case BENCH_EDIT_SET:
+                libvxl_map_set(&map, x, y, max((int) top[1] - 1, 0), 0x806040);
+                blocks++;
+                break;
+            case BENCH_EDIT_SETAIR:
+                // the bottom layer cannot be destroyed in game either
+                if (top[1] < map.depth - 1) {
+                    libvxl_map_setair(&map, x, y, top[1]);
+                    blocks++;
+                }
+                break;
+            case BENCH_EDIT_GRENADE:
+                // same 3x3x3 blocks as ACTION_GRENADE
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        for (int dz = -1; dz <= 1; dz++) {
+                            int z = top[1] + dz;
+                            if (z >= 0 && z < (int) map.depth - 1) {
+                                libvxl_map_setair(&map, (x + dx) & (map.width - 1), (y + dy) & (map.height - 1), z);
+                                blocks++;
+                            }
+                        }
+                    }
+                }
+                break;
+        }
+    }
+
+    double elapsed = test_time() - start;
+
+    libvxl_free(&map);
+
+    const char * names[] = {"set", "setair", "grenade"};
+    printf("edit %-8s %i ops %8.2f us/op %8.2f us/block\n", names[type], BENCH_EDITS, elapsed / BENCH_EDITS * 1e6,
+           elapsed / max(blocks, 1) * 1e6);
+}
+
+int main(int argc, char ** argv) {
+    struct libvxl_map source;
+
+    if (!test_map_create(&source, argc > 1 ? argv[1] : NULL)) {
+        fprintf(stderr, "could not load map %s\n", argv[1]);
+        return 1;
+    }
+
+    size_t size;
+    uint8_t * data = test_map_encode(&source, &size);
+
+    printf("map %s, %zu bytes\n", argc > 1 ? argv[1] : "generated", size);
+
+    // more threads than cores still show the cost of splitting the work
+    int cores = clamp(2, BENCH_THREADS_MAX, sysconf(_SC_NPROCESSORS_ONLN));
+    bool success = true;
+
+    for (int threads = 1; threads <= cores; threads *= 2)
+        success &= bench_load(data, size, threads);
+
+    for (int threads = 1; threads <= cores; threads *= 2)
+        success &= bench_save(&source, size, threads);
+
+    success &= bench_gettop(&source);
+
+    for (enum bench_edit type = BENCH_EDIT_SET; type <= BENCH_EDIT_GRENADE; type++)
+        bench_edit(data, size, type);
+
+    free(data);
+    libvxl_free(&source);
+
+    return !success;
+}